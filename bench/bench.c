@@ -0,0 +1,281 @@
+/* Microbenchmarks of ljs's own hot paths: runtime and context creation,
+ * compiling a module graph, saving it as a bundle, reading the bundle back
+ * and running it. The graphs are synthetic binary trees of modules,
+ * generated into a temporary directory at sizes 1, 10, 100 and 1000.
+ *
+ *   ljs-bench [--json] [--time <ms>] [--max <modules>]
+ */
+#include "clock.h"
+#include "jsc.h"
+#include "module.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mimalloc.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#include <io.h>
+#define rmdir _rmdir
+#else
+#include <unistd.h>
+#endif
+
+static int json;
+static int time_ms = 500;
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, int modules, double *s, int n) {
+    double mean = 0, var = 0;
+
+    qsort(s, n, sizeof(s[0]), cmp_double);
+    for (int i = 0; i < n; ++i)
+        mean += s[i];
+    mean /= n;
+    for (int i = 0; i < n; ++i)
+        var += (s[i] - mean) * (s[i] - mean);
+    var = n > 1 ? var / (n - 1) : 0;
+
+    double median = n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+    double p99 = s[(int)ceil(n * 0.99) - 1];
+
+    if (json)
+        printf("{\"name\":\"%s\",\"modules\":%d,\"samples\":%d,"
+               "\"median_ns\":%.0f,\"p99_ns\":%.0f,\"mean_ns\":%.0f,"
+               "\"stddev_ns\":%.0f}\n",
+               name, modules, n, median, p99, mean, sqrt(var));
+    else
+        printf("%-10s %6d modules %6d samples  median %10.1fus  p99 "
+               "%10.1fus  stddev %8.1fus\n",
+               name, modules, n, median / 1e3, p99 / 1e3, sqrt(var) / 1e3);
+}
+
+/* Writes m0.js .. m<n-1>.js; module k imports 2k+1 and 2k+2, so m0.js
+ * reaches the whole tree. Each carries a few functions, so that the
+ * bytecode is not trivially small. */
+static int write_graph(const char *dir, int n) {
+    char path[1024];
+
+    for (int k = 0; k < n; ++k) {
+        snprintf(path, sizeof(path), "%s/m%d.js", dir, k);
+        FILE *fp = fopen(path, "w");
+        if (!fp) {
+            perror(path);
+            return -1;
+        }
+        for (int c = 2 * k + 1; c <= 2 * k + 2 && c < n; ++c)
+            fprintf(fp, "import { f%d } from \"./m%d.js\";\n", c, c);
+        for (int j = 0; j < 4; ++j)
+            fprintf(fp,
+                    "function g%d_%d(x) {\n"
+                    "    let s = x;\n"
+                    "    for (let i = 0; i < 8; i++)\n"
+                    "        s = (s * 31 + i) | 0;\n"
+                    "    return { v: s, tag: \"m%d\" };\n"
+                    "}\n",
+                    k, j, k);
+        fprintf(fp, "export function f%d(x) {\n    let r = g%d_0(x).v", k, k);
+        for (int c = 2 * k + 1; c <= 2 * k + 2 && c < n; ++c)
+            fprintf(fp, " + f%d(x)", c);
+        fprintf(fp, ";\n    return r | 0;\n}\n");
+        if (k == 0)
+            fprintf(fp, "f0(1);\n");
+        fclose(fp);
+    }
+    return 0;
+}
+
+static void remove_graph(const char *dir, int n) {
+    char path[1024];
+    for (int k = 0; k < n; ++k) {
+        snprintf(path, sizeof(path), "%s/m%d.js", dir, k);
+        remove(path);
+    }
+    snprintf(path, sizeof(path), "%s/a.pbc", dir);
+    remove(path);
+}
+
+enum { OP_CREATE, OP_COMPILE, OP_SAVE, OP_READ, OP_RUN, OP_COUNT };
+static const char *op_names[OP_COUNT] = {"create", "compile", "save", "read",
+                                         "run"};
+
+/* One round of op on the graph rooted at entry; returns its duration, or
+ * -1 when it fails. Everything around the measured call is set up and
+ * torn down outside the timing. */
+static double round_once(int op, const char *entry, const char *pbc) {
+    JSRuntime *rt;
+    lanyt_js *ljs = NULL;
+    uint64_t t0, t = 0;
+    int r = 0;
+
+    t0 = ljs_clock_ns();
+    rt = lanyt_jsc_new_rt();
+    if (rt)
+        ljs = lanyt_new_js(rt);
+    if (op == OP_CREATE)
+        t = ljs_clock_ns() - t0;
+    if (!ljs)
+        goto done;
+
+    switch (op) {
+    case OP_COMPILE:
+        t0 = ljs_clock_ns();
+        r = lanyt_js_eval(ljs, entry);
+        t = ljs_clock_ns() - t0;
+        break;
+    case OP_SAVE:
+        r = lanyt_js_eval(ljs, entry);
+        if (r)
+            break;
+        t0 = ljs_clock_ns();
+        r = lanyt_js_save(ljs, pbc, 0);
+        t = ljs_clock_ns() - t0;
+        break;
+    case OP_READ:
+        t0 = ljs_clock_ns();
+        r = lanyt_js_read(ljs, pbc, NULL);
+        t = ljs_clock_ns() - t0;
+        break;
+    case OP_RUN:
+        r = lanyt_js_read(ljs, pbc, NULL);
+        if (r)
+            break;
+        t0 = ljs_clock_ns();
+        r = lanyt_js_run(ljs, 0);
+        t = ljs_clock_ns() - t0;
+        break;
+    default:
+        break;
+    }
+done:
+    lanyt_free_js(ljs);
+    if (rt)
+        lanyt_jsc_free_rt(rt);
+    if (!ljs || r)
+        return -1;
+    return (double)t;
+}
+
+static int measure(int op, int modules, const char *entry, const char *pbc) {
+    uint64_t start = ljs_clock_ns(), budget = (uint64_t)time_ms * 1000000;
+    double *s = NULL;
+    int n = 0, cap = 0;
+
+    // one untimed round warms the file cache and the allocator
+    if (round_once(op, entry, pbc) < 0)
+        return -1;
+    while (n < 5 || (ljs_clock_ns() - start < budget && n < 100000)) {
+        if (n >= cap) {
+            cap = cap ? cap * 2 : 64;
+            double *a = mi_realloc(s, sizeof(s[0]) * cap);
+            if (!a)
+                break;
+            s = a;
+        }
+        double t = round_once(op, entry, pbc);
+        if (t < 0) {
+            mi_free(s);
+            return -1;
+        }
+        s[n++] = t;
+    }
+    if (n)
+        report(op_names[op], modules, s, n);
+    mi_free(s);
+    return 0;
+}
+
+static char *make_dir(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    char base[MAX_PATH], *dir;
+    if (!GetTempPathA(MAX_PATH, base))
+        return NULL;
+    dir = mi_malloc(MAX_PATH + 32);
+    if (!dir)
+        return NULL;
+    snprintf(dir, MAX_PATH + 32, "%sljs-bench-XXXXXX", base);
+    if (_mktemp_s(dir, strlen(dir) + 1) || _mkdir(dir)) {
+        mi_free(dir);
+        return NULL;
+    }
+    for (char *c = dir; *c; ++c)
+        if (*c == '\\')
+            *c = '/';
+    return dir;
+#else
+    const char *base = getenv("TMPDIR");
+    size_t len;
+    char *dir;
+    if (!base || !*base)
+        base = "/tmp";
+    len = strlen(base) + 32;
+    dir = mi_malloc(len);
+    if (!dir)
+        return NULL;
+    snprintf(dir, len, "%s/ljs-bench-XXXXXX", base);
+    if (!mkdtemp(dir)) {
+        mi_free(dir);
+        return NULL;
+    }
+    return dir;
+#endif
+}
+
+int main(int argc, char **argv) {
+    int max = 1000, ret = 0;
+    char entry[1024], pbc[1024];
+    char *dir;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--json")) {
+            json = 1;
+        } else if (!strcmp(argv[i], "--time") && i + 1 < argc) {
+            time_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max") && i + 1 < argc) {
+            max = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--time <ms>] [--max <n>]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    lanyt_js_module_init();
+    dir = make_dir();
+    if (!dir) {
+        perror("temporary directory");
+        return 1;
+    }
+    snprintf(entry, sizeof(entry), "%s/m0.js", dir);
+    snprintf(pbc, sizeof(pbc), "%s/a.pbc", dir);
+
+    if (measure(OP_CREATE, 0, entry, pbc))
+        ret = 1;
+    for (int size = 1; !ret && size <= max; size *= 10) {
+        if (write_graph(dir, size)) {
+            ret = 1;
+            break;
+        }
+        // later ops read the bundle that save leaves behind
+        for (int op = OP_COMPILE; op < OP_COUNT && !ret; ++op) {
+            if (measure(op, size, entry, pbc)) {
+                fprintf(stderr, "%s failed at %d modules\n", op_names[op],
+                        size);
+                ret = 1;
+            }
+        }
+        remove_graph(dir, size);
+    }
+
+    rmdir(dir);
+    mi_free(dir);
+    lanyt_js_module_free();
+    return ret;
+}
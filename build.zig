@@ -1,32 +1,47 @@
 const std = @import("std");
 
-pub fn build(b: *std.Build) void {
-    const target = b.standardTargetOptions(.{});
+const flags = &.{
+    "-Wall",
+    "-Wno-array-bounds",
+    "-fwrapv",
+    "-fvisibility=hidden",
+    "-DCONFIG_VERSION=\"2024-02-14\"",
+    // "-DCONFIG_CHECK_JSVALUE",
+};
+
+// everything but an entry point, shared by ljs and ljs-bench
+const lib_files = &.{ "jsc.c", "module.c", "bundle.c", "lz.c", "cache.c", "deps.c", "pool.c", "ffi.c", "fs.c", "prof.c", "trace.c", "intrin.c", "resolve.c", "exe.c", "loop.c", "worker.c", "watch.c" };
 
+fn addLjsExecutable(b: *std.Build, target: std.Build.ResolvedTarget, name: []const u8, main: []const u8) *std.Build.Step.Compile {
     const exe = b.addExecutable(.{
-        .name = "ljs",
+        .name = name,
         .target = target,
         .optimize = .ReleaseSafe,
     });
 
     exe.linkLibC();
+    exe.addIncludePath(.{ .path = "." });
     exe.addIncludePath(.{ .path = "../quickjs" });
     exe.addLibraryPath(.{ .path = "../quickjs/zig-out/lib" });
     exe.linkSystemLibrary("quickjs");
     exe.linkSystemLibrary("mimalloc");
     exe.linkSystemLibrary("c");
+    exe.linkSystemLibrary("m");
     exe.linkSystemLibrary("dl");
-    exe.addCSourceFiles(.{
-        .files = &.{ "main.c", "jsc.c", "module.c" },
-        .flags = &.{
-            "-Wall",
-            "-Wno-array-bounds",
-            "-fwrapv",
-            "-fvisibility=hidden",
-            "-DCONFIG_VERSION=\"2024-02-14\"",
-            // "-DCONFIG_CHECK_JSVALUE",
-        },
-    });
+    exe.linkSystemLibrary("pthread");
+    exe.addCSourceFile(.{ .file = .{ .path = main }, .flags = flags });
+    exe.addCSourceFiles(.{ .files = lib_files, .flags = flags });
+    return exe;
+}
+
+pub fn build(b: *std.Build) void {
+    const target = b.standardTargetOptions(.{});
+
+    b.installArtifact(addLjsExecutable(b, target, "ljs", "main.c"));
 
-    b.installArtifact(exe);
+    // zig build bench: microbenchmarks of compile, save, read, run
+    const bench = addLjsExecutable(b, target, "ljs-bench", "bench/bench.c");
+    const run_bench = b.addRunArtifact(bench);
+    if (b.args) |args| run_bench.addArgs(args);
+    b.step("bench", "Run the C microbenchmarks").dependOn(&run_bench.step);
 }
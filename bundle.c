@@ -0,0 +1,531 @@
+#include "bundle.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mimalloc.h>
+
+#define HEADER_SIZE_V2 32
+#define HEADER_SIZE 48
+#define TOC_ENTRY_SIZE 56
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (i * 8);
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++)
+        p[i] = v >> (i * 8);
+}
+
+static uint16_t get_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static size_t put_leb128(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    do {
+        uint8_t c = v & 0x7f;
+        v >>= 7;
+        if (p)
+            p[n] = c | (v ? 0x80 : 0);
+        n++;
+    } while (v);
+    return n;
+}
+
+// bytes used, 0 if the number runs past end
+static size_t get_leb128(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    size_t n = 0;
+    *v = 0;
+    while (p + n < end && n < 10) {
+        *v |= (uint64_t)(p[n] & 0x7f) << (n * 7);
+        if (!(p[n++] & 0x80))
+            return n;
+    }
+    return 0;
+}
+
+static int name_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    int r = memcmp(a, b, alen < blen ? alen : blen);
+    if (r)
+        return r;
+    return alen < blen ? -1 : alen > blen;
+}
+
+static int in_image(const ljs_bundle *b, uint64_t off, uint64_t len) {
+    return off <= b->image_len && len <= b->image_len - off;
+}
+
+int ljs_bundle_probe(const uint8_t *image, size_t image_len) {
+    return image_len >= HEADER_SIZE_V2 && !memcmp(image, LJS_BUNDLE_MAGIC, 4);
+}
+
+static int open_dict(ljs_bundle *b, uint64_t off, uint64_t len) {
+    const uint8_t *offs;
+    uint64_t count, strings_len;
+
+    if (!in_image(b, off, len) || len < 4)
+        return -1;
+    count = get_u32(b->image + off);
+    if ((count + 1) * 4 > len - 4)
+        return -1;
+    strings_len = len - 4 - (count + 1) * 4;
+    offs = b->image + off + 4;
+    for (uint64_t i = 0; i < count; i++) {
+        if (get_u32(offs + i * 4) > get_u32(offs + i * 4 + 4))
+            return -1;
+    }
+    if (get_u32(offs) != 0 || get_u32(offs + count * 4) > strings_len)
+        return -1;
+    b->dict = b->image + off;
+    b->dict_count = count;
+    return 0;
+}
+
+int ljs_bundle_open(ljs_bundle *b, const uint8_t *image, size_t image_len) {
+    uint64_t names, names_len;
+    uint16_t version;
+
+    if (!ljs_bundle_probe(image, image_len))
+        return -1;
+    version = get_u16(image + 4);
+    if (version != 2 && version != LJS_BUNDLE_VERSION)
+        return -2;
+
+    b->image = image;
+    b->image_len = image_len;
+    b->flags = get_u16(image + 6);
+    b->count = get_u32(image + 8);
+    b->entry = get_u32(image + 12);
+    b->toc = version == 2 ? HEADER_SIZE_V2 : HEADER_SIZE;
+    b->dict = NULL;
+    b->dict_count = 0;
+    if (image_len < b->toc)
+        return -3;
+    names = get_u64(image + 16);
+    names_len = get_u64(image + 24) - names;
+
+    if (b->entry >= b->count ||
+        (uint64_t)b->count * TOC_ENTRY_SIZE > image_len - b->toc ||
+        names < b->toc + (uint64_t)b->count * TOC_ENTRY_SIZE ||
+        !in_image(b, names, names_len))
+        return -3;
+    if (version >= 3 && get_u64(image + 40) &&
+        open_dict(b, get_u64(image + 32),
+                  get_u64(image + 40) - get_u64(image + 32)))
+        return -3;
+
+    for (uint32_t i = 0; i < b->count; i++) {
+        const uint8_t *e = image + b->toc + i * TOC_ENTRY_SIZE;
+        if ((uint64_t)get_u32(e) + get_u32(e + 4) > names_len ||
+            !in_image(b, get_u64(e + 16), get_u64(e + 24)) ||
+            !in_image(b, get_u64(e + 40), get_u64(e + 48)))
+            return -3;
+    }
+    return 0;
+}
+
+void ljs_bundle_get(const ljs_bundle *b, uint32_t idx, ljs_bundle_module *m) {
+    const uint8_t *e = b->image + b->toc + idx * TOC_ENTRY_SIZE;
+    const uint8_t *names = b->image + get_u64(b->image + 16);
+
+    m->name = (const char *)names + get_u32(e);
+    m->name_len = get_u32(e + 4);
+    m->flags = get_u32(e + 8);
+    m->intrinsics = get_u32(e + 12);
+    m->data = b->image + get_u64(e + 16);
+    m->size = get_u64(e + 24);
+    m->raw_size = get_u64(e + 32);
+    m->debug_size = get_u64(e + 48);
+    m->debug = m->debug_size ? b->image + get_u64(e + 40) : NULL;
+}
+
+int ljs_bundle_find(const ljs_bundle *b, const char *name) {
+    const uint8_t *names = b->image + get_u64(b->image + 16);
+    size_t len = strlen(name);
+    uint32_t lo = 0, hi = b->count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const uint8_t *e = b->image + b->toc + mid * TOC_ENTRY_SIZE;
+        int r = name_cmp(name, len, (const char *)names + get_u32(e),
+                         get_u32(e + 4));
+        if (r == 0)
+            return mid;
+        if (r < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+size_t ljs_bundle_expand(const ljs_bundle *b, const uint8_t *data,
+                         size_t size, uint8_t *out) {
+    const uint8_t *p = data + 1, *end = data + size, *offs, *strings;
+    uint64_t count, idx;
+    size_t total, n;
+
+    if (!b->dict || size < 1)
+        return 0;
+    offs = b->dict + 4;
+    strings = offs + ((size_t)b->dict_count + 1) * 4;
+    n = get_leb128(p, end, &count);
+    if (!n)
+        return 0;
+    // the version byte and the count stay as they are
+    total = 1 + n;
+    if (out)
+        memcpy(out, data, total);
+    p += n;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t start, len;
+        n = get_leb128(p, end, &idx);
+        if (!n || idx >= b->dict_count)
+            return 0;
+        p += n;
+        start = get_u32(offs + idx * 4);
+        len = get_u32(offs + idx * 4 + 4) - start;
+        if (out)
+            memcpy(out + total, strings + start, len);
+        total += len;
+    }
+    if (out)
+        memcpy(out + total, p, end - p);
+    return total + (end - p);
+}
+
+typedef struct dict_record {
+    struct dict_record *next;
+    uint8_t data[];
+} dict_record;
+
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+    uint64_t hash;
+} dict_entry;
+
+struct ljs_bundle_dict {
+    uint8_t *strings; // every entry back to back, as JS_WriteObject wrote it
+    size_t len;
+    size_t cap;
+    dict_entry *entries;
+    uint32_t count;
+    uint32_t entries_cap;
+    uint32_t *table; // open addressing, entry index + 1, 0 is empty
+    uint32_t mask;
+    dict_record *records;
+};
+
+ljs_bundle_dict *ljs_bundle_dict_new(void) {
+    return mi_zalloc(sizeof(ljs_bundle_dict));
+}
+
+void ljs_bundle_dict_free(ljs_bundle_dict *d) {
+    if (!d)
+        return;
+    while (d->records) {
+        dict_record *r = d->records;
+        d->records = r->next;
+        mi_free(r);
+    }
+    mi_free(d->strings);
+    mi_free(d->entries);
+    mi_free(d->table);
+    mi_free(d);
+}
+
+static uint32_t *dict_slot(ljs_bundle_dict *d, uint32_t *table, uint32_t mask,
+                           const uint8_t *s, uint32_t len, uint64_t hash) {
+    uint32_t i = hash & mask;
+    while (table[i]) {
+        const dict_entry *e = &d->entries[table[i] - 1];
+        if (e->hash == hash && e->len == len &&
+            !memcmp(d->strings + e->off, s, len))
+            break;
+        i = (i + 1) & mask;
+    }
+    return &table[i];
+}
+
+// a buffer of len bytes, freed with d
+static dict_record *dict_record_new(ljs_bundle_dict *d, size_t len) {
+    dict_record *r = mi_malloc(sizeof(dict_record) + len);
+    if (r) {
+        r->next = d->records;
+        d->records = r;
+    }
+    return r;
+}
+
+// index of s in d, added if new; -1 when out of memory
+static int64_t dict_intern(ljs_bundle_dict *d, const uint8_t *s, size_t len) {
+    uint64_t hash = ljs_hash64(s, len, 0);
+    uint32_t *slot;
+    dict_entry *e;
+
+    if (len > UINT32_MAX - d->len)
+        return -1;
+    if ((d->count + 1) * 2 > d->mask) {
+        uint32_t mask = d->mask ? d->mask * 2 + 1 : 255;
+        uint32_t *table = mi_calloc(mask + 1, sizeof(uint32_t));
+        if (!table)
+            return -1;
+        for (uint32_t i = 0; i < d->count; i++) {
+            e = &d->entries[i];
+            *dict_slot(d, table, mask, d->strings + e->off, e->len,
+                       e->hash) = i + 1;
+        }
+        mi_free(d->table);
+        d->table = table;
+        d->mask = mask;
+    }
+    slot = dict_slot(d, d->table, d->mask, s, len, hash);
+    if (*slot)
+        return *slot - 1;
+
+    if (d->count == d->entries_cap) {
+        uint32_t cap = d->entries_cap ? d->entries_cap * 2 : 256;
+        dict_entry *a = mi_realloc(d->entries, sizeof(dict_entry) * cap);
+        if (!a)
+            return -1;
+        d->entries = a;
+        d->entries_cap = cap;
+    }
+    if (d->len + len > d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 4096;
+        uint8_t *a;
+        while (cap < d->len + len)
+            cap *= 2;
+        a = mi_realloc(d->strings, cap);
+        if (!a)
+            return -1;
+        d->strings = a;
+        d->cap = cap;
+    }
+    memcpy(d->strings + d->len, s, len);
+    e = &d->entries[d->count];
+    e->off = d->len;
+    e->len = len;
+    e->hash = hash;
+    d->len += len;
+    *slot = ++d->count;
+    return d->count - 1;
+}
+
+int ljs_bundle_dict_seed(ljs_bundle_dict *d, const ljs_bundle *b) {
+    const uint8_t *offs, *strings;
+
+    if (d->count || !b->dict)
+        return d->count ? -1 : 0;
+    offs = b->dict + 4;
+    strings = offs + ((size_t)b->dict_count + 1) * 4;
+    for (uint32_t i = 0; i < b->dict_count; i++) {
+        uint32_t start = get_u32(offs + i * 4);
+        // a repeated string would shift every index after it
+        if (dict_intern(d, strings + start,
+                        get_u32(offs + i * 4 + 4) - start) != i)
+            return -1;
+    }
+    return 0;
+}
+
+int ljs_bundle_dict_add(ljs_bundle_dict *d, const uint8_t *data, size_t size,
+                        const uint8_t **out, size_t *out_size) {
+    const uint8_t *p = data + 1, *end = data + size;
+    uint32_t *idx = NULL;
+    uint64_t count, head;
+    size_t n, len;
+    dict_record *r;
+    uint8_t *q;
+    int ret = -1;
+
+    if (size < 1 || !(n = get_leb128(p, end, &count)) || count > size)
+        goto plain;
+    p += n;
+    idx = mi_malloc(sizeof(uint32_t) * (count ? count : 1));
+    if (!idx)
+        return -1;
+    len = 1 + n;
+    // each string is its length and width as a leb128, then the characters
+    for (uint64_t i = 0; i < count; i++) {
+        const uint8_t *s = p;
+        uint64_t bytes;
+        int64_t k;
+        n = get_leb128(p, end, &head);
+        bytes = (head >> 1) << (head & 1);
+        if (!n || bytes > (uint64_t)(end - p) - n) {
+            mi_free(idx);
+            goto plain;
+        }
+        p += n + bytes;
+        k = dict_intern(d, s, p - s);
+        if (k < 0)
+            goto done;
+        idx[i] = k;
+        len += put_leb128(NULL, k);
+    }
+    len += end - p;
+
+    r = dict_record_new(d, len);
+    if (!r)
+        goto done;
+    q = r->data;
+    *q++ = data[0];
+    q += put_leb128(q, count);
+    for (uint64_t i = 0; i < count; i++)
+        q += put_leb128(q, idx[i]);
+    memcpy(q, p, end - p);
+    *out = r->data;
+    *out_size = len;
+    ret = 0;
+done:
+    mi_free(idx);
+    return ret;
+
+plain:
+    r = dict_record_new(d, size);
+    if (!r)
+        return -1;
+    memcpy(r->data, data, size);
+    *out = r->data;
+    *out_size = size;
+    return 1;
+}
+
+static int mod_cmp(const void *a, const void *b) {
+    const ljs_bundle_module *x = *(const ljs_bundle_module **)a;
+    const ljs_bundle_module *y = *(const ljs_bundle_module **)b;
+    int r = name_cmp(x->name, x->name_len, y->name, y->name_len);
+    // keep unnamed (eager) modules in their load order
+    if (r == 0)
+        r = x < y ? -1 : x > y;
+    return r;
+}
+
+static int write_dict(FILE *fp, const ljs_bundle_dict *d) {
+    uint8_t b[4];
+
+    put_u32(b, d->count);
+    if (fwrite(b, 1, 4, fp) != 4)
+        return -1;
+    for (uint32_t i = 0; i <= d->count; i++) {
+        put_u32(b, i < d->count ? d->entries[i].off : d->len);
+        if (fwrite(b, 1, 4, fp) != 4)
+            return -1;
+    }
+    if (d->len && fwrite(d->strings, 1, d->len, fp) != d->len)
+        return -1;
+    return 0;
+}
+
+int ljs_bundle_write(FILE *fp, const ljs_bundle_module *mods, uint32_t count,
+                     uint32_t entry, uint32_t flags,
+                     const ljs_bundle_dict *dict) {
+    const ljs_bundle_module **order;
+    uint8_t head[HEADER_SIZE], *toc = NULL;
+    uint64_t names, names_len = 0, atoms, atoms_len = 0, off;
+    uint32_t sorted_entry = 0, i;
+    int ret = -1;
+
+    if (entry >= count)
+        return -1;
+    order = mi_malloc(sizeof(*order) * count);
+    toc = mi_malloc((size_t)TOC_ENTRY_SIZE * count);
+    if (!order || !toc)
+        goto done;
+    for (i = 0; i < count; i++)
+        order[i] = &mods[i];
+    qsort(order, count, sizeof(*order), mod_cmp);
+
+    names = HEADER_SIZE + (uint64_t)TOC_ENTRY_SIZE * count;
+    for (i = 0; i < count; i++)
+        names_len += order[i]->name_len;
+    atoms = names + names_len;
+    if (dict && dict->count)
+        atoms_len = 4 + ((uint64_t)dict->count + 1) * 4 + dict->len;
+    off = atoms + atoms_len;
+
+    names_len = 0;
+    for (i = 0; i < count; i++) {
+        const ljs_bundle_module *m = order[i];
+        uint8_t *e = toc + i * TOC_ENTRY_SIZE;
+        if (m == &mods[entry])
+            sorted_entry = i;
+        put_u32(e, names_len);
+        put_u32(e + 4, m->name_len);
+        put_u32(e + 8, m->flags);
+        put_u32(e + 12, m->intrinsics);
+        put_u64(e + 16, off);
+        put_u64(e + 24, m->size);
+        put_u64(e + 32, m->raw_size);
+        off += m->size;
+        names_len += m->name_len;
+    }
+    for (i = 0; i < count; i++) {
+        const ljs_bundle_module *m = order[i];
+        uint8_t *e = toc + i * TOC_ENTRY_SIZE;
+        put_u64(e + 40, m->debug_size ? off : 0);
+        put_u64(e + 48, m->debug_size);
+        off += m->debug_size;
+    }
+
+    memcpy(head, LJS_BUNDLE_MAGIC, 4);
+    put_u16(head + 4, LJS_BUNDLE_VERSION);
+    put_u16(head + 6, flags);
+    put_u32(head + 8, count);
+    put_u32(head + 12, sorted_entry);
+    put_u64(head + 16, names);
+    put_u64(head + 24, names + names_len);
+    put_u64(head + 32, atoms_len ? atoms : 0);
+    put_u64(head + 40, atoms_len ? atoms + atoms_len : 0);
+
+    if (fwrite(head, 1, HEADER_SIZE, fp) != HEADER_SIZE ||
+        fwrite(toc, TOC_ENTRY_SIZE, count, fp) != count)
+        goto done;
+    for (i = 0; i < count; i++) {
+        if (order[i]->name_len &&
+            fwrite(order[i]->name, 1, order[i]->name_len, fp) !=
+                order[i]->name_len)
+            goto done;
+    }
+    if (atoms_len && write_dict(fp, dict))
+        goto done;
+    for (i = 0; i < count; i++) {
+        const ljs_bundle_module *m = order[i];
+        if (fwrite(m->data, 1, m->size, fp) != m->size)
+            goto done;
+    }
+    for (i = 0; i < count; i++) {
+        const ljs_bundle_module *m = order[i];
+        if (m->debug_size &&
+            fwrite(m->debug, 1, m->debug_size, fp) != m->debug_size)
+            goto done;
+    }
+    ret = 0;
+done:
+    mi_free(order);
+    mi_free(toc);
+    return ret;
+}
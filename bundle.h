@@ -0,0 +1,94 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* .pbc container v3
+ *
+ *   header   magic "LJSB", version, flags, module count, entry index
+ *   toc      one fixed-size record per module, sorted by module name
+ *   names    module names referenced by the toc, not NUL-terminated
+ *   atoms    (v3) the atom strings of all modules, deduplicated
+ *   data     module bytecode, referenced by offset
+ *   debug    debug blobs, last so that running never touches their pages
+ *
+ * JS_WriteObject output starts with a version byte and a table of every
+ * atom the record uses, which the rest of it refers to by index. In a
+ * LJS_MODULE_ATOMS record that table holds indexes into the bundle's atom
+ * dictionary instead of the strings, so identifiers shared by hundreds of
+ * modules are stored once. ljs_bundle_expand restores the original bytes.
+ *
+ * All integers are little-endian. Offsets are relative to the start of the
+ * image, so a bundle can be used in place from a read-only mapping. v2
+ * images, which lack the dictionary, are still read. */
+
+#define LJS_BUNDLE_MAGIC "LJSB"
+#define LJS_BUNDLE_VERSION 3
+
+// header flags
+#define LJS_BUNDLE_DEBUG (1 << 0)
+#define LJS_BUNDLE_INTRINSICS (1 << 1) // toc records the intrinsics in use
+// each debug blob is its raw size as a u64, then the text, ljs_lz
+// compressed when that is smaller
+#define LJS_BUNDLE_DEBUG_PACKED (1 << 2)
+
+// module flags
+#define LJS_MODULE_EAGER (1 << 0) // unnamed, must be loaded before the entry
+#define LJS_MODULE_LZ (1 << 1)    // data is ljs_lz compressed to raw_size
+#define LJS_MODULE_ATOMS (1 << 2) // atom table refers to the dictionary
+// not a module: data is the name of the module this name resolves to
+#define LJS_MODULE_ALIAS (1 << 3)
+
+typedef struct ljs_bundle_module {
+    const char *name; // not NUL-terminated when read from an image
+    uint32_t name_len;
+    uint32_t flags;
+    uint32_t intrinsics; // LANYT_INTRINSIC_* the module's source references
+    const uint8_t *data;
+    size_t size;
+    size_t raw_size;
+    const uint8_t *debug;
+    size_t debug_size;
+} ljs_bundle_module;
+
+typedef struct ljs_bundle {
+    const uint8_t *image;
+    size_t image_len;
+    uint32_t flags;
+    uint32_t count;
+    uint32_t entry;
+    uint32_t toc;        // offset of the first toc record
+    const uint8_t *dict; // atom dictionary offsets, NULL before v3
+    uint32_t dict_count;
+} ljs_bundle;
+
+int ljs_bundle_probe(const uint8_t *image, size_t image_len);
+int ljs_bundle_open(ljs_bundle *b, const uint8_t *image, size_t image_len);
+void ljs_bundle_get(const ljs_bundle *b, uint32_t idx, ljs_bundle_module *m);
+int ljs_bundle_find(const ljs_bundle *b, const char *name);
+// rebuild the JS_WriteObject output of a LJS_MODULE_ATOMS record (already
+// inflated) into out, or only measure it when out is NULL; 0 if malformed
+size_t ljs_bundle_expand(const ljs_bundle *b, const uint8_t *data,
+                         size_t size, uint8_t *out);
+
+typedef struct ljs_bundle_dict ljs_bundle_dict;
+
+ljs_bundle_dict *ljs_bundle_dict_new(void);
+// Move the atom table of one JS_WriteObject output into d. *out is the
+// record to store with LJS_MODULE_ATOMS, owned by d. Returns 1 when data
+// does not start with an atom table; *out is then a plain copy of it.
+int ljs_bundle_dict_add(ljs_bundle_dict *d, const uint8_t *data, size_t size,
+                        const uint8_t **out, size_t *out_size);
+void ljs_bundle_dict_free(ljs_bundle_dict *d);
+// Start the empty d with the dictionary of b, in the same order, so that
+// LJS_MODULE_ATOMS records of b can be written again byte for byte
+int ljs_bundle_dict_seed(ljs_bundle_dict *d, const ljs_bundle *b);
+
+// dict may be NULL when no record has LJS_MODULE_ATOMS
+int ljs_bundle_write(FILE *fp, const ljs_bundle_module *mods, uint32_t count,
+                     uint32_t entry, uint32_t flags,
+                     const ljs_bundle_dict *dict);
+
+#endif // BUNDLE_H
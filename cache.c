@@ -0,0 +1,115 @@
+#include "cache.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#include <process.h>
+#define make_dir(d) _mkdir(d)
+#define get_pid() _getpid()
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_dir(d) mkdir(d, 0777)
+#define get_pid() getpid()
+#endif
+
+#ifndef CONFIG_VERSION
+#define CONFIG_VERSION "unknown"
+#endif
+
+#define CACHE_MAGIC "LJSC"
+#define CACHE_FORMAT 1
+#define HEADER_SIZE 32
+#define PATH_SIZE 1024
+
+void ljs_cache_key_init(ljs_cache_key *k, const char *name, int flags,
+                        const uint8_t *source, size_t source_len) {
+    static const uint64_t seeds[2] = {0, 0x9e3779b97f4a7c15ULL};
+
+    for (int i = 0; i < 2; i++) {
+        uint64_t h = ljs_hash64(CONFIG_VERSION, strlen(CONFIG_VERSION),
+                                seeds[i] ^ CACHE_FORMAT);
+        h = ljs_hash64(name, strlen(name), h ^ (uint32_t)flags);
+        k->h[i] = ljs_hash64(source, source_len, h);
+    }
+    k->source_len = source_len;
+}
+
+static void entry_path(char *buf, const char *dir, const ljs_cache_key *k) {
+    snprintf(buf, PATH_SIZE, "%s/%016llx%016llx.ljc", dir,
+             (unsigned long long)k->h[0], (unsigned long long)k->h[1]);
+}
+
+static void put_header(uint8_t *p, const ljs_cache_key *k) {
+    uint32_t format = CACHE_FORMAT;
+    memcpy(p, CACHE_MAGIC, 4);
+    memcpy(p + 4, &format, 4);
+    memcpy(p + 8, k->h, 16);
+    memcpy(p + 24, &k->source_len, 8);
+}
+
+uint8_t *ljs_cache_load(JSContext *ctx, const char *dir,
+                        const ljs_cache_key *k, size_t *plen) {
+    char path[PATH_SIZE];
+    uint8_t head[HEADER_SIZE], want[HEADER_SIZE], *buf;
+    long size;
+    FILE *fp;
+
+    entry_path(path, dir, k);
+    fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    put_header(want, k);
+    if (fread(head, 1, HEADER_SIZE, fp) != HEADER_SIZE ||
+        memcmp(head, want, HEADER_SIZE) || fseek(fp, 0, SEEK_END) ||
+        (size = ftell(fp)) <= HEADER_SIZE || fseek(fp, HEADER_SIZE, SEEK_SET))
+        goto miss;
+
+    size -= HEADER_SIZE;
+    buf = js_malloc(ctx, size);
+    if (!buf)
+        goto miss;
+    if (fread(buf, 1, size, fp) != (size_t)size) {
+        js_free(ctx, buf);
+        goto miss;
+    }
+    fclose(fp);
+    *plen = size;
+    return buf;
+miss:
+    fclose(fp);
+    return NULL;
+}
+
+int ljs_cache_store(const char *dir, const ljs_cache_key *k,
+                    const uint8_t *bytecode, size_t len) {
+    char path[PATH_SIZE], tmp[PATH_SIZE + 32];
+    uint8_t head[HEADER_SIZE];
+    FILE *fp;
+    int ret = 0;
+
+    entry_path(path, dir, k);
+    /* write aside and rename, so concurrent runs never see a torn entry */
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)get_pid());
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        make_dir(dir);
+        fp = fopen(tmp, "wb");
+        if (!fp)
+            return -1;
+    }
+    put_header(head, k);
+    if (fwrite(head, 1, HEADER_SIZE, fp) != HEADER_SIZE ||
+        fwrite(bytecode, 1, len, fp) != len)
+        ret = -1;
+    if (fclose(fp))
+        ret = -1;
+    if (ret == 0 && rename(tmp, path))
+        ret = -1;
+    if (ret)
+        remove(tmp);
+    return ret;
+}
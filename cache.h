@@ -0,0 +1,27 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <quickjs.h>
+
+/* Content-addressed bytecode cache. An entry is keyed by the engine
+ * version, the compile flags, the module name (it is baked into the
+ * bytecode and drives relative imports) and the source bytes, so a stale
+ * entry can never be hit, only left behind. */
+
+typedef struct ljs_cache_key {
+    uint64_t h[2];
+    uint64_t source_len;
+} ljs_cache_key;
+
+void ljs_cache_key_init(ljs_cache_key *k, const char *name, int flags,
+                        const uint8_t *source, size_t source_len);
+// returns js_malloc'd bytecode, NULL on a miss
+uint8_t *ljs_cache_load(JSContext *ctx, const char *dir,
+                        const ljs_cache_key *k, size_t *plen);
+int ljs_cache_store(const char *dir, const ljs_cache_key *k,
+                    const uint8_t *bytecode, size_t len);
+
+#endif // CACHE_H
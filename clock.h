@@ -0,0 +1,30 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// monotonic nanoseconds, for measuring intervals only
+static inline uint64_t ljs_clock_ns(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (uint64_t)(t.QuadPart / freq.QuadPart) * 1000000000ULL +
+           (uint64_t)(t.QuadPart % freq.QuadPart) * 1000000000ULL /
+               freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#endif // CLOCK_H
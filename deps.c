@@ -0,0 +1,222 @@
+#include "deps.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mimalloc.h>
+
+#ifndef CONFIG_VERSION
+#define CONFIG_VERSION "unknown"
+#endif
+
+#define DEPS_MAGIC "ljs-deps"
+#define DEPS_FORMAT 1
+#define LINE_SIZE 4096
+
+ljs_deps *ljs_deps_new(void) { return mi_zalloc(sizeof(ljs_deps)); }
+
+void ljs_deps_free(ljs_deps *d) {
+    if (!d)
+        return;
+    for (int i = 0; i < d->len; i++) {
+        ljs_deps_module *m = &d->mods[i];
+        for (int j = 0; j < m->imports_len; j++)
+            mi_free(m->imports[j]);
+        mi_free(m->imports);
+        mi_free(m->name);
+    }
+    mi_free(d->mods);
+    mi_free(d->index);
+    mi_free(d);
+}
+
+ljs_deps_module *ljs_deps_add(ljs_deps *d, const char *name) {
+    ljs_deps_module *m;
+
+    if (d->len >= d->cap) {
+        int cap = d->cap + (d->cap >> 1) + 16;
+        ljs_deps_module *a = mi_realloc(d->mods, sizeof(*a) * cap);
+        if (!a)
+            return NULL;
+        d->mods = a;
+        d->cap = cap;
+    }
+    m = &d->mods[d->len];
+    memset(m, 0, sizeof(*m));
+    m->name = mi_strdup(name);
+    if (!m->name)
+        return NULL;
+    d->len++;
+    return m;
+}
+
+int ljs_deps_add_import(ljs_deps_module *m, const char *name) {
+    if (m->imports_len >= m->imports_cap) {
+        int cap = m->imports_cap + (m->imports_cap >> 1) + 4;
+        char **a = mi_realloc(m->imports, sizeof(a[0]) * cap);
+        if (!a)
+            return -1;
+        m->imports = a;
+        m->imports_cap = cap;
+    }
+    m->imports[m->imports_len] = mi_strdup(name);
+    if (!m->imports[m->imports_len])
+        return -1;
+    m->imports_len++;
+    return 0;
+}
+
+static int module_cmp(const void *a, const void *b) {
+    return strcmp((*(ljs_deps_module *const *)a)->name,
+                  (*(ljs_deps_module *const *)b)->name);
+}
+
+const ljs_deps_module *ljs_deps_find(const ljs_deps *d, const char *name) {
+    int lo = 0, hi = d->index ? d->len : 0;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int r = strcmp(name, d->index[mid]->name);
+        if (r == 0)
+            return d->index[mid];
+        if (r < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
+
+// "<hash> <offset> <size> <raw size> <flags> <intrinsics> <name>"
+static int parse_module(ljs_deps *d, const char *s) {
+    ljs_deps_module *m;
+    uint64_t hash, offset, size, raw_size;
+    uint32_t flags, intrinsics;
+    int n = -1;
+
+    if (sscanf(s, "%" SCNx64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu32
+               " %" SCNu32 " %n",
+               &hash, &offset, &size, &raw_size, &flags, &intrinsics,
+               &n) != 6 ||
+        n < 0 || !s[n])
+        return -1;
+    m = ljs_deps_add(d, s + n);
+    if (!m)
+        return -1;
+    m->hash = hash;
+    m->offset = offset;
+    m->size = size;
+    m->raw_size = raw_size;
+    m->flags = flags;
+    m->intrinsics = intrinsics;
+    return 0;
+}
+
+ljs_deps *ljs_deps_read(const char *filename) {
+    char line[LINE_SIZE];
+    ljs_deps *d;
+    FILE *fp = fopen(filename, "r");
+    int format, n = -1, ok = 0;
+
+    if (!fp)
+        return NULL;
+    d = ljs_deps_new();
+    if (!d)
+        goto done;
+    if (!fgets(line, sizeof(line), fp) ||
+        sscanf(line, DEPS_MAGIC " %d %n", &format, &n) != 1 || n < 0 ||
+        format != DEPS_FORMAT ||
+        strcmp(line + n, CONFIG_VERSION "\n") != 0)
+        goto done;
+    if (!fgets(line, sizeof(line), fp) ||
+        sscanf(line, "bundle %" SCNu64 " %" SCNx64 " %" SCNu32,
+               &d->bundle_size, &d->bundle_hash, &d->save_flags) != 3)
+        goto done;
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strcspn(line, "\r\n");
+        // a name too long for the buffer is not worth a second path
+        if (!line[len])
+            goto done;
+        line[len] = '\0';
+        if (!strncmp(line, "entry ", 6) && d->len == 0) {
+            if (parse_module(d, line + 6))
+                goto done;
+        } else if (!strncmp(line, "module ", 7) && d->len > 0) {
+            if (parse_module(d, line + 7))
+                goto done;
+        } else if (!strncmp(line, "import ", 7) && d->len > 0 && line[7]) {
+            if (ljs_deps_add_import(&d->mods[d->len - 1], line + 7))
+                goto done;
+        } else {
+            goto done;
+        }
+    }
+    if (ferror(fp) || d->len == 0)
+        goto done;
+    d->index = mi_malloc(sizeof(d->index[0]) * d->len);
+    if (!d->index)
+        goto done;
+    for (int i = 0; i < d->len; i++)
+        d->index[i] = &d->mods[i];
+    qsort(d->index, d->len, sizeof(d->index[0]), module_cmp);
+    ok = 1;
+done:
+    fclose(fp);
+    if (!ok) {
+        ljs_deps_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+static int write_module(FILE *fp, const ljs_deps_module *m, int entry) {
+    if (fprintf(fp,
+                "%s %016" PRIx64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+                " %" PRIu32 " %" PRIu32 " %s\n",
+                entry ? "entry" : "module", m->hash, m->offset, m->size,
+                m->raw_size, m->flags, m->intrinsics, m->name) < 0)
+        return -1;
+    for (int i = 0; i < m->imports_len; i++) {
+        if (fprintf(fp, "import %s\n", m->imports[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Written under a temporary name and renamed into place, so that an
+ * interrupted compile leaves the old file or none, never half of one. */
+int ljs_deps_write(const ljs_deps *d, const char *filename) {
+    size_t len = strlen(filename);
+    char *tmp = mi_malloc(len + 5);
+    FILE *fp;
+    int ret = -1;
+
+    if (!tmp)
+        return -1;
+    memcpy(tmp, filename, len);
+    memcpy(tmp + len, ".tmp", 5);
+    fp = fopen(tmp, "w");
+    if (!fp)
+        goto done;
+    ret = 0;
+    if (fprintf(fp, DEPS_MAGIC " %d " CONFIG_VERSION "\n", DEPS_FORMAT) < 0 ||
+        fprintf(fp, "bundle %" PRIu64 " %016" PRIx64 " %" PRIu32 "\n",
+                d->bundle_size, d->bundle_hash, d->save_flags) < 0)
+        ret = -1;
+    for (int i = 0; !ret && i < d->len; i++)
+        ret = write_module(fp, &d->mods[i], i == 0);
+    if (fclose(fp))
+        ret = -1;
+#if defined(_WIN32) || defined(_WIN64)
+    remove(filename); // rename does not replace a file there
+#endif
+    if (ret || rename(tmp, filename)) {
+        remove(tmp);
+        ret = -1;
+    }
+done:
+    mi_free(tmp);
+    return ret;
+}
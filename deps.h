@@ -0,0 +1,59 @@
+#ifndef DEPS_H
+#define DEPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Dependency file of a bundle. `compile` writes one next to its output, as
+ * <output>.deps, so that the next compile of the same graph only parses
+ * the files that changed and copies every other module's record out of
+ * the old bundle (see lanyt_js_set_base). It is text, one line per fact:
+ *
+ *   ljs-deps 1 <engine version>
+ *   bundle <size> <hash> <save flags>
+ *   entry <hash> <offset> <size> <raw size> <flags> <intrinsics> <name>
+ *   module <hash> <offset> <size> <raw size> <flags> <intrinsics> <name>
+ *   import <name>
+ *
+ * Hashes are ljs_hash64 in hex. The bundle's covers the whole file, so a
+ * bundle written by anything else is never trusted. A module's covers its
+ * source, and the numbers after it are its toc record in the bundle. The
+ * import lines after a module are the lexical names its imports asked for,
+ * which are resolved again, so a file added or removed under one of them
+ * is noticed even though the importer did not change. */
+
+typedef struct {
+    char *name; // canonical, or the entry's file name as given
+    uint64_t hash;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t raw_size;
+    uint32_t flags;
+    uint32_t intrinsics;
+    char **imports;
+    int imports_len;
+    int imports_cap;
+} ljs_deps_module;
+
+typedef struct {
+    uint64_t bundle_size;
+    uint64_t bundle_hash;
+    uint32_t save_flags;
+    ljs_deps_module *mods; // the entry first
+    int len;
+    int cap;
+    ljs_deps_module **index; // by name, built by ljs_deps_read
+} ljs_deps;
+
+ljs_deps *ljs_deps_new(void);
+void ljs_deps_free(ljs_deps *d);
+// NULL if the file is missing, malformed or from another engine version
+ljs_deps *ljs_deps_read(const char *filename);
+int ljs_deps_write(const ljs_deps *d, const char *filename);
+// the returned module moves with the next ljs_deps_add
+ljs_deps_module *ljs_deps_add(ljs_deps *d, const char *name);
+int ljs_deps_add_import(ljs_deps_module *m, const char *name);
+// only in a ljs_deps_read result
+const ljs_deps_module *ljs_deps_find(const ljs_deps *d, const char *name);
+
+#endif // DEPS_H
@@ -0,0 +1,195 @@
+#include "exe.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <mimalloc.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#endif
+#endif
+
+#define PATH_SIZE 4096
+#define COPY_CHUNK 65536
+#define MARK_TAG_SIZE 12
+
+/* Set in the copies ljs_exe_copy_self writes, which find the tag in the
+ * file and patch the byte after it, so a stock ljs knows it has no bundle
+ * without opening itself. Spelled out byte by byte so that the tag is in
+ * the binary only once; volatile so that the test reads the patched byte
+ * rather than the initializer. */
+static volatile uint8_t exe_mark[MARK_TAG_SIZE + 1] = {
+    'L', 'J', 'S', '_', 'E', 'X', 'E', '_', 'M', 'A', 'R', 'K', 0,
+};
+
+static struct {
+    pthread_once_t once;
+    const uint8_t *bundle;
+    size_t len;
+} self = {PTHREAD_ONCE_INIT};
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++)
+        p[i] = v >> (i * 8);
+}
+
+static int self_path(char *buf, size_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+    DWORD n = GetModuleFileNameA(NULL, buf, (DWORD)size);
+    return n == 0 || n >= size ? -1 : 0;
+#elif defined(__APPLE__)
+    uint32_t n = size;
+    return _NSGetExecutablePath(buf, &n) ? -1 : 0;
+#elif defined(__linux__)
+    snprintf(buf, size, "/proc/self/exe");
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+// the size of fp, and the bundle its trailer describes; -1 without one,
+// -2 if not even the size could be found
+static int read_trailer(FILE *fp, uint64_t *len, uint64_t *off,
+                        uint64_t *size) {
+    uint8_t t[LJS_EXE_TRAILER_SIZE];
+    long end;
+
+    if (fseek(fp, 0, SEEK_END) || (end = ftell(fp)) < 0)
+        return -2;
+    *len = end;
+    if (*len < LJS_EXE_TRAILER_SIZE ||
+        fseek(fp, end - LJS_EXE_TRAILER_SIZE, SEEK_SET) ||
+        fread(t, 1, sizeof(t), fp) != sizeof(t) ||
+        memcmp(t + 16, LJS_EXE_MAGIC, 8))
+        return -1;
+    *off = get_u64(t);
+    *size = get_u64(t + 8);
+    if (*off > *len - LJS_EXE_TRAILER_SIZE ||
+        *size != *len - LJS_EXE_TRAILER_SIZE - *off)
+        return -1;
+    return 0;
+}
+
+static void self_init(void) {
+    char path[PATH_SIZE];
+    uint64_t len, off, size;
+    FILE *fp;
+
+    if (!exe_mark[MARK_TAG_SIZE])
+        return;
+    if (self_path(path, sizeof(path)) || !(fp = fopen(path, "rb")))
+        return;
+    if (read_trailer(fp, &len, &off, &size) || size == 0)
+        goto done;
+#if defined(_WIN32) || defined(_WIN64)
+    {
+        uint8_t *buf = mi_malloc(size);
+        if (buf && !fseek(fp, (long)off, SEEK_SET) &&
+            fread(buf, 1, size, fp) == size) {
+            self.bundle = buf;
+            self.len = size;
+        } else {
+            mi_free(buf);
+        }
+    }
+#else
+    {
+        // the mapping must start on a page, the bundle need not
+        uint64_t start = off & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+        void *p = mmap(NULL, size + (off - start), PROT_READ, MAP_SHARED,
+                       fileno(fp), start);
+        if (p != MAP_FAILED) {
+            self.bundle = (const uint8_t *)p + (off - start);
+            self.len = size;
+        }
+    }
+#endif
+done:
+    fclose(fp);
+}
+
+const uint8_t *ljs_exe_bundle(size_t *plen) {
+    pthread_once(&self.once, self_init);
+    *plen = self.len;
+    return self.bundle;
+}
+
+int ljs_exe_copy_self(FILE *out) {
+    char path[PATH_SIZE];
+    uint8_t *buf, tag[MARK_TAG_SIZE], set = 1;
+    uint64_t len, off, size, pos = 0, mark = 0;
+    size_t n, matched = 0;
+    long base = ftell(out);
+    FILE *fp;
+    int ret = -1, r;
+
+    if (self_path(path, sizeof(path)) || !(fp = fopen(path, "rb")))
+        return -1;
+    buf = mi_malloc(COPY_CHUNK);
+    r = read_trailer(fp, &len, &off, &size);
+    if (!buf || r == -2)
+        goto done;
+    // an executable built this way only passes on the ljs part
+    if (r == 0)
+        len = off;
+    if (base < 0 || fseek(fp, 0, SEEK_SET))
+        goto done;
+    for (size_t i = 0; i < MARK_TAG_SIZE; i++)
+        tag[i] = exe_mark[i];
+    for (; len; len -= n, pos += n) {
+        n = len < COPY_CHUNK ? len : COPY_CHUNK;
+        if (fread(buf, 1, n, fp) != n || fwrite(buf, 1, n, out) != n)
+            goto done;
+        // the tag's first byte occurs in it only once, so no backtracking
+        for (size_t i = 0; i < n && !mark; i++) {
+            if (matched == MARK_TAG_SIZE)
+                mark = pos + i;
+            else if (buf[i] == tag[matched])
+                matched++;
+            else
+                matched = buf[i] == tag[0];
+        }
+    }
+    // a copy that cannot say it carries a bundle would run as plain ljs
+    if (!mark || fseek(out, base + (long)mark, SEEK_SET) ||
+        fwrite(&set, 1, 1, out) != 1 || fseek(out, 0, SEEK_END))
+        goto done;
+    ret = 0;
+done:
+    mi_free(buf);
+    fclose(fp);
+    return ret;
+}
+
+int ljs_exe_finish(FILE *fp, uint64_t off) {
+    uint8_t t[LJS_EXE_TRAILER_SIZE];
+    long end = ftell(fp);
+
+    if (end < 0 || (uint64_t)end < off)
+        return -1;
+    put_u64(t, off);
+    put_u64(t + 8, end - off);
+    memcpy(t + 16, LJS_EXE_MAGIC, 8);
+    if (fwrite(t, 1, sizeof(t), fp) != sizeof(t))
+        return -1;
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (fchmod(fileno(fp), 0755))
+        return -1;
+#endif
+    return 0;
+}
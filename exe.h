@@ -0,0 +1,34 @@
+#ifndef EXE_H
+#define EXE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Self-contained executables. The ljs binary is copied as it is and a
+ * bundle appended to it, followed by a trailer:
+ *
+ *   u64 offset of the bundle in the file
+ *   u64 size of the bundle
+ *   magic "LJSEXE01"
+ *
+ * Loaders do not look past the program's own segments (and PE and Mach-O
+ * tools treat the rest as overlay data), so the copy still runs as ljs;
+ * at startup it finds the trailer and runs the bundle instead. The copy
+ * also has a flag in its data section set, and only then does it look:
+ * a stock ljs never opens its own file. */
+
+#define LJS_EXE_MAGIC "LJSEXE01"
+#define LJS_EXE_TRAILER_SIZE 24
+
+// the bundle appended to the running executable, mapped read-only on the
+// first call and kept for the life of the process. NULL if there is none
+const uint8_t *ljs_exe_bundle(size_t *plen);
+// write the running executable to fp, without any bundle it carries and
+// flagged to look for the one that will follow
+int ljs_exe_copy_self(FILE *fp);
+// after the bundle was written to fp from offset off on, add the trailer
+// and make the file executable
+int ljs_exe_finish(FILE *fp, uint64_t off);
+
+#endif // EXE_H
@@ -0,0 +1,620 @@
+#include "module.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <cutils.h>
+#include <mimalloc.h>
+#include <quickjs.h>
+
+/* lanyt:ffi binds C symbols to JS functions without a glue module:
+ *
+ *   import { dlopen } from "lanyt:ffi";
+ *   const lib = dlopen("libm" + p_suffix);
+ *   const pow = lib.func("pow", "f64", ["f64", "f64"]);
+ *
+ * The signature is parsed once when the function is bound. It becomes a
+ * table saying which register or stack slot each argument goes to, so a call
+ * only converts the values and jumps. There is no libffi underneath. Every
+ * call goes through one function pointer type that spans all argument
+ * registers of the ABI. That is exact for non-variadic functions on x86-64
+ * SysV and AArch64, where integer and floating-point arguments are
+ * allocated independently. Windows x64 allocates by position, so the call
+ * picks one of sixteen prototypes by which of the first four arguments are
+ * floating point. */
+
+#define FFI_MAX_ARGS 16
+
+#if defined(_WIN64)
+#define FFI_POSITIONAL 1
+#define FFI_INT_REGS 4
+#define FFI_FP_REGS 4
+#elif defined(__x86_64__) && !defined(_WIN32)
+#define FFI_INT_REGS 6
+#define FFI_FP_REGS 8
+#elif defined(__aarch64__)
+#define FFI_INT_REGS 8
+#define FFI_FP_REGS 8
+#endif
+
+#if defined(FFI_INT_REGS)
+#define FFI_SUPPORTED 1
+#if defined(__APPLE__)
+// Apple packs stack arguments by their natural size, slots do not apply
+#define FFI_STACK_SLOTS 0
+#else
+#define FFI_STACK_SLOTS 8
+#endif
+#endif
+
+typedef enum {
+    FFI_VOID,
+    FFI_I8,
+    FFI_U8,
+    FFI_I16,
+    FFI_U16,
+    FFI_I32,
+    FFI_U32,
+    FFI_I64,
+    FFI_U64,
+    FFI_F32,
+    FFI_F64,
+    FFI_PTR,
+    FFI_CSTR,
+} ffi_type;
+
+static const struct {
+    const char *name;
+    ffi_type type;
+} ffi_type_names[] = {
+    {"void", FFI_VOID},   {"i8", FFI_I8},       {"u8", FFI_U8},
+    {"i16", FFI_I16},     {"u16", FFI_U16},     {"i32", FFI_I32},
+    {"u32", FFI_U32},     {"i64", FFI_I64},     {"u64", FFI_U64},
+    {"f32", FFI_F32},     {"f64", FFI_F64},     {"ptr", FFI_PTR},
+    {"cstr", FFI_CSTR},   {"int", FFI_I32},     {"float", FFI_F32},
+    {"double", FFI_F64},  {"pointer", FFI_PTR}, {"size_t", FFI_U64},
+};
+
+enum {
+    FFI_LOC_INT,
+    FFI_LOC_FP,
+    FFI_LOC_STACK,
+};
+
+typedef struct {
+    void *handle; // from lanyt_js_dll_open, NULL once closed
+    char *filename;
+} ffi_lib;
+
+typedef struct {
+    void *fn;
+    ffi_lib *lib;
+    uint8_t ret;
+    uint8_t nargs;
+    uint8_t fp_mask; // positional ABIs: which register slots are floating
+    uint8_t type[FFI_MAX_ARGS];
+    uint8_t loc[FFI_MAX_ARGS];
+    uint8_t index[FFI_MAX_ARGS];
+    // per argument: 1 when the last pointer came from a plain ArrayBuffer,
+    // so a monomorphic call site never probes the wrong class twice
+    uint8_t ab_hint[FFI_MAX_ARGS];
+} ffi_func;
+
+typedef union {
+    uint64_t i;
+    double d;
+} ffi_word;
+
+static JSClassID ffi_lib_class_id, ffi_func_class_id;
+static pthread_once_t ffi_class_once = PTHREAD_ONCE_INIT;
+
+static void ffi_new_class_ids(void) {
+    JS_NewClassID(&ffi_lib_class_id);
+    JS_NewClassID(&ffi_func_class_id);
+}
+
+static int ffi_parse_type(JSContext *ctx, JSValueConst v, ffi_type *out) {
+    const char *s = JS_ToCString(ctx, v);
+    if (!s)
+        return -1;
+    for (size_t i = 0; i < countof(ffi_type_names); ++i) {
+        if (!strcmp(s, ffi_type_names[i].name)) {
+            *out = ffi_type_names[i].type;
+            JS_FreeCString(ctx, s);
+            return 0;
+        }
+    }
+    JS_ThrowTypeError(ctx, "ffi: unknown type '%s'", s);
+    JS_FreeCString(ctx, s);
+    return -1;
+}
+
+static int ffi_is_fp(ffi_type t) { return t == FFI_F32 || t == FFI_F64; }
+
+/* Assigns each argument its register or stack slot, once per binding. */
+static int ffi_compile(JSContext *ctx, ffi_func *f) {
+#if defined(FFI_SUPPORTED)
+    int ni = 0, nf = 0, ns = 0;
+
+    for (int i = 0; i < f->nargs; ++i) {
+        int fp = ffi_is_fp(f->type[i]);
+#if defined(FFI_POSITIONAL)
+        if (i < FFI_INT_REGS) {
+            f->loc[i] = fp ? FFI_LOC_FP : FFI_LOC_INT;
+            f->index[i] = i;
+            if (fp)
+                f->fp_mask |= 1 << i;
+            continue;
+        }
+#else
+        if (!fp && ni < FFI_INT_REGS) {
+            f->loc[i] = FFI_LOC_INT;
+            f->index[i] = ni++;
+            continue;
+        }
+        if (fp && nf < FFI_FP_REGS) {
+            f->loc[i] = FFI_LOC_FP;
+            f->index[i] = nf++;
+            continue;
+        }
+#endif
+        if (ns >= FFI_STACK_SLOTS) {
+            JS_ThrowRangeError(ctx, "ffi: too many arguments for this ABI");
+            return -1;
+        }
+        f->loc[i] = FFI_LOC_STACK;
+        f->index[i] = ns++;
+    }
+    (void)ni;
+    (void)nf;
+    return 0;
+#else
+    JS_ThrowInternalError(ctx, "ffi: calls are not supported on this platform");
+    return -1;
+#endif
+}
+
+#if defined(FFI_SUPPORTED)
+#define S8 uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, \
+           uint64_t, uint64_t
+#define SA8 s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7]
+
+#if defined(FFI_POSITIONAL)
+#define W_T_0 uint64_t
+#define W_T_1 double
+#define W_A_0(k) r[k].i
+#define W_A_1(k) r[k].d
+#define W_CALL(R, a, b, c, d)                                                  \
+    ((R(*)(W_T_##a, W_T_##b, W_T_##c, W_T_##d, S8))fn)(                        \
+        W_A_##a(0), W_A_##b(1), W_A_##c(2), W_A_##d(3), SA8)
+#define W_CASES(R, out)                                                        \
+    case 0x0: out = W_CALL(R, 0, 0, 0, 0); break;                              \
+    case 0x1: out = W_CALL(R, 1, 0, 0, 0); break;                              \
+    case 0x2: out = W_CALL(R, 0, 1, 0, 0); break;                              \
+    case 0x3: out = W_CALL(R, 1, 1, 0, 0); break;                              \
+    case 0x4: out = W_CALL(R, 0, 0, 1, 0); break;                              \
+    case 0x5: out = W_CALL(R, 1, 0, 1, 0); break;                              \
+    case 0x6: out = W_CALL(R, 0, 1, 1, 0); break;                              \
+    case 0x7: out = W_CALL(R, 1, 1, 1, 0); break;                              \
+    case 0x8: out = W_CALL(R, 0, 0, 0, 1); break;                              \
+    case 0x9: out = W_CALL(R, 1, 0, 0, 1); break;                              \
+    case 0xa: out = W_CALL(R, 0, 1, 0, 1); break;                              \
+    case 0xb: out = W_CALL(R, 1, 1, 0, 1); break;                              \
+    case 0xc: out = W_CALL(R, 0, 0, 1, 1); break;                              \
+    case 0xd: out = W_CALL(R, 1, 0, 1, 1); break;                              \
+    case 0xe: out = W_CALL(R, 0, 1, 1, 1); break;                              \
+    default: out = W_CALL(R, 1, 1, 1, 1); break;
+
+static void ffi_invoke(const ffi_func *f, ffi_word *r, double *fr,
+                       uint64_t *s, ffi_word *out) {
+    void *fn = f->fn;
+    (void)fr;
+    if (ffi_is_fp(f->ret)) {
+        switch (f->fp_mask) { W_CASES(double, out->d) }
+    } else {
+        switch (f->fp_mask) { W_CASES(uint64_t, out->i) }
+    }
+}
+#else
+#if FFI_INT_REGS == 6
+#define IR uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t
+#define IA r[0].i, r[1].i, r[2].i, r[3].i, r[4].i, r[5].i
+#else
+#define IR uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, \
+           uint64_t, uint64_t
+#define IA r[0].i, r[1].i, r[2].i, r[3].i, r[4].i, r[5].i, r[6].i, r[7].i
+#endif
+#define FR double, double, double, double, double, double, double, double
+#define FA fr[0], fr[1], fr[2], fr[3], fr[4], fr[5], fr[6], fr[7]
+
+static void ffi_invoke(const ffi_func *f, ffi_word *r, double *fr,
+                       uint64_t *s, ffi_word *out) {
+    if (ffi_is_fp(f->ret))
+        out->d = ((double (*)(IR, FR, S8))f->fn)(IA, FA, SA8);
+    else
+        out->i = ((uint64_t(*)(IR, FR, S8))f->fn)(IA, FA, SA8);
+}
+#endif
+
+static int ffi_pointer_arg(JSContext *ctx, ffi_func *f, int i, JSValueConst v,
+                           uint64_t *out) {
+    size_t off, len, bpe, size;
+    JSValue buf;
+    uint8_t *p;
+    int64_t n;
+
+    if (JS_IsNull(v) || JS_IsUndefined(v)) {
+        *out = 0;
+        return 0;
+    }
+    if (!JS_IsObject(v)) {
+        // an address handed out by symbol() or a previous call
+        if (JS_ToInt64Ext(ctx, &n, v))
+            return -1;
+        *out = n;
+        return 0;
+    }
+
+    if (f->ab_hint[i]) {
+        p = JS_GetArrayBuffer(ctx, &size, v);
+        if (p) {
+            *out = (uintptr_t)p;
+            return 0;
+        }
+        // a view this time; the hint only saves the failed probe
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        f->ab_hint[i] = 0;
+    }
+    buf = JS_GetTypedArrayBuffer(ctx, v, &off, &len, &bpe);
+    if (!JS_IsException(buf)) {
+        p = JS_GetArrayBuffer(ctx, &size, buf);
+        JS_FreeValue(ctx, buf);
+        if (!p)
+            return -1;
+        *out = (uintptr_t)(p + off);
+        return 0;
+    }
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    p = JS_GetArrayBuffer(ctx, &size, v);
+    if (!p)
+        return -1;
+    f->ab_hint[i] = 1;
+    *out = (uintptr_t)p;
+    return 0;
+}
+#endif
+
+static JSValue ffi_call(JSContext *ctx, JSValueConst this_val, int argc,
+                        JSValueConst *argv, int magic, JSValue *func_data) {
+#if defined(FFI_SUPPORTED)
+    ffi_func *f = JS_GetOpaque(func_data[0], ffi_func_class_id);
+    ffi_word r[FFI_INT_REGS > FFI_FP_REGS ? FFI_INT_REGS : FFI_FP_REGS] = {0};
+    double fr[FFI_FP_REGS] = {0};
+    uint64_t s[8] = {0};
+    const char *cstr[FFI_MAX_ARGS];
+    int ncstr = 0;
+    ffi_word out, w;
+    JSValue ret = JS_EXCEPTION;
+
+    if (!f->lib->handle)
+        return JS_ThrowTypeError(ctx, "ffi: library is closed");
+
+    for (int i = 0; i < f->nargs; ++i) {
+        JSValueConst v = argv[i];
+        int32_t i32;
+        int64_t i64;
+        double d;
+        float fl;
+
+        w.i = 0;
+        switch (f->type[i]) {
+        case FFI_F64:
+            if (JS_VALUE_GET_TAG(v) == JS_TAG_INT)
+                w.d = JS_VALUE_GET_INT(v);
+            else if (JS_ToFloat64(ctx, &w.d, v))
+                goto done;
+            break;
+        case FFI_F32:
+            if (JS_ToFloat64(ctx, &d, v))
+                goto done;
+            // the callee reads the low half of the register
+            fl = (float)d;
+            memcpy(&w.i, &fl, sizeof(fl));
+            break;
+        case FFI_I64:
+        case FFI_U64:
+            if (JS_ToInt64Ext(ctx, &i64, v))
+                goto done;
+            w.i = i64;
+            break;
+        case FFI_PTR:
+            if (ffi_pointer_arg(ctx, f, i, v, &w.i))
+                goto done;
+            break;
+        case FFI_CSTR:
+            if (JS_IsNull(v) || JS_IsUndefined(v))
+                break;
+            cstr[ncstr] = JS_ToCString(ctx, v);
+            if (!cstr[ncstr])
+                goto done;
+            w.i = (uintptr_t)cstr[ncstr++];
+            break;
+        default:
+            if (JS_VALUE_GET_TAG(v) == JS_TAG_INT)
+                i32 = JS_VALUE_GET_INT(v);
+            else if (JS_ToInt32(ctx, &i32, v))
+                goto done;
+            switch (f->type[i]) {
+            case FFI_I8: w.i = (int64_t)(int8_t)i32; break;
+            case FFI_U8: w.i = (uint8_t)i32; break;
+            case FFI_I16: w.i = (int64_t)(int16_t)i32; break;
+            case FFI_U16: w.i = (uint16_t)i32; break;
+            case FFI_U32: w.i = (uint32_t)i32; break;
+            default: w.i = (int64_t)i32; break;
+            }
+            break;
+        }
+
+        switch (f->loc[i]) {
+        case FFI_LOC_INT:
+            r[f->index[i]].i = w.i;
+            break;
+        case FFI_LOC_FP:
+#if defined(FFI_POSITIONAL)
+            r[f->index[i]].d = w.d;
+#else
+            fr[f->index[i]] = w.d;
+#endif
+            break;
+        default:
+            s[f->index[i]] = w.i;
+            break;
+        }
+    }
+
+    ffi_invoke(f, r, fr, s, &out);
+
+    switch (f->ret) {
+    case FFI_VOID: ret = JS_UNDEFINED; break;
+    case FFI_I8: ret = JS_NewInt32(ctx, (int8_t)out.i); break;
+    case FFI_U8: ret = JS_NewInt32(ctx, (uint8_t)out.i); break;
+    case FFI_I16: ret = JS_NewInt32(ctx, (int16_t)out.i); break;
+    case FFI_U16: ret = JS_NewInt32(ctx, (uint16_t)out.i); break;
+    case FFI_I32: ret = JS_NewInt32(ctx, (int32_t)out.i); break;
+    case FFI_U32: ret = JS_NewUint32(ctx, (uint32_t)out.i); break;
+    case FFI_I64: ret = JS_NewBigInt64(ctx, (int64_t)out.i); break;
+    case FFI_U64:
+    case FFI_PTR: ret = JS_NewBigUint64(ctx, out.i); break;
+    case FFI_F64: ret = JS_NewFloat64(ctx, out.d); break;
+    case FFI_F32: {
+        float fl;
+        uint32_t lo = (uint32_t)out.i;
+        memcpy(&fl, &lo, sizeof(fl));
+        ret = JS_NewFloat64(ctx, fl);
+        break;
+    }
+    case FFI_CSTR:
+        ret = out.i ? JS_NewString(ctx, (const char *)(uintptr_t)out.i)
+                    : JS_NULL;
+        break;
+    }
+done:
+    while (ncstr > 0)
+        JS_FreeCString(ctx, cstr[--ncstr]);
+    return ret;
+#else
+    return JS_ThrowInternalError(ctx, "ffi: unsupported platform");
+#endif
+}
+
+static void ffi_lib_finalizer(JSRuntime *rt, JSValue val) {
+    ffi_lib *l = JS_GetOpaque(val, ffi_lib_class_id);
+    if (!l)
+        return;
+    if (l->handle)
+        lanyt_js_dll_release(l->filename);
+    mi_free(l->filename);
+    mi_free(l);
+}
+
+static void ffi_func_finalizer(JSRuntime *rt, JSValue val) {
+    mi_free(JS_GetOpaque(val, ffi_func_class_id));
+}
+
+static JSClassDef ffi_lib_class = {
+    "FFILibrary",
+    .finalizer = ffi_lib_finalizer,
+};
+
+static JSClassDef ffi_func_class = {
+    "FFIFunction",
+    .finalizer = ffi_func_finalizer,
+};
+
+static ffi_lib *ffi_get_lib(JSContext *ctx, JSValueConst this_val) {
+    ffi_lib *l = JS_GetOpaque2(ctx, this_val, ffi_lib_class_id);
+    if (l && !l->handle) {
+        JS_ThrowTypeError(ctx, "ffi: library is closed");
+        return NULL;
+    }
+    return l;
+}
+
+static void *ffi_lookup(JSContext *ctx, ffi_lib *l, JSValueConst name) {
+    const char *s = JS_ToCString(ctx, name);
+    void *p;
+    if (!s)
+        return NULL;
+    p = lanyt_js_dll_sym(l->handle, s);
+    if (!p)
+        JS_ThrowReferenceError(ctx, "ffi: symbol not found: %s", s);
+    JS_FreeCString(ctx, s);
+    return p;
+}
+
+// lib.func(name, ret, [args])
+static JSValue ffi_lib_func(JSContext *ctx, JSValueConst this_val, int argc,
+                            JSValueConst *argv) {
+    ffi_lib *l = ffi_get_lib(ctx, this_val);
+    ffi_func *f;
+    ffi_type t;
+    JSValue obj, fn, data[2];
+    int64_t len = 0;
+
+    if (!l)
+        return JS_EXCEPTION;
+
+    f = mi_zalloc(sizeof(ffi_func));
+    if (!f)
+        return JS_ThrowOutOfMemory(ctx);
+    obj = JS_NewObjectClass(ctx, ffi_func_class_id);
+    if (JS_IsException(obj)) {
+        mi_free(f);
+        return obj;
+    }
+    JS_SetOpaque(obj, f);
+    f->lib = l;
+
+    if (ffi_parse_type(ctx, argv[1], &t))
+        goto fail;
+    f->ret = t;
+
+    if (!JS_IsUndefined(argv[2])) {
+        JSValue v = JS_GetPropertyStr(ctx, argv[2], "length");
+        if (JS_ToInt64(ctx, &len, v)) {
+            JS_FreeValue(ctx, v);
+            goto fail;
+        }
+        JS_FreeValue(ctx, v);
+    }
+    if (len > FFI_MAX_ARGS) {
+        JS_ThrowRangeError(ctx, "ffi: more than %d arguments", FFI_MAX_ARGS);
+        goto fail;
+    }
+    f->nargs = len;
+    for (int i = 0; i < f->nargs; ++i) {
+        JSValue v = JS_GetPropertyUint32(ctx, argv[2], i);
+        int err = ffi_parse_type(ctx, v, &t);
+        JS_FreeValue(ctx, v);
+        if (err)
+            goto fail;
+        if (t == FFI_VOID) {
+            JS_ThrowTypeError(ctx, "ffi: void argument");
+            goto fail;
+        }
+        f->type[i] = t;
+    }
+    if (ffi_compile(ctx, f))
+        goto fail;
+
+    f->fn = ffi_lookup(ctx, l, argv[0]);
+    if (!f->fn)
+        goto fail;
+
+    data[0] = obj;
+    data[1] = (JSValue)this_val;
+    fn = JS_NewCFunctionData(ctx, ffi_call, f->nargs, 0, 2, data);
+    JS_FreeValue(ctx, obj);
+    return fn;
+fail:
+    JS_FreeValue(ctx, obj);
+    return JS_EXCEPTION;
+}
+
+// lib.symbol(name), the address as a BigInt
+static JSValue ffi_lib_symbol(JSContext *ctx, JSValueConst this_val, int argc,
+                              JSValueConst *argv) {
+    ffi_lib *l = ffi_get_lib(ctx, this_val);
+    void *p;
+    if (!l)
+        return JS_EXCEPTION;
+    p = ffi_lookup(ctx, l, argv[0]);
+    if (!p)
+        return JS_EXCEPTION;
+    return JS_NewBigUint64(ctx, (uintptr_t)p);
+}
+
+static JSValue ffi_lib_close(JSContext *ctx, JSValueConst this_val, int argc,
+                             JSValueConst *argv) {
+    ffi_lib *l = JS_GetOpaque2(ctx, this_val, ffi_lib_class_id);
+    if (!l)
+        return JS_EXCEPTION;
+    if (l->handle) {
+        lanyt_js_dll_release(l->filename);
+        l->handle = NULL;
+    }
+    return JS_UNDEFINED;
+}
+
+static const JSCFunctionListEntry ffi_lib_proto_funcs[] = {
+    JS_CFUNC_DEF("func", 3, ffi_lib_func),
+    JS_CFUNC_DEF("symbol", 1, ffi_lib_symbol),
+    JS_CFUNC_DEF("close", 0, ffi_lib_close),
+};
+
+static JSValue js_ffi_dlopen(JSContext *ctx, JSValueConst this_val, int argc,
+                             JSValueConst *argv) {
+    const char *filename = JS_ToCString(ctx, argv[0]);
+    char *error = NULL;
+    ffi_lib *l;
+    JSValue obj;
+
+    if (!filename)
+        return JS_EXCEPTION;
+
+    obj = JS_NewObjectClass(ctx, ffi_lib_class_id);
+    if (JS_IsException(obj))
+        goto done;
+    l = mi_zalloc(sizeof(ffi_lib));
+    if (!l || !(l->filename = mi_strdup(filename))) {
+        mi_free(l);
+        JS_FreeValue(ctx, obj);
+        obj = JS_ThrowOutOfMemory(ctx);
+        goto done;
+    }
+    JS_SetOpaque(obj, l);
+
+    l->handle = lanyt_js_dll_open(filename, &error);
+    if (!l->handle) {
+        JS_FreeValue(ctx, obj);
+        obj = JS_ThrowReferenceError(ctx, "ffi: %s",
+                                     error ? error : "cannot open library");
+        mi_free(error);
+    }
+done:
+    JS_FreeCString(ctx, filename);
+    return obj;
+}
+
+static const JSCFunctionListEntry js_ffi_funcs[] = {
+    JS_PROP_STRING_DEF("p_suffix", p_suffix, JS_PROP_ENUMERABLE),
+    JS_CFUNC_DEF("dlopen", 1, js_ffi_dlopen),
+};
+
+static int js_ffi_init(JSContext *ctx, JSModuleDef *m) {
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSValue proto;
+
+    pthread_once(&ffi_class_once, ffi_new_class_ids);
+    if (!JS_IsRegisteredClass(rt, ffi_lib_class_id)) {
+        JS_NewClass(rt, ffi_lib_class_id, &ffi_lib_class);
+        JS_NewClass(rt, ffi_func_class_id, &ffi_func_class);
+    }
+    proto = JS_NewObject(ctx);
+    JS_SetPropertyFunctionList(ctx, proto, ffi_lib_proto_funcs,
+                               countof(ffi_lib_proto_funcs));
+    JS_SetClassProto(ctx, ffi_lib_class_id, proto);
+
+    return JS_SetModuleExportList(ctx, m, js_ffi_funcs, countof(js_ffi_funcs));
+}
+
+JSModuleDef *lanyt_js_init_module_ffi(JSContext *ctx,
+                                      const char *module_name) {
+    JSModuleDef *m;
+    m = JS_NewCModule(ctx, module_name, js_ffi_init);
+    if (!m)
+        return NULL;
+    JS_AddModuleExportList(ctx, m, js_ffi_funcs, countof(js_ffi_funcs));
+    return m;
+}
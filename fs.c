@@ -0,0 +1,574 @@
+#include "module.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cutils.h>
+#include <mimalloc.h>
+#include <quickjs.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/mman.h>
+#endif
+
+/* lanyt:fs moves file bytes without stdio or JS strings in between:
+ *
+ *   import * as fs from "lanyt:fs";
+ *   const head = fs.mmap("big.csv", 0, 1 << 30); // ArrayBuffer on the file
+ *   const out = fs.writer("out.csv");
+ *   for (const chunk of fs.reader("big.csv"))    // Uint8Array, refilled
+ *       out.write(chunk);
+ *   out.close();
+ *
+ * mmap maps the file privately. Pages are read as they are touched, writes
+ * through the buffer never reach the file, and the finalizer unmaps. An
+ * ArrayBuffer holds at most 2 GiB, so larger files are mapped a window at
+ * a time. A reader owns one ArrayBuffer and every chunk is a view on it:
+ * a chunk is valid until the next one is read. A writer gathers small
+ * writes and passes large ones to write(2) as they are, strings as their
+ * UTF-8 bytes. */
+
+#if !defined(O_BINARY)
+#define O_BINARY 0
+#endif
+#if !defined(O_CLOEXEC)
+#define O_CLOEXEC 0
+#endif
+
+#define FS_CHUNK_SIZE (1 << 20)
+#define FS_WRITE_BUFFER (1 << 16)
+#define FS_MAX_BUFFER INT32_MAX
+
+typedef struct {
+    int fd; // -1 once closed or at the end
+    JSValue buf;  // the ArrayBuffer chunks are read into
+    JSValue ctor; // Uint8Array
+} fs_reader;
+
+typedef struct {
+    int fd; // -1 once closed
+    size_t used;
+    uint8_t *buf; // FS_WRITE_BUFFER bytes
+} fs_writer;
+
+typedef struct {
+    void *base;
+    size_t len;
+} fs_map;
+
+static JSClassID fs_reader_class_id, fs_writer_class_id;
+static pthread_once_t fs_class_once = PTHREAD_ONCE_INIT;
+
+static void fs_new_class_ids(void) {
+    JS_NewClassID(&fs_reader_class_id);
+    JS_NewClassID(&fs_writer_class_id);
+}
+
+static JSValue fs_throw_errno(JSContext *ctx, const char *what) {
+    return JS_ThrowInternalError(ctx, "fs: %s: %s", what, strerror(errno));
+}
+
+static int fs_open(JSContext *ctx, JSValueConst path, int flags) {
+    const char *s = JS_ToCString(ctx, path);
+    int fd;
+
+    if (!s)
+        return -1;
+    fd = open(s, flags | O_BINARY | O_CLOEXEC, 0666);
+    if (fd < 0)
+        fs_throw_errno(ctx, s);
+    JS_FreeCString(ctx, s);
+    return fd;
+}
+
+static int fs_write_all(int fd, const uint8_t *p, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// the bytes of an ArrayBuffer or a typed array
+static uint8_t *fs_bytes(JSContext *ctx, JSValueConst v, size_t *plen) {
+    size_t off, len, bpe, size;
+    JSValue buf = JS_GetTypedArrayBuffer(ctx, v, &off, &len, &bpe);
+    uint8_t *p;
+
+    if (JS_IsException(buf)) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return JS_GetArrayBuffer(ctx, plen, v);
+    }
+    p = JS_GetArrayBuffer(ctx, &size, buf);
+    JS_FreeValue(ctx, buf);
+    *plen = len;
+    return p ? p + off : NULL;
+}
+
+static void fs_free_buffer(JSRuntime *rt, void *opaque, void *ptr) {
+    mi_free(ptr);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+static void fs_unmap(JSRuntime *rt, void *opaque, void *ptr) {
+    fs_map *m = opaque;
+    munmap(m->base, m->len);
+    mi_free(m);
+}
+#endif
+
+/* mmap */
+
+static JSValue js_fs_mmap(JSContext *ctx, JSValueConst this_val, int argc,
+                          JSValueConst *argv) {
+    static uint8_t empty[1];
+    int64_t off = 0, len = -1;
+    struct stat st;
+    uint8_t *p;
+    JSValue obj;
+    int fd;
+
+    if (argc > 1 && JS_ToInt64Ext(ctx, &off, argv[1]))
+        return JS_EXCEPTION;
+    if (argc > 2 && !JS_IsUndefined(argv[2]) &&
+        JS_ToInt64Ext(ctx, &len, argv[2]))
+        return JS_EXCEPTION;
+    if (off < 0)
+        return JS_ThrowRangeError(ctx, "fs: negative offset");
+    fd = fs_open(ctx, argv[0], O_RDONLY);
+    if (fd < 0)
+        return JS_EXCEPTION;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return JS_ThrowTypeError(ctx, "fs: mmap needs a regular file");
+    }
+    // the window is cut to the end of the file
+    if (off > st.st_size)
+        off = st.st_size;
+    if (len < 0 || len > st.st_size - off)
+        len = st.st_size - off;
+    if (len > FS_MAX_BUFFER) {
+        close(fd);
+        return JS_ThrowRangeError(ctx, "fs: window over 2 GiB, map less");
+    }
+    if (len == 0) {
+        close(fd);
+        return JS_NewArrayBuffer(ctx, empty, 0, NULL, NULL, 0);
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    p = mi_malloc(len);
+    if (!p) {
+        close(fd);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    for (int64_t n = 0; n < len;) {
+        int k = lseek(fd, off + n, SEEK_SET) < 0
+                    ? -1
+                    : read(fd, p + n, (unsigned)(len - n));
+        if (k <= 0) {
+            mi_free(p);
+            close(fd);
+            return fs_throw_errno(ctx, "read");
+        }
+        n += k;
+    }
+    close(fd);
+    obj = JS_NewArrayBuffer(ctx, p, len, fs_free_buffer, NULL, 0);
+    if (JS_IsException(obj))
+        mi_free(p);
+#else
+    {
+        // the mapping starts on a page, the window need not
+        int64_t start = off & ~(int64_t)(sysconf(_SC_PAGESIZE) - 1);
+        fs_map *m = mi_malloc(sizeof(fs_map));
+        if (!m) {
+            close(fd);
+            return JS_ThrowOutOfMemory(ctx);
+        }
+        m->len = len + (off - start);
+        m->base = mmap(NULL, m->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                       start);
+        close(fd);
+        if (m->base == MAP_FAILED) {
+            mi_free(m);
+            return fs_throw_errno(ctx, "mmap");
+        }
+        p = (uint8_t *)m->base + (off - start);
+        obj = JS_NewArrayBuffer(ctx, p, len, fs_unmap, m, 0);
+        if (JS_IsException(obj)) {
+            munmap(m->base, m->len);
+            mi_free(m);
+        }
+    }
+#endif
+    return obj;
+}
+
+static JSValue js_fs_size(JSContext *ctx, JSValueConst this_val, int argc,
+                          JSValueConst *argv) {
+    const char *s = JS_ToCString(ctx, argv[0]);
+    struct stat st;
+    JSValue ret;
+
+    if (!s)
+        return JS_EXCEPTION;
+    ret = stat(s, &st) ? fs_throw_errno(ctx, s)
+                       : JS_NewInt64(ctx, (int64_t)st.st_size);
+    JS_FreeCString(ctx, s);
+    return ret;
+}
+
+/* reader */
+
+static void fs_reader_finalizer(JSRuntime *rt, JSValue val) {
+    fs_reader *r = JS_GetOpaque(val, fs_reader_class_id);
+    if (!r)
+        return;
+    if (r->fd >= 0)
+        close(r->fd);
+    JS_FreeValueRT(rt, r->buf);
+    JS_FreeValueRT(rt, r->ctor);
+    mi_free(r);
+}
+
+static void fs_reader_mark(JSRuntime *rt, JSValueConst val,
+                           JS_MarkFunc *mark_func) {
+    fs_reader *r = JS_GetOpaque(val, fs_reader_class_id);
+    if (!r)
+        return;
+    JS_MarkValue(rt, r->buf, mark_func);
+    JS_MarkValue(rt, r->ctor, mark_func);
+}
+
+static JSClassDef fs_reader_class = {
+    "FSReader",
+    .finalizer = fs_reader_finalizer,
+    .gc_mark = fs_reader_mark,
+};
+
+// the next chunk as a view on the reader's buffer, null at the end
+static JSValue fs_reader_chunk(JSContext *ctx, JSValueConst this_val) {
+    fs_reader *r = JS_GetOpaque2(ctx, this_val, fs_reader_class_id);
+    size_t size, n = 0;
+    JSValue args[3];
+    uint8_t *p;
+
+    if (!r)
+        return JS_EXCEPTION;
+    if (r->fd < 0)
+        return JS_NULL;
+    p = JS_GetArrayBuffer(ctx, &size, r->buf);
+    if (!p)
+        return JS_EXCEPTION;
+    // fill the whole buffer, so that only the last chunk is short
+    while (n < size) {
+        ssize_t k = read(r->fd, p + n, size - n);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k < 0)
+            return fs_throw_errno(ctx, "read");
+        if (k == 0)
+            break;
+        n += k;
+    }
+    if (n == 0) {
+        close(r->fd);
+        r->fd = -1;
+        return JS_NULL;
+    }
+    args[0] = r->buf;
+    args[1] = JS_NewInt32(ctx, 0);
+    args[2] = JS_NewInt64(ctx, n);
+    return JS_CallConstructor(ctx, r->ctor, 3, args);
+}
+
+static JSValue fs_reader_read(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv) {
+    return fs_reader_chunk(ctx, this_val);
+}
+
+static JSValue fs_reader_next(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv) {
+    JSValue chunk = fs_reader_chunk(ctx, this_val), ret;
+
+    if (JS_IsException(chunk))
+        return chunk;
+    ret = JS_NewObject(ctx);
+    if (JS_IsException(ret)) {
+        JS_FreeValue(ctx, chunk);
+        return ret;
+    }
+    JS_SetPropertyStr(ctx, ret, "done", JS_NewBool(ctx, JS_IsNull(chunk)));
+    JS_SetPropertyStr(ctx, ret, "value",
+                      JS_IsNull(chunk) ? JS_UNDEFINED : chunk);
+    return ret;
+}
+
+static JSValue fs_reader_iterator(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv) {
+    return JS_DupValue(ctx, this_val);
+}
+
+static JSValue fs_reader_close(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv) {
+    fs_reader *r = JS_GetOpaque2(ctx, this_val, fs_reader_class_id);
+    if (!r)
+        return JS_EXCEPTION;
+    if (r->fd >= 0)
+        close(r->fd);
+    r->fd = -1;
+    return JS_UNDEFINED;
+}
+
+static const JSCFunctionListEntry fs_reader_proto_funcs[] = {
+    JS_CFUNC_DEF("read", 0, fs_reader_read),
+    JS_CFUNC_DEF("next", 0, fs_reader_next),
+    JS_CFUNC_DEF("[Symbol.iterator]", 0, fs_reader_iterator),
+    JS_CFUNC_DEF("close", 0, fs_reader_close),
+};
+
+static JSValue js_fs_reader(JSContext *ctx, JSValueConst this_val, int argc,
+                            JSValueConst *argv) {
+    int64_t size = FS_CHUNK_SIZE;
+    JSValue obj, global;
+    fs_reader *r;
+    uint8_t *mem;
+
+    if (argc > 1 && !JS_IsUndefined(argv[1]) &&
+        JS_ToInt64Ext(ctx, &size, argv[1]))
+        return JS_EXCEPTION;
+    if (size <= 0 || size > FS_MAX_BUFFER)
+        return JS_ThrowRangeError(ctx, "fs: invalid chunk size");
+    obj = JS_NewObjectClass(ctx, fs_reader_class_id);
+    if (JS_IsException(obj))
+        return obj;
+    r = mi_malloc(sizeof(fs_reader));
+    mem = mi_malloc(size);
+    if (!r || !mem) {
+        mi_free(r);
+        mi_free(mem);
+        JS_FreeValue(ctx, obj);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    r->buf = JS_NewArrayBuffer(ctx, mem, size, fs_free_buffer, NULL, 0);
+    if (JS_IsException(r->buf)) {
+        mi_free(mem);
+        r->buf = JS_UNDEFINED;
+    }
+    global = JS_GetGlobalObject(ctx);
+    r->ctor = JS_GetPropertyStr(ctx, global, "Uint8Array");
+    JS_FreeValue(ctx, global);
+    r->fd = -1;
+    JS_SetOpaque(obj, r);
+    if (JS_IsUndefined(r->buf) || JS_IsException(r->ctor)) {
+        JS_FreeValue(ctx, obj);
+        return JS_EXCEPTION;
+    }
+    r->fd = fs_open(ctx, argv[0], O_RDONLY);
+    if (r->fd < 0) {
+        JS_FreeValue(ctx, obj);
+        return JS_EXCEPTION;
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return obj;
+}
+
+/* writer */
+
+static int fs_writer_flush_buffer(fs_writer *w) {
+    int ret = fs_write_all(w->fd, w->buf, w->used);
+    w->used = 0;
+    return ret;
+}
+
+static void fs_writer_finalizer(JSRuntime *rt, JSValue val) {
+    fs_writer *w = JS_GetOpaque(val, fs_writer_class_id);
+    if (!w)
+        return;
+    // like a stdio FILE left open: flushed, errors lost
+    if (w->fd >= 0) {
+        fs_writer_flush_buffer(w);
+        close(w->fd);
+    }
+    mi_free(w->buf);
+    mi_free(w);
+}
+
+static JSClassDef fs_writer_class = {
+    "FSWriter",
+    .finalizer = fs_writer_finalizer,
+};
+
+static fs_writer *fs_get_writer(JSContext *ctx, JSValueConst this_val) {
+    fs_writer *w = JS_GetOpaque2(ctx, this_val, fs_writer_class_id);
+    if (w && w->fd < 0) {
+        JS_ThrowTypeError(ctx, "fs: writer is closed");
+        return NULL;
+    }
+    return w;
+}
+
+static int fs_writer_put(fs_writer *w, const uint8_t *p, size_t len) {
+    if (w->used + len > FS_WRITE_BUFFER && fs_writer_flush_buffer(w))
+        return -1;
+    if (len >= FS_WRITE_BUFFER)
+        return fs_write_all(w->fd, p, len);
+    memcpy(w->buf + w->used, p, len);
+    w->used += len;
+    return 0;
+}
+
+static JSValue fs_writer_write(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv) {
+    fs_writer *w = fs_get_writer(ctx, this_val);
+    const char *s;
+    uint8_t *p;
+    size_t len;
+    int r;
+
+    if (!w)
+        return JS_EXCEPTION;
+    if (JS_IsString(argv[0])) {
+        s = JS_ToCStringLen(ctx, &len, argv[0]);
+        if (!s)
+            return JS_EXCEPTION;
+        r = fs_writer_put(w, (const uint8_t *)s, len);
+        JS_FreeCString(ctx, s);
+    } else {
+        p = fs_bytes(ctx, argv[0], &len);
+        if (!p)
+            return JS_ThrowTypeError(ctx,
+                                     "fs: expected a string or a buffer");
+        r = fs_writer_put(w, p, len);
+    }
+    if (r)
+        return fs_throw_errno(ctx, "write");
+    return JS_UNDEFINED;
+}
+
+static JSValue fs_writer_flush(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv) {
+    fs_writer *w = fs_get_writer(ctx, this_val);
+    if (!w)
+        return JS_EXCEPTION;
+    if (fs_writer_flush_buffer(w))
+        return fs_throw_errno(ctx, "write");
+    return JS_UNDEFINED;
+}
+
+static JSValue fs_writer_close(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv) {
+    fs_writer *w = fs_get_writer(ctx, this_val);
+    int r;
+
+    if (!w)
+        return JS_EXCEPTION;
+    r = fs_writer_flush_buffer(w);
+    if (close(w->fd))
+        r = -1;
+    w->fd = -1;
+    if (r)
+        return fs_throw_errno(ctx, "close");
+    return JS_UNDEFINED;
+}
+
+static const JSCFunctionListEntry fs_writer_proto_funcs[] = {
+    JS_CFUNC_DEF("write", 1, fs_writer_write),
+    JS_CFUNC_DEF("flush", 0, fs_writer_flush),
+    JS_CFUNC_DEF("close", 0, fs_writer_close),
+};
+
+static JSValue js_fs_writer(JSContext *ctx, JSValueConst this_val, int argc,
+                            JSValueConst *argv) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    const char *mode;
+    fs_writer *w;
+    JSValue obj;
+
+    if (argc > 1 && !JS_IsUndefined(argv[1])) {
+        mode = JS_ToCString(ctx, argv[1]);
+        if (!mode)
+            return JS_EXCEPTION;
+        if (!strcmp(mode, "a"))
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+        else if (strcmp(mode, "w"))
+            flags = -1;
+        JS_FreeCString(ctx, mode);
+        if (flags < 0)
+            return JS_ThrowTypeError(ctx, "fs: mode must be 'w' or 'a'");
+    }
+    obj = JS_NewObjectClass(ctx, fs_writer_class_id);
+    if (JS_IsException(obj))
+        return obj;
+    w = mi_zalloc(sizeof(fs_writer));
+    if (!w || !(w->buf = mi_malloc(FS_WRITE_BUFFER))) {
+        mi_free(w);
+        JS_FreeValue(ctx, obj);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    w->fd = -1;
+    JS_SetOpaque(obj, w);
+    w->fd = fs_open(ctx, argv[0], flags);
+    if (w->fd < 0) {
+        JS_FreeValue(ctx, obj);
+        return JS_EXCEPTION;
+    }
+    return obj;
+}
+
+static const JSCFunctionListEntry js_fs_funcs[] = {
+    JS_CFUNC_DEF("mmap", 3, js_fs_mmap),
+    JS_CFUNC_DEF("size", 1, js_fs_size),
+    JS_CFUNC_DEF("reader", 2, js_fs_reader),
+    JS_CFUNC_DEF("writer", 2, js_fs_writer),
+};
+
+static int js_fs_init(JSContext *ctx, JSModuleDef *m) {
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSValue proto, global, ab;
+
+    pthread_once(&fs_class_once, fs_new_class_ids);
+    if (!JS_IsRegisteredClass(rt, fs_reader_class_id)) {
+        JS_NewClass(rt, fs_reader_class_id, &fs_reader_class);
+        JS_NewClass(rt, fs_writer_class_id, &fs_writer_class);
+    }
+    proto = JS_NewObject(ctx);
+    JS_SetPropertyFunctionList(ctx, proto, fs_reader_proto_funcs,
+                               countof(fs_reader_proto_funcs));
+    JS_SetClassProto(ctx, fs_reader_class_id, proto);
+    proto = JS_NewObject(ctx);
+    JS_SetPropertyFunctionList(ctx, proto, fs_writer_proto_funcs,
+                               countof(fs_writer_proto_funcs));
+    JS_SetClassProto(ctx, fs_writer_class_id, proto);
+
+    // the module hands out buffers even where the script names none
+    global = JS_GetGlobalObject(ctx);
+    ab = JS_GetPropertyStr(ctx, global, "ArrayBuffer");
+    if (JS_IsUndefined(ab))
+        JS_AddIntrinsicTypedArrays(ctx);
+    JS_FreeValue(ctx, ab);
+    JS_FreeValue(ctx, global);
+
+    return JS_SetModuleExportList(ctx, m, js_fs_funcs, countof(js_fs_funcs));
+}
+
+JSModuleDef *lanyt_js_init_module_fs(JSContext *ctx, const char *module_name) {
+    JSModuleDef *m;
+    m = JS_NewCModule(ctx, module_name, js_fs_init);
+    if (!m)
+        return NULL;
+    JS_AddModuleExportList(ctx, m, js_fs_funcs, countof(js_fs_funcs));
+    return m;
+}
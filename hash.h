@@ -0,0 +1,41 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static inline uint64_t ljs_hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* 64-bit hash of a byte string, eight bytes per round. Not cryptographic,
+ * but well mixed enough to key caches and tables. */
+static inline uint64_t ljs_hash64(const void *data, size_t len,
+                                  uint64_t seed) {
+    const uint8_t *p = data;
+    uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL), k;
+
+    while (len >= 8) {
+        memcpy(&k, p, 8);
+        h = (h ^ ljs_hash_mix(k)) * 0x9e3779b97f4a7c15ULL;
+        h = (h << 31) | (h >> 33);
+        p += 8;
+        len -= 8;
+    }
+    k = 0;
+    memcpy(&k, p, len);
+    h ^= ljs_hash_mix(k ^ len);
+    return ljs_hash_mix(h);
+}
+
+static inline uint64_t ljs_hash_str(const char *s) {
+    return ljs_hash64(s, strlen(s), 0);
+}
+
+#endif // HASH_H
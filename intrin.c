@@ -0,0 +1,236 @@
+#include "intrin.h"
+#include "jsc.h"
+
+#include <string.h>
+
+#define SCAN_MAX_NESTING 32
+
+typedef struct {
+    const char *name;
+    int mask;
+} intrin_name;
+
+// globals and prototype methods that only exist once an intrinsic is added
+static const intrin_name scan_words[] = {
+    {"Date", LANYT_INTRINSIC_DATE},
+    {"eval", LANYT_INTRINSIC_EVAL},
+    {"Function", LANYT_INTRINSIC_EVAL},
+    {"normalize", LANYT_INTRINSIC_NORMALIZE},
+    {"localeCompare", LANYT_INTRINSIC_NORMALIZE},
+    {"RegExp", LANYT_INTRINSIC_REGEXP},
+    // these construct a RegExp from a string argument
+    {"match", LANYT_INTRINSIC_REGEXP},
+    {"matchAll", LANYT_INTRINSIC_REGEXP},
+    {"search", LANYT_INTRINSIC_REGEXP},
+    {"JSON", LANYT_INTRINSIC_JSON},
+    {"Proxy", LANYT_INTRINSIC_PROXY},
+    {"Map", LANYT_INTRINSIC_MAPSET},
+    {"Set", LANYT_INTRINSIC_MAPSET},
+    {"WeakMap", LANYT_INTRINSIC_MAPSET},
+    {"WeakSet", LANYT_INTRINSIC_MAPSET},
+    {"ArrayBuffer", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"SharedArrayBuffer", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"DataView", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Atomics", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Int8Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Uint8Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Uint8ClampedArray", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Int16Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Uint16Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Int32Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Uint32Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"BigInt64Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"BigUint64Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Float32Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"Float64Array", LANYT_INTRINSIC_TYPED_ARRAYS},
+};
+
+// keywords after which a '/' starts a regexp rather than a division
+static const char *regexp_keywords[] = {
+    "return", "typeof", "instanceof", "in",    "of",    "new",   "delete",
+    "void",   "throw",  "case",       "do",    "else",  "yield", "await",
+};
+
+static const intrin_name profiles[] = {
+    {"full", LANYT_INTRINSIC_ALL},
+    {"compute", LANYT_INTRINSIC_JSON | LANYT_INTRINSIC_MAPSET |
+                    LANYT_INTRINSIC_TYPED_ARRAYS},
+    {"minimal", 0},
+    {"auto", LANYT_INTRINSIC_AUTO},
+    {"date", LANYT_INTRINSIC_DATE},
+    {"eval", LANYT_INTRINSIC_EVAL},
+    {"normalize", LANYT_INTRINSIC_NORMALIZE},
+    {"regexp", LANYT_INTRINSIC_REGEXP},
+    {"json", LANYT_INTRINSIC_JSON},
+    {"proxy", LANYT_INTRINSIC_PROXY},
+    {"mapset", LANYT_INTRINSIC_MAPSET},
+    {"typedarrays", LANYT_INTRINSIC_TYPED_ARRAYS},
+};
+
+static int is_word_start(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+           c == '$';
+}
+
+static int is_word_char(int c) {
+    return is_word_start(c) || (c >= '0' && c <= '9');
+}
+
+static int word_is(const char *s, size_t len, const char *w) {
+    return strlen(w) == len && !memcmp(s, w, len);
+}
+
+static const char *skip_quoted(const char *p, const char *end, char q) {
+    while (p < end && *p != q && *p != '\n') {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        p++;
+    }
+    return p < end ? p + 1 : end;
+}
+
+// p is past the opening '/'; a class may hold an unescaped '/'
+static const char *skip_regexp(const char *p, const char *end) {
+    int in_class = 0;
+    while (p < end && *p != '\n') {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        else if (*p == '[')
+            in_class = 1;
+        else if (*p == ']')
+            in_class = 0;
+        else if (*p == '/' && !in_class)
+            break;
+        p++;
+    }
+    if (p < end && *p == '/')
+        p++;
+    while (p < end && is_word_char(*p))
+        p++;
+    return p;
+}
+
+int ljs_intrin_scan(const char *src, size_t len) {
+    const char *p = src, *end = src + len;
+    // open braces of each ${...} we are in, innermost last
+    int braces[SCAN_MAX_NESTING], depth = 0;
+    int in_template = 0, after_value = 0, mask = 0;
+
+    while (p < end) {
+        char c = *p;
+
+        if (in_template) {
+            if (c == '\\' && p + 1 < end) {
+                p += 2;
+            } else if (c == '`') {
+                in_template = 0;
+                after_value = 1;
+                p++;
+            } else if (c == '$' && p + 1 < end && p[1] == '{' &&
+                       depth < SCAN_MAX_NESTING) {
+                braces[depth++] = 0;
+                in_template = 0;
+                after_value = 0;
+                p += 2;
+            } else {
+                p++;
+            }
+            continue;
+        }
+
+        if (c == '/' && p + 1 < end && p[1] == '/') {
+            while (p < end && *p != '\n')
+                p++;
+        } else if (c == '/' && p + 1 < end && p[1] == '*') {
+            const char *e = NULL;
+            for (const char *q = p + 2; q + 1 < end && !e; q++)
+                if (q[0] == '*' && q[1] == '/')
+                    e = q + 2;
+            p = e ? e : end;
+        } else if (c == '/') {
+            if (after_value) {
+                p++;
+                after_value = 0;
+            } else {
+                mask |= LANYT_INTRINSIC_REGEXP;
+                p = skip_regexp(p + 1, end);
+                after_value = 1;
+            }
+        } else if (c == '\'' || c == '"') {
+            p = skip_quoted(p + 1, end, c);
+            after_value = 1;
+        } else if (c == '`') {
+            in_template = 1;
+            p++;
+        } else if (is_word_start((unsigned char)c) ||
+                   (unsigned char)c >= 0x80) {
+            const char *w = p;
+            size_t n;
+            while (p < end &&
+                   (is_word_char((unsigned char)*p) ||
+                    (unsigned char)*p >= 0x80))
+                p++;
+            n = p - w;
+            after_value = 1;
+            for (size_t i = 0;
+                 i < sizeof(regexp_keywords) / sizeof(regexp_keywords[0]);
+                 i++) {
+                if (word_is(w, n, regexp_keywords[i])) {
+                    after_value = 0;
+                    break;
+                }
+            }
+            for (size_t i = 0; i < sizeof(scan_words) / sizeof(scan_words[0]);
+                 i++) {
+                if (word_is(w, n, scan_words[i].name))
+                    mask |= scan_words[i].mask;
+            }
+        } else if (c >= '0' && c <= '9') {
+            while (p < end && (is_word_char((unsigned char)*p) || *p == '.'))
+                p++;
+            after_value = 1;
+        } else if (c == ')' || c == ']') {
+            after_value = 1;
+            p++;
+        } else if (c == '{') {
+            if (depth)
+                braces[depth - 1]++;
+            after_value = 0;
+            p++;
+        } else if (c == '}') {
+            if (depth && braces[depth - 1]-- == 0) {
+                // back in the template the ${ came from
+                depth--;
+                in_template = 1;
+            }
+            // a block or an object literal; a regexp is the safer guess
+            after_value = 0;
+            p++;
+        } else {
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+                after_value = 0;
+            p++;
+        }
+    }
+    return mask;
+}
+
+int ljs_intrin_parse(const char *spec) {
+    int mask = 0;
+
+    while (*spec) {
+        const char *e = strchr(spec, ',');
+        size_t n = e ? (size_t)(e - spec) : strlen(spec), i;
+        for (i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+            if (word_is(spec, n, profiles[i].name))
+                break;
+        }
+        if (i == sizeof(profiles) / sizeof(profiles[0]))
+            return -1;
+        mask |= profiles[i].mask;
+        spec += n;
+        if (*spec == ',')
+            spec++;
+    }
+    return mask;
+}
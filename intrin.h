@@ -0,0 +1,21 @@
+#ifndef INTRIN_H
+#define INTRIN_H
+
+#include <stddef.h>
+
+/* Masks are LANYT_INTRINSIC_* from jsc.h. */
+
+/* Intrinsics a script's source may need, found by scanning its tokens for
+ * the globals and methods each one installs and for regexp literals. The
+ * scan errs on the side of reporting too much: names inside strings and
+ * comments are skipped, but a property that merely shares a name with a
+ * global (obj.Date) still counts. Globals reached only through computed
+ * names, like globalThis["Da" + "te"], are not found. */
+int ljs_intrin_scan(const char *src, size_t len);
+
+/* Comma-separated profiles (full, compute, minimal, auto) and intrinsic
+ * names (date, eval, normalize, regexp, json, proxy, mapset, typedarrays),
+ * or'ed together. -1 on an unknown name. */
+int ljs_intrin_parse(const char *spec);
+
+#endif // INTRIN_H
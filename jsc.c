@@ -1,32 +1,139 @@
 
 #include "jsc.h"
+#include "bundle.h"
+#include "cache.h"
+#include "deps.h"
+#include "exe.h"
+#include "hash.h"
+#include "intrin.h"
+#include "loop.h"
+#include "lz.h"
 #include "module.h"
+#include "prof.h"
+#include "resolve.h"
+#include "trace.h"
 
+#include <inttypes.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
 #include <mimalloc.h>
+#include <pthread.h>
 #include <string.h>
 
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(__APPLE__)
 #define MALLOC_OVERHEAD 0
 #else
 #define MALLOC_OVERHEAD 8
 #endif
 
+/* Per-runtime allocator state, passed to JS_NewRuntime2 as the malloc
+ * opaque. quickjs-libc owns the runtime opaque, so lookups by runtime go
+ * through the rt_infos list instead. With a private heap every engine
+ * allocation of the runtime lands in its own mimalloc pages. The heap is
+ * thread-local to the thread that created the runtime, which is also the
+ * only thread that may use it. */
+enum { MEM_COMPILE, MEM_LOAD, MEM_EVAL, MEM_PHASES };
+#define MEM_CLASSES 16
+
+typedef struct {
+    char *name;
+    uint64_t count[MEM_PHASES];
+    uint64_t bytes[MEM_PHASES];
+    int64_t net[MEM_PHASES]; // allocated minus freed while current
+} mem_module;
+
+/* Allocation accounting of a LANYT_RT_MEM_STATS runtime. Every allocation
+ * is charged to the module being compiled, loaded or evaluated at the
+ * time. Evaluation of a module graph runs from the entry, so the entry's
+ * eval column also covers what its dependencies do at run time. */
+typedef struct {
+    size_t peak;
+    uint64_t classes[MEM_CLASSES]; // allocations up to 16 << i bytes
+    mem_module *mods;
+    int len;
+    int cap;
+    int current; // mods index * MEM_PHASES + phase, or -1
+    int report_gen;
+} mem_stats;
+
+typedef struct rt_info {
+    struct rt_info *next;
+    JSRuntime *rt;
+    mi_heap_t *heap;   // NULL without LANYT_RT_HEAP
+    mem_stats *stats; // NULL without LANYT_RT_MEM_STATS
+    ljs_prof *prof;    // between lanyt_jsc_prof_start and _stop
+    JSContext *ctx;    // context inside lanyt_js_run, for samples
+    JSValue error;     // its Error constructor, taken before any script ran
+    int flags;
+} rt_info;
+
+static rt_info *rt_infos;
+static pthread_mutex_t rt_infos_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static rt_info *rt_info_find(JSRuntime *rt) {
+    rt_info *i;
+    pthread_mutex_lock(&rt_infos_lock);
+    for (i = rt_infos; i && i->rt != rt; i = i->next)
+        ;
+    pthread_mutex_unlock(&rt_infos_lock);
+    return i;
+}
+
+static inline mi_heap_t *ljs_heap(JSMallocState *s) {
+    return s->opaque ? ((rt_info *)s->opaque)->heap : NULL;
+}
+
+static void mem_account(JSMallocState *s, int64_t delta, size_t size) {
+    mem_stats *m = s->opaque ? ((rt_info *)s->opaque)->stats : NULL;
+    int c = 0;
+
+    if (likely(!m))
+        return;
+    if (s->malloc_size > m->peak)
+        m->peak = s->malloc_size;
+    if (size) {
+        while (c < MEM_CLASSES - 1 && size > ((size_t)16 << c))
+            ++c;
+        m->classes[c]++;
+    }
+    if (m->current >= 0) {
+        mem_module *mod = &m->mods[m->current / MEM_PHASES];
+        int phase = m->current % MEM_PHASES;
+        if (size) {
+            mod->count[phase]++;
+            mod->bytes[phase] += size;
+        }
+        mod->net[phase] += delta;
+    }
+}
+
 static void *ljs_def_malloc(JSMallocState *s, size_t size) {
     void *ptr;
 
     if (size == 0 || unlikely(s->malloc_size + size > s->malloc_limit))
         return NULL;
 
-    ptr = mi_malloc(size);
+    ptr = ljs_heap(s) ? mi_heap_malloc(ljs_heap(s), size) : mi_malloc(size);
     if (!ptr)
         return NULL;
 
     s->malloc_count++;
     s->malloc_size += mi_usable_size(ptr) + MALLOC_OVERHEAD;
+    mem_account(s, mi_usable_size(ptr), mi_usable_size(ptr));
     return ptr;
 }
 
@@ -35,6 +142,7 @@ static void ljs_def_free(JSMallocState *s, void *ptr) {
         return;
     s->malloc_count--;
     s->malloc_size -= mi_usable_size(ptr) + MALLOC_OVERHEAD;
+    mem_account(s, -(int64_t)mi_usable_size(ptr), 0);
     mi_free(ptr);
 }
 
@@ -51,17 +159,21 @@ static void *ljs_def_realloc(JSMallocState *s, void *ptr, size_t size) {
     if (size == 0) {
         s->malloc_count--;
         s->malloc_size -= old_size + MALLOC_OVERHEAD;
+        mem_account(s, -(int64_t)old_size, 0);
         mi_free(ptr);
         return NULL;
     }
     if (s->malloc_size + size - old_size > s->malloc_limit)
         return NULL;
 
-    ptr = mi_realloc(ptr, size);
+    ptr = ljs_heap(s) ? mi_heap_realloc(ljs_heap(s), ptr, size)
+                      : mi_realloc(ptr, size);
     if (!ptr)
         return NULL;
 
     s->malloc_size += mi_usable_size(ptr) - old_size;
+    mem_account(s, (int64_t)mi_usable_size(ptr) - (int64_t)old_size,
+                mi_usable_size(ptr) > old_size ? mi_usable_size(ptr) : 0);
     return ptr;
 }
 
@@ -76,48 +188,658 @@ static const JSMallocFunctions def_malloc_funcs = {
     ljs_def_malloc_usable_size,
 };
 
-static JSContext *JS_NewCustomContext(JSRuntime *rt) {
+static atomic_int mem_stats_runtimes;
+static volatile sig_atomic_t mem_report_gen;
+
+/* Charges the runtime's allocations to name in phase until mem_leave gets
+ * the returned token back. Nests, since compiling a module loads its
+ * imports. */
+static int mem_enter(JSContext *ctx, const char *name, int phase) {
+    rt_info *info;
+    mem_stats *m;
+    int prev, i;
+
+    if (!atomic_load_explicit(&mem_stats_runtimes, memory_order_relaxed))
+        return -1;
+    info = rt_info_find(JS_GetRuntime(ctx));
+    if (!info || !(m = info->stats))
+        return -1;
+    prev = m->current;
+    for (i = 0; i < m->len && strcmp(m->mods[i].name, name); ++i)
+        ;
+    if (i == m->len) {
+        if (m->len >= m->cap) {
+            int newcap = m->cap + (m->cap >> 1) + 8;
+            mem_module *a = mi_realloc(m->mods, sizeof(m->mods[0]) * newcap);
+            if (!a)
+                return prev;
+            m->mods = a;
+            m->cap = newcap;
+        }
+        memset(&m->mods[i], 0, sizeof(m->mods[i]));
+        m->mods[i].name = mi_strdup(name);
+        if (!m->mods[i].name)
+            return prev;
+        ++m->len;
+    }
+    m->current = i * MEM_PHASES + phase;
+    return prev;
+}
+
+static void mem_leave(JSContext *ctx, int prev) {
+    rt_info *info;
+
+    if (!atomic_load_explicit(&mem_stats_runtimes, memory_order_relaxed))
+        return;
+    info = rt_info_find(JS_GetRuntime(ctx));
+    if (info && info->stats)
+        info->stats->current = prev;
+}
+
+static void mem_stats_free(mem_stats *m) {
+    if (!m)
+        return;
+    for (int i = 0; i < m->len; ++i)
+        mi_free(m->mods[i].name);
+    mi_free(m->mods);
+    mi_free(m);
+}
+
+void lanyt_jsc_mem_report(JSRuntime *rt, FILE *fp) {
+    rt_info *info = rt_info_find(rt);
+    mem_stats *m = info ? info->stats : NULL;
+    JSMemoryUsage u;
+    static const char *phase_names[MEM_PHASES] = {"compile", "load", "eval"};
+
+    JS_ComputeMemoryUsage(rt, &u);
+    fprintf(fp, "memory report\n");
+    fprintf(fp, "  current: %" PRId64 " KiB in %" PRId64 " blocks\n",
+            u.malloc_size >> 10, u.malloc_count);
+    if (!m) {
+        JS_DumpMemoryUsage(fp, &u, rt);
+        return;
+    }
+    fprintf(fp, "  peak:    %zu KiB\n", m->peak >> 10);
+
+    fprintf(fp, "\n  %-12s %12s\n", "size class", "allocations");
+    for (int c = 0; c < MEM_CLASSES; ++c) {
+        if (!m->classes[c])
+            continue;
+        if (c == MEM_CLASSES - 1)
+            fprintf(fp, "   > %-8zu %12" PRIu64 "\n", (size_t)16 << (c - 1),
+                    m->classes[c]);
+        else
+            fprintf(fp, "  <= %-8zu %12" PRIu64 "\n", (size_t)16 << c,
+                    m->classes[c]);
+    }
+
+    if (m->len) {
+        fprintf(fp, "\n  %-32s", "module (KiB allocated/net)");
+        for (int p = 0; p < MEM_PHASES; ++p)
+            fprintf(fp, " %17s", phase_names[p]);
+        fprintf(fp, "\n");
+        for (int i = 0; i < m->len; ++i) {
+            mem_module *mod = &m->mods[i];
+            fprintf(fp, "  %-32s", mod->name);
+            for (int p = 0; p < MEM_PHASES; ++p)
+                fprintf(fp, " %8" PRIu64 "/%8" PRId64, mod->bytes[p] >> 10,
+                        mod->net[p] / 1024);
+            fprintf(fp, "\n");
+        }
+    }
+    fprintf(fp, "\n");
+    JS_DumpMemoryUsage(fp, &u, rt);
+}
+
+#if defined(SIGUSR1)
+static void mem_report_signal(int sig) { ++mem_report_gen; }
+#endif
+
+/* The engine polls this between bytecodes, which makes it the safe point
+ * for work requested from a signal handler. */
+static int rt_interrupt(JSRuntime *rt, void *opaque) {
+    rt_info *info = opaque;
+
+    if (info->stats && info->stats->report_gen != mem_report_gen) {
+        info->stats->report_gen = mem_report_gen;
+        lanyt_jsc_mem_report(rt, stderr);
+    }
+    if (info->prof && info->ctx)
+        ljs_prof_poll(info->prof, info->ctx, info->error);
+    return 0;
+}
+
+int lanyt_jsc_prof_start(JSRuntime *rt, int hz) {
+    rt_info *info = rt_info_find(rt);
+    if (!info || info->prof)
+        return -1;
+    info->prof = ljs_prof_new(hz);
+    return info->prof ? 0 : -1;
+}
+
+int lanyt_jsc_prof_stop(JSRuntime *rt, const char *filename) {
+    rt_info *info = rt_info_find(rt);
+    FILE *fp;
+    int ret;
+
+    if (!info || !info->prof)
+        return -1;
+    fp = fopen(filename, "w");
+    if (!fp) {
+        perror(filename);
+        ret = -1;
+    } else {
+        ret = ljs_prof_write(info->prof, fp);
+        if (fclose(fp))
+            ret = -1;
+    }
+    ljs_prof_free(info->prof);
+    info->prof = NULL;
+    return ret;
+}
+
+static atomic_int worker_intrinsics = LANYT_INTRINSIC_ALL;
+
+/* None of these may be added twice, the caller keeps track. They only
+ * define globals and prototypes, so they can come after the context is
+ * in use. */
+static void add_intrinsics(JSContext *ctx, int mask) {
+    if (mask & LANYT_INTRINSIC_DATE)
+        JS_AddIntrinsicDate(ctx);
+    if (mask & LANYT_INTRINSIC_EVAL)
+        JS_AddIntrinsicEval(ctx);
+    if (mask & LANYT_INTRINSIC_NORMALIZE)
+        JS_AddIntrinsicStringNormalize(ctx);
+    if (mask & LANYT_INTRINSIC_REGEXP)
+        JS_AddIntrinsicRegExp(ctx);
+    if (mask & LANYT_INTRINSIC_JSON)
+        JS_AddIntrinsicJSON(ctx);
+    if (mask & LANYT_INTRINSIC_PROXY)
+        JS_AddIntrinsicProxy(ctx);
+    if (mask & LANYT_INTRINSIC_MAPSET)
+        JS_AddIntrinsicMapSet(ctx);
+    if (mask & LANYT_INTRINSIC_TYPED_ARRAYS)
+        JS_AddIntrinsicTypedArrays(ctx);
+}
+
+static JSContext *new_context(JSRuntime *rt, int intrinsics) {
+    int span = ljs_trace_begin("intrinsics", NULL);
     JSContext *ctx = JS_NewContextRaw(rt);
     if (!ctx) {
+        ljs_trace_end(span);
         return NULL;
     }
     JS_AddIntrinsicBaseObjects(ctx);
-    JS_AddIntrinsicDate(ctx);
-    JS_AddIntrinsicEval(ctx);
-    JS_AddIntrinsicStringNormalize(ctx);
-    JS_AddIntrinsicRegExp(ctx);
-    JS_AddIntrinsicJSON(ctx);
-    JS_AddIntrinsicProxy(ctx);
-    JS_AddIntrinsicMapSet(ctx);
-    JS_AddIntrinsicTypedArrays(ctx);
+    add_intrinsics(ctx, intrinsics & LANYT_INTRINSIC_ALL);
+    // a module's evaluation returns a promise, so this one is not optional
     JS_AddIntrinsicPromise(ctx);
+    ljs_trace_end(span);
     return ctx;
 }
 
-JSRuntime *lanyt_jsc_new_rt() {
-    JSRuntime *p = JS_NewRuntime2(&def_malloc_funcs, NULL);
-    if (!p)
+static JSContext *JS_NewCustomContext(JSRuntime *rt) {
+    return new_context(rt, LANYT_INTRINSIC_ALL);
+}
+
+/* quickjs-libc installs its own loader on a worker runtime before asking
+ * for the context, so route worker imports through the native registry
+ * first. */
+static JSModuleDef *worker_module_loader(JSContext *ctx,
+                                         const char *module_name,
+                                         void *opaque) {
+    JSModuleDef *m = lanyt_js_init_module(ctx, module_name);
+    if (m)
+        return m;
+    return js_module_loader(ctx, module_name, opaque);
+}
+
+static JSContext *worker_new_context(JSRuntime *rt) {
+    int intrinsics = atomic_load(&worker_intrinsics);
+    JSContext *ctx;
+
+    // a worker compiles its script itself, so there is nothing to scan
+    if (intrinsics & LANYT_INTRINSIC_AUTO)
+        intrinsics = LANYT_INTRINSIC_ALL;
+    ctx = new_context(rt, intrinsics | LANYT_INTRINSIC_EVAL);
+    if (ctx) {
+        JS_AddIntrinsicRegExpCompiler(ctx);
+        JS_SetModuleLoaderFunc(rt, NULL, worker_module_loader, NULL);
+        // Atomics.wait on shared memory; only the main thread must not block
+        JS_SetCanBlock(rt, 1);
+    }
+    // libc's loop runs the worker, its message port included
+    ljs_loop_set_worker_thread();
+    return ctx;
+}
+
+void lanyt_jsc_set_worker_intrinsics(int intrinsics) {
+    atomic_store(&worker_intrinsics, intrinsics);
+}
+
+JSRuntime *lanyt_jsc_new_rt() { return lanyt_jsc_new_rt2(LANYT_RT_HEAP); }
+
+JSRuntime *lanyt_jsc_new_rt2(int flags) {
+    rt_info *info = mi_zalloc(sizeof(rt_info));
+    JSRuntime *p;
+
+    if (!info)
+        return NULL;
+    // dropping the heap is what makes the fast teardown possible
+    if (flags & LANYT_RT_FAST_FREE)
+        flags |= LANYT_RT_HEAP;
+    info->flags = flags;
+    info->error = JS_UNDEFINED;
+    if ((flags & LANYT_RT_HEAP) && !(info->heap = mi_heap_new())) {
+        mi_free(info);
+        return NULL;
+    }
+    if (flags & LANYT_RT_MEM_STATS) {
+        info->stats = mi_zalloc(sizeof(mem_stats));
+        if (!info->stats) {
+            if (info->heap)
+                mi_heap_delete(info->heap);
+            mi_free(info);
+            return NULL;
+        }
+        info->stats->current = -1;
+        info->stats->report_gen = mem_report_gen;
+    }
+    p = JS_NewRuntime2(&def_malloc_funcs, info);
+    if (!p) {
+        if (info->heap)
+            mi_heap_delete(info->heap);
+        mem_stats_free(info->stats);
+        mi_free(info);
         return NULL;
-    js_std_set_worker_new_context_func(JS_NewCustomContext);
+    }
+    info->rt = p;
+    pthread_mutex_lock(&rt_infos_lock);
+    info->next = rt_infos;
+    rt_infos = info;
+    pthread_mutex_unlock(&rt_infos_lock);
+    JS_SetInterruptHandler(p, rt_interrupt, info);
+    if (info->stats) {
+        atomic_fetch_add(&mem_stats_runtimes, 1);
+#if defined(SIGUSR1)
+        signal(SIGUSR1, mem_report_signal);
+#endif
+    }
+
+    js_std_set_worker_new_context_func(worker_new_context);
     js_std_init_handlers(p);
     return p;
 }
 
 void lanyt_jsc_free_rt(JSRuntime *p) {
+    rt_info *info, **pp;
+
+    pthread_mutex_lock(&rt_infos_lock);
+    for (pp = &rt_infos; *pp && (*pp)->rt != p; pp = &(*pp)->next)
+        ;
+    info = *pp;
+    if (info)
+        *pp = info->next;
+    pthread_mutex_unlock(&rt_infos_lock);
+    if (info && info->stats)
+        atomic_fetch_sub(&mem_stats_runtimes, 1);
+    if (info) {
+        ljs_prof_free(info->prof);
+        info->prof = NULL;
+    }
+
+    if (info && (info->flags & LANYT_RT_FAST_FREE)) {
+        // no finalizers, no per-object frees: the runtime, its contexts and
+        // every object die with the heap pages
+        mi_heap_destroy(info->heap);
+        mem_stats_free(info->stats);
+        mi_free(info);
+        return;
+    }
     js_std_free_handlers(p);
     JS_FreeRuntime(p);
+    if (info) {
+        if (info->heap)
+            mi_heap_delete(info->heap);
+        mem_stats_free(info->stats);
+        mi_free(info);
+    }
 }
 
+enum {
+    LANYT_IMAGE_NONE,
+    LANYT_IMAGE_HEAP,     // js_load_file buffer, released with js_free
+    LANYT_IMAGE_MAP,      // read-only file mapping, released with unmap_file
+    LANYT_IMAGE_BORROWED, // the caller's, see lanyt_js_read_mem
+};
+
+/* What an incremental compile starts from, see lanyt_js_set_base. */
+typedef struct {
+    ljs_deps *from; // NULL when the base is missing or stale
+    uint8_t *image; // the base bundle, read whole since it is overwritten
+    size_t image_len;
+    ljs_bundle bundle;
+    int flags; // LANYT_SAVE_* the next bundle is saved with
+    ljs_deps *to; // filled by lanyt_js_eval_parallel
+} incremental;
+
 struct lanyt_js {
     JSContext *ctx;
     int byte_swap;
+    int borrowed; // bytecode points into the head's image, not owned
+    int lazy;     // materialized by the module loader on first import
+    int compressed; // bytecode is ljs_lz compressed to raw_len bytes
+    int atoms;      // atom table is in the head's bundle dictionary
+    int kept;       // record of the base bundle, saved again as it is
+    int mi_owned;   // bytecode is mi_malloc'd, compiled on another runtime
+    size_t raw_len;
     size_t bytecode_len;
     uint8_t *bytecode;
-    char *filename;
+    char *name; // module name the loader resolved, NULL for the entry
+    char *filename; // "<name>" and the source, see lanyt_js_get_filename
+    // filename as stored in the bundle, inflated on first use
+    const uint8_t *debug;
+    size_t debug_size;
+    JSRuntime *rt;
     struct lanyt_js *next;
+    // bundle image backing borrowed bytecode, head node only
+    int image_kind;
+    uint8_t *image;
+    size_t image_len;
+    ljs_bundle bundle; // toc of a v2 image, bundle.image is NULL otherwise
+    char *cache_dir;   // bytecode cache consulted before compiling
+    int intrinsics;    // head only, as given to lanyt_new_js2
+    int installed;     // head only, intrinsics added to ctx so far
+    JSContext *compile_ctx; // head only, see compile_context
+    int uses;          // intrinsics this module references
+    int keep_source;   // head only, see lanyt_js_set_keep_source
+    ljs_resolver *resolver; // head only, canonical module names
+    incremental *incr;      // head only, see lanyt_js_set_base
 };
 
 static lanyt_js *lanyt_new_js_noctx(JSRuntime *rt);
+static void free_help(JSContext *ctx, lanyt_js *ljs);
+
+/* With LANYT_INTRINSIC_AUTO, bring the head's context up to what a module
+ * read or compiled into the chain references. */
+static void use_intrinsics(lanyt_js *head, int mask) {
+    if (!(head->intrinsics & LANYT_INTRINSIC_AUTO))
+        return;
+    mask &= LANYT_INTRINSIC_ALL & ~head->installed;
+    if (mask) {
+        add_intrinsics(head->ctx, mask);
+        head->installed |= mask;
+    }
+}
+
+/* Compiling source needs the eval hook and the regexp compiler, and in a
+ * context they also make eval, Function and new RegExp work. A head whose
+ * intrinsics leave them out compiles in a second context on the same
+ * runtime instead, and only the bytecode comes over. */
+static JSContext *compile_context(lanyt_js *head) {
+    const int need = LANYT_INTRINSIC_EVAL | LANYT_INTRINSIC_REGEXP;
+
+    if ((head->installed & need) == need)
+        return head->ctx;
+    if (!head->compile_ctx)
+        head->compile_ctx = new_context(head->rt, need);
+    return head->compile_ctx;
+}
+
+static uint8_t *load_file(JSContext *ctx, size_t *plen, const char *filename) {
+    int span = ljs_trace_begin("load_file", filename);
+    uint8_t *buf = js_load_file(ctx, plen, filename);
+    ljs_trace_end(span);
+    return buf;
+}
+
+/* Source text handed to the compiler, which wants it NUL-terminated. A
+ * file whose size is not a multiple of the page size is mapped, since the
+ * kernel zero-fills the rest of its last page; any other file is read
+ * straight into one buffer. Either way nothing is copied after that. */
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    int mapped;
+} source;
+
+static int open_source(JSContext *ctx, const char *filename, source *src) {
+    int span = ljs_trace_begin("load_file", filename), ret = -1;
+
+    src->mapped = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    src->buf = js_load_file(ctx, &src->len, filename);
+    if (src->buf)
+        ret = 0;
+#else
+    struct stat st;
+    size_t off = 0;
+    ssize_t r;
+    int fd = open(filename, O_RDONLY);
+
+    src->buf = NULL;
+    if (fd < 0)
+        goto done;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+        goto close;
+    src->len = st.st_size;
+    if (src->len % sysconf(_SC_PAGESIZE)) {
+        void *p = mmap(NULL, src->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            // scanned, hashed and parsed front to back
+            madvise(p, src->len, MADV_SEQUENTIAL);
+            src->buf = p;
+            src->mapped = 1;
+            ret = 0;
+            goto close;
+        }
+    }
+    src->buf = js_malloc(ctx, src->len + 1);
+    if (!src->buf)
+        goto close;
+    while (off < src->len) {
+        r = read(fd, src->buf + off, src->len - off);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        off += r;
+    }
+    if (off < src->len) {
+        js_free(ctx, src->buf);
+        src->buf = NULL;
+        goto close;
+    }
+    src->buf[src->len] = '\0';
+    ret = 0;
+close:
+    close(fd);
+done:
+#endif
+    ljs_trace_end(span);
+    return ret;
+}
+
+static void close_source(JSContext *ctx, source *src) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (src->mapped) {
+        munmap(src->buf, src->len);
+        return;
+    }
+#endif
+    js_free(ctx, src->buf);
+}
+
+// a module name may leave off its ".js"
+static int open_module_source(JSContext *ctx, const char *name,
+                              source *src) {
+    char *alt;
+    int r;
+
+    if (!open_source(ctx, name, src))
+        return 0;
+    alt = js_malloc(ctx, strlen(name) + 4);
+    if (!alt)
+        return -1;
+    sprintf(alt, "%s.js", name);
+    r = open_source(ctx, alt, src);
+    js_free(ctx, alt);
+    return r;
+}
+
+/* "<name>" and the source, the form lanyt_js_get_filename returns, into
+ * out. Returns the size including the NUL; out may be NULL to measure. */
+static size_t source_text(char *out, const char *name, const source *src) {
+    size_t name_len = strlen(name);
+
+    if (out) {
+        out[0] = '<';
+        memcpy(out + 1, name, name_len);
+        out[name_len + 1] = '>';
+        memcpy(out + name_len + 2, src->buf, src->len);
+        out[name_len + 2 + src->len] = '\0';
+    }
+    return name_len + 2 + src->len + 1;
+}
+
+/* The JS_WriteObject output of a module record: inflated when the bundle
+ * stores it compressed, and with its atom table taken back out of the
+ * bundle's dictionary. *owned, if set, is freed by the caller. */
+static const uint8_t *plain_bytecode(JSContext *ctx, const ljs_bundle *b,
+                                     const uint8_t *data, size_t size,
+                                     size_t raw_size, int flags, size_t *plen,
+                                     uint8_t **owned) {
+    uint8_t *buf = NULL, *out;
+    size_t len;
+
+    *owned = NULL;
+    if (flags & LJS_MODULE_LZ) {
+        buf = js_malloc(ctx, raw_size + 1);
+        if (!buf)
+            return NULL;
+        if (ljs_lz_decompress(data, size, buf, raw_size)) {
+            js_free(ctx, buf);
+            JS_ThrowInternalError(ctx, "corrupt compressed bytecode");
+            return NULL;
+        }
+        data = buf;
+        size = raw_size;
+    }
+    if (flags & LJS_MODULE_ATOMS) {
+        len = ljs_bundle_expand(b, data, size, NULL);
+        if (!len) {
+            js_free(ctx, buf);
+            JS_ThrowInternalError(ctx, "corrupt bytecode atom table");
+            return NULL;
+        }
+        out = js_malloc(ctx, len);
+        if (out)
+            ljs_bundle_expand(b, data, size, out);
+        js_free(ctx, buf);
+        if (!out)
+            return NULL;
+        data = buf = out;
+        size = len;
+    }
+    *owned = buf;
+    *plen = size;
+    return data;
+}
+
+/* Deserialize a module record. JS_ReadObject copies what it keeps, so a
+ * rebuilt record only lives for the call. */
+static JSValue read_bytecode(JSContext *ctx, const ljs_bundle *b,
+                             const uint8_t *data, size_t size,
+                             size_t raw_size, int flags, const char *name) {
+    int span = ljs_trace_begin("read_object", name);
+    JSValue obj = JS_EXCEPTION;
+    uint8_t *owned;
+    size_t len;
+
+    data = plain_bytecode(ctx, b, data, size, raw_size, flags, &len, &owned);
+    if (data)
+        obj = JS_ReadObject(ctx, data, len, JS_READ_OBJ_BYTECODE);
+    js_free(ctx, owned);
+    ljs_trace_end(span);
+    return obj;
+}
+
+static int record_flags(const lanyt_js *n) {
+    return (n->compressed ? LJS_MODULE_LZ : 0) |
+           (n->atoms ? LJS_MODULE_ATOMS : 0);
+}
+
+static JSModuleDef *bundle_module_loader(JSContext *ctx, lanyt_js *ljs,
+                                         const char *module_name) {
+    ljs_bundle_module bm;
+    JSModuleDef *m;
+    JSValue obj;
+    int idx = ljs_bundle_find(&ljs->bundle, module_name), mem;
+
+    if (idx < 0 || idx == ljs->bundle.entry)
+        return NULL;
+    ljs_bundle_get(&ljs->bundle, idx, &bm);
+    if (bm.flags & LJS_MODULE_ALIAS)
+        return NULL;
+
+    mem = mem_enter(ctx, module_name, MEM_LOAD);
+    obj = read_bytecode(ctx, &ljs->bundle, bm.data, bm.size, bm.raw_size,
+                        bm.flags, module_name);
+    mem_leave(ctx, mem);
+    if (JS_IsException(obj)) {
+        js_std_dump_error(ctx);
+        return NULL;
+    }
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_MODULE) {
+        JS_FreeValue(ctx, obj);
+        return NULL;
+    }
+    js_module_set_import_meta(ctx, obj, FALSE, FALSE);
+
+    /* the module is already referenced, so we must free it */
+    m = JS_VALUE_GET_PTR(obj);
+    JS_FreeValue(ctx, obj);
+    return m;
+}
+
+/* A module the chain already carries, compiled by an earlier import or
+ * kept from the last run by lanyt_js_adopt, is read from its bytecode
+ * instead of being compiled again next to it. */
+static JSModuleDef *chain_module_loader(JSContext *ctx, lanyt_js *ljs,
+                                        const char *module_name) {
+    JSModuleDef *m;
+    JSValue obj;
+    lanyt_js *n;
+    int mem;
+
+    for (n = ljs->next; n; n = n->next) {
+        if (!n->lazy && n->bytecode && n->name &&
+            !strcmp(n->name, module_name))
+            break;
+    }
+    if (!n)
+        return NULL;
+
+    mem = mem_enter(ctx, module_name, MEM_LOAD);
+    obj = read_bytecode(ctx, &ljs->bundle, n->bytecode, n->bytecode_len,
+                        n->raw_len, record_flags(n), module_name);
+    mem_leave(ctx, mem);
+    if (JS_IsException(obj)) {
+        js_std_dump_error(ctx);
+        return NULL;
+    }
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_MODULE) {
+        JS_FreeValue(ctx, obj);
+        JS_ThrowSyntaxError(ctx, "'%s' is not a module", module_name);
+        js_std_dump_error(ctx);
+        return NULL;
+    }
+    js_module_set_import_meta(ctx, obj, FALSE, FALSE);
+
+    /* the module is already referenced, so we must free it */
+    m = JS_VALUE_GET_PTR(obj);
+    JS_FreeValue(ctx, obj);
+    return m;
+}
 
 static int to_bytecode(JSContext *ctx, JSValueConst obj, lanyt_js *ljs) {
     uint8_t *bytecode_buf;
@@ -138,14 +860,108 @@ static int to_bytecode(JSContext *ctx, JSValueConst obj, lanyt_js *ljs) {
     return 0;
 }
 
+/* Compile source into n, or take the bytecode from the cache when an
+ * identical compile is already there. Like JS_Eval, a module comes back
+ * resolved either way, so its imports have gone through the loader. */
+static JSValue compile_source(JSContext *ctx, const char *cache_dir,
+                              lanyt_js *n, const uint8_t *buf, size_t buf_len,
+                              const char *name, int eval_flags) {
+    ljs_cache_key key;
+    uint8_t *bc = NULL;
+    size_t bc_len;
+    JSValue obj;
+    int mem = mem_enter(ctx, name, MEM_COMPILE);
+    int span = ljs_trace_begin("compile", name);
+
+    n->uses = ljs_intrin_scan((const char *)buf, buf_len);
+    if (cache_dir) {
+        ljs_cache_key_init(&key, name, eval_flags | (n->byte_swap << 16), buf,
+                           buf_len);
+        bc = ljs_cache_load(ctx, cache_dir, &key, &bc_len);
+    }
+    if (bc) {
+        obj = JS_ReadObject(ctx, bc, bc_len, JS_READ_OBJ_BYTECODE);
+        if (JS_IsException(obj)) {
+            js_free(ctx, bc);
+            goto done;
+        }
+        if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE &&
+            JS_ResolveModule(ctx, obj) < 0) {
+            JS_FreeValue(ctx, obj);
+            js_free(ctx, bc);
+            obj = JS_EXCEPTION;
+            goto done;
+        }
+        n->bytecode = bc;
+        n->bytecode_len = bc_len;
+        goto done;
+    }
+
+    obj = JS_Eval(ctx, (const char *)buf, buf_len, name, eval_flags);
+    if (JS_IsException(obj))
+        goto done;
+    if (to_bytecode(ctx, obj, n)) {
+        JS_FreeValue(ctx, obj);
+        obj = JS_ThrowInternalError(ctx, "could not write bytecode '%s'",
+                                    name);
+        goto done;
+    }
+    if (cache_dir)
+        ljs_cache_store(cache_dir, &key, n->bytecode, n->bytecode_len);
+done:
+    ljs_trace_end(span);
+    mem_leave(ctx, mem);
+    return obj;
+}
+
+/* The module name an import refers to, one per file (see resolve.h). A
+ * bundle answers from its toc, so running one does not stat anything. */
+static char *normalize_name(JSContext *ctx, ljs_resolver *r,
+                            const ljs_bundle *b, const char *base,
+                            const char *spec) {
+    ljs_bundle_module bm;
+    char *lexical, *name = NULL, *ret;
+    int idx;
+
+    if (lanyt_js_is_native_module(spec))
+        return js_strdup(ctx, spec);
+    lexical = ljs_resolve_name(base, spec);
+    if (lexical && b && b->image &&
+        (idx = ljs_bundle_find(b, lexical)) >= 0) {
+        ljs_bundle_get(b, idx, &bm);
+        if (bm.flags & LJS_MODULE_ALIAS)
+            ret = js_strndup(ctx, (const char *)bm.data, bm.size);
+        else
+            ret = js_strdup(ctx, lexical);
+        mi_free(lexical);
+        return ret;
+    }
+    if (lexical)
+        name = ljs_resolve(r, lexical);
+    mi_free(lexical);
+    if (!name) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    ret = js_strdup(ctx, name);
+    mi_free(name);
+    return ret;
+}
+
+static char *jsc_module_normalize(JSContext *ctx, const char *base,
+                                  const char *spec, void *opaque) {
+    lanyt_js *ljs = opaque;
+    return normalize_name(ctx, ljs->resolver, &ljs->bundle, base, spec);
+}
+
 static JSModuleDef *jsc_module_loader(JSContext *ctx, const char *module_name,
                                       void *opaque) {
 
     JSModuleDef *m;
-    size_t buf_len;
-    uint8_t *buf;
+    source src;
     JSValue func_val;
-    lanyt_js *ljs = opaque;
+    JSContext *cctx;
+    lanyt_js *ljs = opaque, *n, *tail;
 
     /* check if it is a declared C or system module */
     m = lanyt_js_init_module(ctx, module_name);
@@ -154,108 +970,120 @@ static JSModuleDef *jsc_module_loader(JSContext *ctx, const char *module_name,
         return m;
     }
 
-    buf = js_load_file(ctx, &buf_len, module_name);
+    /* then if the chain already has it */
+    m = chain_module_loader(ctx, ljs, module_name);
+    if (m)
+        return m;
 
-    if (!buf) {
-        size_t len = strlen(module_name);
-        char *module_name_buf = js_malloc(ctx, len + 4);
-        if (!module_name_buf) {
-            js_std_dump_error(ctx);
-            return NULL;
-        }
-        snprintf(module_name_buf, len + 4, "%s.js", module_name);
-        buf = js_load_file(ctx, &buf_len, module_name_buf);
-        js_free(ctx, module_name_buf);
+    /* then if the bundle we run from carries it */
+    if (ljs->bundle.image) {
+        m = bundle_module_loader(ctx, ljs, module_name);
+        if (m)
+            return m;
     }
-    if (!buf) {
+
+    if (open_module_source(ctx, module_name, &src)) {
         JS_ThrowInternalError(ctx, "could not load module filename '%s'",
                               module_name);
         js_std_dump_error(ctx);
         return NULL;
     }
 
-    /* compile the module */
-    func_val = JS_Eval(ctx, (char *)buf, buf_len, module_name,
-                       JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
-    js_free(ctx, buf);
-
-    if (JS_IsException(func_val)) {
+    n = lanyt_new_js_noctx(JS_GetRuntime(ctx));
+    cctx = compile_context(ljs);
+    if (!n || !cctx) {
+        mi_free(n);
+        close_source(ctx, &src);
+        JS_ThrowOutOfMemory(ctx);
         js_std_dump_error(ctx);
         return NULL;
     }
 
-    while (ljs->next != NULL)
-        ljs = ljs->next;
+    /* compile the module */
+    func_val = compile_source(cctx, ljs->cache_dir, n, src.buf, src.len,
+                              module_name,
+                              JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+    if (ljs->keep_source && !JS_IsException(func_val)) {
+        n->filename = js_malloc(ctx, source_text(NULL, module_name, &src));
+        if (n->filename) {
+            source_text(n->filename, module_name, &src);
+        } else {
+            JS_FreeValue(cctx, func_val);
+            func_val = JS_EXCEPTION;
+        }
+    }
+    close_source(ctx, &src);
 
-    ljs->next = lanyt_new_js_noctx(JS_GetRuntime(ctx));
-    if (to_bytecode(ctx, func_val, ljs->next)) {
-        JS_FreeValue(ctx, func_val);
-        JS_ThrowInternalError(ctx, "could not write module bytecode '%s'",
-                              module_name);
+    if (JS_IsException(func_val)) {
+        free_help(ctx, n);
+        js_std_dump_error(ctx);
         return NULL;
     }
+    n->name = js_strdup(ctx, module_name);
+    use_intrinsics(ljs, n->uses);
+
+    for (tail = ljs; tail->next != NULL; tail = tail->next)
+        ;
+    tail->next = n;
 
     /* the module is already referenced, so we must free it */
     m = JS_VALUE_GET_PTR(func_val);
-    JS_FreeValue(ctx, func_val);
+    JS_FreeValue(cctx, func_val);
 
+    // compiled for the other context; the importer's reads the bytecode
+    if (cctx != ctx)
+        m = chain_module_loader(ctx, ljs, module_name);
     return m;
 }
 
 static int compile_file(JSContext *ctx, lanyt_js *ljs, const char *filename) {
-    uint8_t *buf;
     int eval_flags;
+    JSContext *cctx;
     JSValue obj;
-    size_t buf_len;
-
-    char *pc = "<lanyt>";
-    char pc_buf[8] = {0};
-    snprintf(pc_buf, 8, "%s", filename);
-
-    if (strcmp(pc_buf, pc))
-        buf = js_load_file(ctx, &buf_len, filename);
-    else {
-        buf_len = strlen(filename) - 7;
-        buf = (uint8_t *)filename + 7;
-    }
-    if (!buf) {
+    source src;
+    int inline_src = !strncmp(filename, "<lanyt>", 7);
+
+    if (inline_src) {
+        src.buf = (uint8_t *)filename + 7;
+        src.len = strlen(filename) - 7;
+        src.mapped = 0;
+    } else if (open_source(ctx, filename, &src)) {
         JS_ThrowTypeError(ctx, "Could not load '%s'", filename);
     dump:
         js_std_dump_error(ctx);
         return -1;
+    } else {
+        // so that importing the entry under another name finds it
+        mi_free(ljs_resolve(ljs->resolver, filename));
     }
     eval_flags = JS_EVAL_FLAG_COMPILE_ONLY;
-    int module = JS_DetectModule((const char *)buf, buf_len);
+    int module = JS_DetectModule((const char *)src.buf, src.len);
 
     if (module)
         eval_flags |= JS_EVAL_TYPE_MODULE;
     else
         eval_flags |= JS_EVAL_TYPE_GLOBAL;
 
-    obj = JS_Eval(ctx, (const char *)buf, buf_len, filename, eval_flags);
-    if (strcmp(pc_buf, pc)) {
-        ljs->filename =
-            js_malloc(ctx, strlen(filename) + 1 + 2 + strlen((char *)buf));
+    cctx = compile_context(ljs);
+    obj = !cctx ? JS_ThrowOutOfMemory(ctx)
+                : compile_source(cctx, inline_src ? NULL : ljs->cache_dir, ljs,
+                                 src.buf, src.len, filename, eval_flags);
+    if (ljs->keep_source && !JS_IsException(obj)) {
+        if (inline_src)
+            ljs->filename = js_strdup(ctx, (const char *)src.buf);
+        else if ((ljs->filename =
+                      js_malloc(ctx, source_text(NULL, filename, &src))))
+            source_text(ljs->filename, filename, &src);
         if (!ljs->filename) {
-            JS_FreeValue(ctx, obj);
-            goto dump;
+            JS_FreeValue(cctx, obj);
+            obj = JS_EXCEPTION;
         }
-        sprintf(ljs->filename, "<%s>", filename);
-        strcat(ljs->filename, (char *)buf);
-        js_free(ctx, buf);
-    } else {
-        ljs->filename = js_strdup(ctx, (char *)buf);
-    }
-    if (!ljs->filename) {
-        JS_FreeValue(ctx, obj);
-        goto dump;
     }
-    if (JS_IsException(obj)) {
-        JS_FreeValue(ctx, obj);
+    if (!inline_src)
+        close_source(ctx, &src);
+    if (JS_IsException(obj))
         goto dump;
-    }
-    to_bytecode(ctx, obj, ljs);
-    JS_FreeValue(ctx, obj);
+    JS_FreeValue(cctx, obj);
     return 0;
 }
 
@@ -267,54 +1095,263 @@ static lanyt_js *lanyt_new_js_noctx(JSRuntime *rt) {
 
     r->ctx = NULL;
     r->byte_swap = 0;
+    r->borrowed = 0;
+    r->lazy = 0;
+    r->compressed = 0;
+    r->atoms = 0;
+    r->kept = 0;
+    r->mi_owned = 0;
+    r->raw_len = 0;
     r->bytecode_len = 0;
     r->bytecode = NULL;
+    r->name = NULL;
     r->filename = NULL;
+    r->debug = NULL;
+    r->debug_size = 0;
+    r->rt = rt;
     r->next = NULL;
+    r->image_kind = LANYT_IMAGE_NONE;
+    r->image = NULL;
+    r->image_len = 0;
+    r->bundle.image = NULL;
+    r->cache_dir = NULL;
+    r->intrinsics = 0;
+    r->installed = 0;
+    r->compile_ctx = NULL;
+    r->uses = 0;
+    r->keep_source = 0;
+    r->resolver = NULL;
+    r->incr = NULL;
 
     return r;
 }
 
 lanyt_js *lanyt_new_js(JSRuntime *rt) {
+    return lanyt_new_js2(rt, LANYT_INTRINSIC_ALL);
+}
+
+lanyt_js *lanyt_new_js2(JSRuntime *rt, int intrinsics) {
     lanyt_js *r = mi_malloc(sizeof(lanyt_js));
 
     if (!r)
         return NULL;
 
-    r->ctx = JS_NewCustomContext(rt);
-    if (!r->ctx) {
+    r->ctx = new_context(rt, intrinsics);
+    r->resolver = ljs_resolver_new();
+    if (!r->ctx || !r->resolver) {
+        if (r->ctx)
+            JS_FreeContext(r->ctx);
+        ljs_resolver_free(r->resolver);
         mi_free(r);
         return NULL;
     }
     r->byte_swap = 0;
+    r->borrowed = 0;
+    r->lazy = 0;
+    r->compressed = 0;
+    r->atoms = 0;
+    r->kept = 0;
+    r->mi_owned = 0;
+    r->raw_len = 0;
     r->bytecode_len = 0;
     r->bytecode = NULL;
+    r->name = NULL;
     r->filename = NULL;
+    r->debug = NULL;
+    r->debug_size = 0;
+    r->rt = rt;
     r->next = NULL;
-    JS_SetModuleLoaderFunc(rt, NULL, jsc_module_loader, r);
+    r->image_kind = LANYT_IMAGE_NONE;
+    r->image = NULL;
+    r->image_len = 0;
+    r->bundle.image = NULL;
+    r->cache_dir = NULL;
+    r->intrinsics = intrinsics;
+    r->installed = intrinsics & LANYT_INTRINSIC_ALL;
+    r->compile_ctx = NULL;
+    r->uses = 0;
+    r->keep_source = 0;
+    r->incr = NULL;
+    JS_SetModuleLoaderFunc(rt, jsc_module_normalize, jsc_module_loader, r);
 
     return r;
 }
 
 JSContext *lanyt_js_get_ctx(lanyt_js *ljs) { return ljs->ctx; }
-lanyt_js *lanyt_js_get_next(lanyt_js *ljs) { return ljs->next; }
-char *lanyt_js_get_filename(lanyt_js *ljs) { return ljs->filename; }
 
-static void free_help(JSContext *ctx, lanyt_js *ljs) {
-    if (ljs == NULL)
-        return;
-    js_free(ctx, ljs->bytecode);
-    js_free(ctx, ljs->filename);
-    free_help(ctx, ljs->next);
-    mi_free(ljs);
+int lanyt_js_set_cache_dir(lanyt_js *ljs, const char *dir) {
+    char *d = NULL;
+    if (dir) {
+        d = js_strdup(ljs->ctx, dir);
+        if (!d)
+            return -1;
+    }
+    js_free(ljs->ctx, ljs->cache_dir);
+    ljs->cache_dir = d;
+    return 0;
 }
-
-void lanyt_free_js(lanyt_js *ljs) {
-    JSContext *ctx;
+void lanyt_js_set_keep_source(lanyt_js *ljs, int keep) {
+    ljs->keep_source = keep;
+}
+lanyt_js *lanyt_js_get_next(lanyt_js *ljs) { return ljs->next; }
+/* A debug blob is the raw size as a little-endian u64, then the text,
+ * ljs_lz compressed unless that did not make it smaller. */
+static char *load_debug(lanyt_js *n) {
+    const uint8_t *p = n->debug;
+    uint64_t raw = 0;
+    char *s;
+
+    if (n->debug_size < 8)
+        return NULL;
+    for (int i = 7; i >= 0; i--)
+        raw = (raw << 8) | p[i];
+    if (raw > SIZE_MAX - 1)
+        return NULL;
+    s = js_malloc_rt(n->rt, raw + 1);
+    if (!s)
+        return NULL;
+    if (n->debug_size - 8 == raw)
+        memcpy(s, p + 8, raw);
+    else if (ljs_lz_decompress(p + 8, n->debug_size - 8, (uint8_t *)s, raw)) {
+        js_free_rt(n->rt, s);
+        return NULL;
+    }
+    s[raw] = '\0';
+    n->filename = s;
+    n->debug = NULL;
+    return s;
+}
+
+char *lanyt_js_get_filename(lanyt_js *ljs) {
+    if (!ljs->filename && ljs->debug)
+        load_debug(ljs);
+    return ljs->filename;
+}
+
+static void free_help(JSContext *ctx, lanyt_js *ljs) {
+    if (ljs == NULL)
+        return;
+    if (ljs->mi_owned)
+        mi_free(ljs->bytecode);
+    else if (!ljs->borrowed)
+        js_free(ctx, ljs->bytecode);
+    js_free(ctx, ljs->name);
+    js_free(ctx, ljs->filename);
+    free_help(ctx, ljs->next);
+    mi_free(ljs);
+}
+
+static uint8_t *map_file(const char *filename, size_t *plen) {
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+    uint8_t *p = NULL;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+    p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!p)
+        return NULL;
+    *plen = (size_t)size.QuadPart;
+    return p;
+#else
+    struct stat st;
+    void *p;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    *plen = st.st_size;
+    return p;
+#endif
+}
+
+static void unmap_file(uint8_t *p, size_t len) {
+#if defined(_WIN32) || defined(_WIN64)
+    UnmapViewOfFile(p);
+#else
+    munmap(p, len);
+#endif
+}
+
+static void release_image(JSContext *ctx, lanyt_js *ljs) {
+    switch (ljs->image_kind) {
+    case LANYT_IMAGE_HEAP:
+        js_free(ctx, ljs->image);
+        break;
+    case LANYT_IMAGE_MAP:
+        unmap_file(ljs->image, ljs->image_len);
+        break;
+    default:
+        break;
+    }
+    ljs->image_kind = LANYT_IMAGE_NONE;
+    ljs->image = NULL;
+    ljs->image_len = 0;
+    ljs->bundle.image = NULL;
+    ljs->debug = NULL;
+    ljs->debug_size = 0;
+}
+
+// image is left to the caller, it is in the runtime's memory
+static void free_incremental(incremental *in) {
+    if (!in)
+        return;
+    ljs_deps_free(in->from);
+    ljs_deps_free(in->to);
+    mi_free(in);
+}
+
+void lanyt_free_js(lanyt_js *ljs) {
+    JSContext *ctx;
+    rt_info *info;
     if (ljs == NULL)
         return;
     ctx = ljs->ctx;
+    info = rt_info_find(JS_GetRuntime(ctx));
+    if (info && (info->flags & LANYT_RT_FAST_FREE)) {
+        // only the chain nodes and a file mapping live outside the heap
+        if (ljs->image_kind == LANYT_IMAGE_MAP)
+            release_image(ctx, ljs);
+        ljs_resolver_free(ljs->resolver);
+        free_incremental(ljs->incr);
+        while (ljs) {
+            lanyt_js *next = ljs->next;
+            if (ljs->mi_owned)
+                mi_free(ljs->bytecode);
+            mi_free(ljs);
+            ljs = next;
+        }
+        return;
+    }
+    release_image(ctx, ljs);
+    js_free(ctx, ljs->cache_dir);
+    ljs_resolver_free(ljs->resolver);
+    if (ljs->incr)
+        js_free(ctx, ljs->incr->image);
+    free_incremental(ljs->incr);
     free_help(ctx, ljs);
+    if (ljs->compile_ctx)
+        JS_FreeContext(ljs->compile_ctx);
     JS_FreeContext(ctx);
 }
 
@@ -326,10 +1363,492 @@ int lanyt_js_eval(lanyt_js *ljs, const char *filename) {
     return compile_file(ljs->ctx, ljs, filename);
 }
 
-static int run(JSContext *ctx, const uint8_t *buf, size_t buf_len,
-               int load_only, int silent) {
+/* Parallel compilation of the module graph.
+ *
+ * Workers pull modules off a shared queue and compile each one in a fresh
+ * context on their own runtime. While a module compiles, its imports are
+ * answered with empty stub modules: resolution only needs the module to
+ * exist, and its bytecode does not depend on what the imports contain.
+ * Every import name is recorded and queued in turn, so discovery and
+ * compilation overlap. Once the queue drains, the modules are chained in
+ * the same post-order jsc_module_loader would have produced. */
+
+typedef struct {
+    char **names;
+    int len;
+    int cap;
+} name_list;
+
+typedef struct {
+    char *name;
+    int is_entry;
+    int visited;
+    uint8_t *bytecode; // mi_malloc'd, moved into the chain on merge
+    size_t bytecode_len;
+    char *filename; // entry only, with keep_source
+    int uses;
+    name_list deps;
+    // for an incremental compile
+    uint64_t hash;                // of the source
+    name_list imports;            // lexical names of deps
+    const ljs_deps_module *kept; // unchanged since the base bundle
+} pjob;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pjob *jobs;
+    int len;
+    int cap;
+    int next; // jobs[next..len) are queued
+    int in_flight;
+    int failed;
+    const char *cache_dir;
+    int keep_source;
+    ljs_resolver *resolver; // the head's, shared by every worker
+    int track;              // fill the jobs' hash and imports
+    const ljs_deps *base;   // modules that need no compile if unchanged
+} pcompile;
+
+static int name_list_add(name_list *l, const char *name) {
+    if (l->len >= l->cap) {
+        int newcap = l->cap + (l->cap >> 1) + 4;
+        char **a = mi_realloc(l->names, sizeof(l->names[0]) * newcap);
+        if (!a)
+            return -1;
+        l->names = a;
+        l->cap = newcap;
+    }
+    l->names[l->len] = mi_strdup(name);
+    if (!l->names[l->len])
+        return -1;
+    ++l->len;
+    return 0;
+}
+
+static void name_list_free(name_list *l) {
+    while (l->len > 0)
+        mi_free(l->names[--l->len]);
+    mi_free(l->names);
+    l->names = NULL;
+    l->cap = 0;
+}
+
+static int stub_module_init(JSContext *ctx, JSModuleDef *m) { return 0; }
+
+// what a worker's module hooks see of its job
+typedef struct {
+    name_list *deps;
+    ljs_resolver *resolver;
+    name_list *imports; // NULL unless tracked
+} discover;
+
+static char *discover_normalize(JSContext *ctx, const char *base,
+                                const char *spec, void *opaque) {
+    discover *d = opaque;
+    char *lexical;
+
+    if (d->imports && !lanyt_js_is_native_module(spec)) {
+        lexical = ljs_resolve_name(base, spec);
+        if (!lexical || name_list_add(d->imports, lexical)) {
+            mi_free(lexical);
+            JS_ThrowOutOfMemory(ctx);
+            return NULL;
+        }
+        mi_free(lexical);
+    }
+    return normalize_name(ctx, d->resolver, NULL, base, spec);
+}
+
+static JSModuleDef *discover_loader(JSContext *ctx, const char *module_name,
+                                    void *opaque) {
+    discover *d = opaque;
+    if (!lanyt_js_is_native_module(module_name) &&
+        name_list_add(d->deps, module_name)) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    return JS_NewCModule(ctx, module_name, stub_module_init);
+}
+
+static int pcompile_find(pcompile *pc, const char *name) {
+    for (int i = 0; i < pc->len; i++) {
+        if (!strcmp(pc->jobs[i].name, name))
+            return i;
+    }
+    return -1;
+}
+
+// called with pc->lock held
+static int pcompile_add(pcompile *pc, const char *name, int is_entry) {
+    pjob *j;
+    if (pcompile_find(pc, name) >= 0)
+        return 0;
+    if (pc->len >= pc->cap) {
+        int newcap = pc->cap + (pc->cap >> 1) + 4;
+        pjob *a = mi_realloc(pc->jobs, sizeof(pc->jobs[0]) * newcap);
+        if (!a)
+            return -1;
+        pc->jobs = a;
+        pc->cap = newcap;
+    }
+    j = &pc->jobs[pc->len];
+    memset(j, 0, sizeof(*j));
+    j->name = mi_strdup(name);
+    if (!j->name)
+        return -1;
+    j->is_entry = is_entry;
+    ++pc->len;
+    return 0;
+}
+
+/* A module that hashes the same as when the base bundle was written keeps
+ * its record. Its imports are resolved again from the names it asked for,
+ * which is all that compiling it would have found out. */
+static int pcompile_keep(pcompile *pc, const char *name, int is_entry,
+                         pjob *out) {
+    const ljs_deps_module *k = ljs_deps_find(pc->base, name);
+    char *dep;
+
+    if (!k || k->hash != out->hash || (k == pc->base->mods) != is_entry)
+        return 0;
+    for (int i = 0; i < k->imports_len; i++) {
+        dep = ljs_resolve(pc->resolver, k->imports[i]);
+        if (!dep || name_list_add(&out->deps, dep) ||
+            name_list_add(&out->imports, k->imports[i])) {
+            mi_free(dep);
+            return -1;
+        }
+        mi_free(dep);
+    }
+    out->uses = k->intrinsics;
+    out->kept = k;
+    return 1;
+}
+
+static int pcompile_one(pcompile *pc, JSRuntime *rt, const char *name,
+                        int is_entry, pjob *out) {
+    JSContext *ctx;
+    lanyt_js *n;
+    source src;
+    discover d = {&out->deps, pc->resolver,
+                  pc->track ? &out->imports : NULL};
+    int eval_flags = JS_EVAL_FLAG_COMPILE_ONLY | JS_EVAL_TYPE_MODULE;
+    JSValue obj;
+    int kept, ret = -1;
+
+    ctx = JS_NewCustomContext(rt);
+    n = lanyt_new_js_noctx(rt);
+    if (!ctx || !n) {
+        fprintf(stderr, "create js context failed\n");
+        goto done;
+    }
+    JS_SetModuleLoaderFunc(rt, discover_normalize, discover_loader, &d);
+
+    if (is_entry ? open_source(ctx, name, &src)
+                 : open_module_source(ctx, name, &src)) {
+        JS_ThrowInternalError(ctx, "could not load module filename '%s'",
+                              name);
+        js_std_dump_error(ctx);
+        goto done;
+    }
+    if (is_entry && !JS_DetectModule((const char *)src.buf, src.len))
+        eval_flags = JS_EVAL_FLAG_COMPILE_ONLY | JS_EVAL_TYPE_GLOBAL;
+
+    if (pc->track)
+        out->hash = ljs_hash64(src.buf, src.len, 0);
+    kept = pc->base ? pcompile_keep(pc, name, is_entry, out) : 0;
+    if (kept < 0)
+        obj = JS_ThrowOutOfMemory(ctx);
+    else if (kept)
+        obj = JS_UNDEFINED;
+    else
+        obj = compile_source(ctx, pc->cache_dir, n, src.buf, src.len, name,
+                             eval_flags);
+    if (is_entry && pc->keep_source && !JS_IsException(obj)) {
+        out->filename = mi_malloc(source_text(NULL, name, &src));
+        if (out->filename)
+            source_text(out->filename, name, &src);
+    }
+    close_source(ctx, &src);
+    if (JS_IsException(obj)) {
+        js_std_dump_error(ctx);
+        goto done;
+    }
+    JS_FreeValue(ctx, obj);
+    if (is_entry && pc->keep_source && !out->filename)
+        goto done;
+    if (kept) {
+        ret = 0;
+        goto done;
+    }
+
+    // out of this runtime's heap, which goes away with the worker
+    out->bytecode = mi_malloc(n->bytecode_len);
+    if (!out->bytecode)
+        goto done;
+    memcpy(out->bytecode, n->bytecode, n->bytecode_len);
+    out->bytecode_len = n->bytecode_len;
+    out->uses = n->uses;
+    ret = 0;
+done:
+    if (ctx) {
+        free_help(ctx, n);
+        JS_FreeContext(ctx);
+    } else {
+        mi_free(n);
+    }
+    return ret;
+}
+
+static void *pcompile_worker(void *opaque) {
+    pcompile *pc = opaque;
+    JSRuntime *rt = lanyt_jsc_new_rt();
+
+    pthread_mutex_lock(&pc->lock);
+    if (!rt)
+        pc->failed = 1;
+    for (;;) {
+        pjob out;
+        char *name;
+        int idx, is_entry, r;
+
+        while (!pc->failed && pc->next == pc->len && pc->in_flight > 0)
+            pthread_cond_wait(&pc->cond, &pc->lock);
+        if (pc->failed || pc->next == pc->len)
+            break;
+        idx = pc->next++;
+        name = pc->jobs[idx].name;
+        is_entry = pc->jobs[idx].is_entry;
+        ++pc->in_flight;
+        pthread_mutex_unlock(&pc->lock);
+
+        memset(&out, 0, sizeof(out));
+        r = pcompile_one(pc, rt, name, is_entry, &out);
+
+        pthread_mutex_lock(&pc->lock);
+        --pc->in_flight;
+        for (int i = 0; r == 0 && i < out.deps.len; i++)
+            r = pcompile_add(pc, out.deps.names[i], 0);
+        if (r) {
+            pc->failed = 1;
+            mi_free(out.bytecode);
+            mi_free(out.filename);
+            name_list_free(&out.deps);
+            name_list_free(&out.imports);
+        } else {
+            pjob *j = &pc->jobs[idx];
+            j->bytecode = out.bytecode;
+            j->bytecode_len = out.bytecode_len;
+            j->filename = out.filename;
+            j->uses = out.uses;
+            j->deps = out.deps;
+            j->hash = out.hash;
+            j->imports = out.imports;
+            j->kept = out.kept;
+        }
+        pthread_cond_broadcast(&pc->cond);
+    }
+    pthread_cond_broadcast(&pc->cond);
+    pthread_mutex_unlock(&pc->lock);
+
+    if (rt)
+        lanyt_jsc_free_rt(rt);
+    return NULL;
+}
+
+static int pcompile_merge(pcompile *pc, int idx, lanyt_js *ljs,
+                          lanyt_js **tail) {
+    pjob *j = &pc->jobs[idx];
+    JSContext *ctx = ljs->ctx;
+    lanyt_js *n;
+
+    if (j->visited)
+        return 0;
+    j->visited = 1;
+    for (int i = 0; i < j->deps.len; i++) {
+        if (pcompile_merge(pc, pcompile_find(pc, j->deps.names[i]), ljs,
+                           tail))
+            return -1;
+    }
+
+    if (j->is_entry) {
+        n = ljs;
+        if (j->filename && !(n->filename = js_strdup(ctx, j->filename)))
+            return -1;
+    } else {
+        n = lanyt_new_js_noctx(JS_GetRuntime(ctx));
+        if (!n)
+            return -1;
+        (*tail)->next = n;
+        *tail = n;
+        n->name = js_strdup(ctx, j->name);
+        if (!n->name)
+            return -1;
+    }
+    n->uses = j->uses;
+    if (j->kept) {
+        n->borrowed = 1;
+        n->kept = 1;
+        n->bytecode = ljs->incr->image + j->kept->offset;
+        n->bytecode_len = j->kept->size;
+        n->raw_len = j->kept->raw_size;
+        n->compressed = !!(j->kept->flags & LJS_MODULE_LZ);
+        n->atoms = !!(j->kept->flags & LJS_MODULE_ATOMS);
+        return 0;
+    }
+    n->mi_owned = 1;
+    n->bytecode = j->bytecode;
+    n->bytecode_len = j->bytecode_len;
+    j->bytecode = NULL;
+    return 0;
+}
+
+// what the dependency file needs to know of each job, entry first
+static int pcompile_record(pcompile *pc, ljs_deps *to) {
+    for (int i = 0; i < pc->len; i++) {
+        pjob *j = &pc->jobs[i];
+        ljs_deps_module *m = ljs_deps_add(to, j->name);
+        if (!m)
+            return -1;
+        m->hash = j->hash;
+        m->intrinsics = j->uses;
+        for (int k = 0; k < j->imports.len; k++) {
+            if (ljs_deps_add_import(m, j->imports.names[k]))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+int lanyt_js_eval_parallel(lanyt_js *ljs, const char *filename, int workers) {
+    pthread_t *threads;
+    pcompile pc;
+    lanyt_js *tail;
+    int started = 0, ret = -1;
+
+    if (!ljs) {
+        printf("ljs is null\n");
+        return -1;
+    }
+    // only the job queue can keep modules for an incremental compile
+    if ((workers <= 1 && !ljs->incr) || !strncmp(filename, "<lanyt>", 7))
+        return compile_file(ljs->ctx, ljs, filename);
+    if (workers < 1)
+        workers = 1;
+
+    memset(&pc, 0, sizeof(pc));
+    pthread_mutex_init(&pc.lock, NULL);
+    pthread_cond_init(&pc.cond, NULL);
+    pc.cache_dir = ljs->cache_dir;
+    pc.keep_source = ljs->keep_source;
+    pc.resolver = ljs->resolver;
+    pc.track = ljs->incr != NULL;
+    pc.base = ljs->incr ? ljs->incr->from : NULL;
+    mi_free(ljs_resolve(pc.resolver, filename));
+    threads = mi_malloc(sizeof(*threads) * workers);
+    if (!threads || pcompile_add(&pc, filename, 1))
+        goto done;
+
+    for (; started < workers; started++) {
+        if (pthread_create(&threads[started], NULL, pcompile_worker, &pc))
+            break;
+    }
+    if (started == 0)
+        goto done;
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    if (pc.failed)
+        goto done;
+
+    tail = ljs;
+    while (tail->next != NULL)
+        tail = tail->next;
+    ret = pcompile_merge(&pc, 0, ljs, &tail);
+    if (!ret && ljs->incr)
+        ret = pcompile_record(&pc, ljs->incr->to);
+    if (ret) {
+        JS_ThrowOutOfMemory(ljs->ctx);
+        js_std_dump_error(ljs->ctx);
+    }
+done:
+    for (int i = 0; i < pc.len; i++) {
+        mi_free(pc.jobs[i].name);
+        mi_free(pc.jobs[i].bytecode);
+        mi_free(pc.jobs[i].filename);
+        name_list_free(&pc.jobs[i].deps);
+        name_list_free(&pc.jobs[i].imports);
+    }
+    mi_free(pc.jobs);
+    mi_free(threads);
+    pthread_cond_destroy(&pc.cond);
+    pthread_mutex_destroy(&pc.lock);
+    return ret;
+}
+
+/* The source text of the module a backtrace names, from whichever chain
+ * node carries it. The entry's file name is only known from its debug
+ * text, so it is the last one tried. */
+static const char *find_source(lanyt_js *head, const char *file, size_t len) {
+    for (lanyt_js *n = head->next; n; n = n->next) {
+        if (n->name && strlen(n->name) == len && !strncmp(n->name, file, len))
+            return lanyt_js_get_filename(n);
+    }
+    return lanyt_js_get_filename(head);
+}
+
+/* After the usual dump, print the line the innermost frame with a known
+ * position points at, when debug text was kept for its module. */
+static void dump_error(lanyt_js *head) {
+    JSContext *ctx = head->ctx;
+    JSValue exc = JS_GetException(ctx), stack = JS_UNDEFINED;
+    const char *s = NULL, *p, *file, *end, *src;
+    int line, i;
+
+    JS_Throw(ctx, JS_DupValue(ctx, exc));
+    js_std_dump_error(ctx);
+    if (JS_IsError(ctx, exc))
+        stack = JS_GetPropertyStr(ctx, exc, "stack");
+    if (JS_IsString(stack))
+        s = JS_ToCString(ctx, stack);
+    // frames look like "    at f (file:line)"
+    for (p = s; p && (p = strchr(p, '(')); p++) {
+        file = p + 1;
+        end = strchr(file, ')');
+        if (!end)
+            break;
+        for (p = end; p > file && p[-1] >= '0' && p[-1] <= '9'; p--)
+            ;
+        if (p == end || p == file || p[-1] != ':')
+            continue;
+        line = atoi(p);
+        src = find_source(head, file, p - 1 - file);
+        // debug text is "<name>" followed by the source
+        if (!src || *src != '<' || strncmp(src + 1, file, p - 1 - file) ||
+            src[p - file] != '>')
+            break;
+        src += p - file + 1;
+        for (i = 1; i < line && (src = strchr(src, '\n')); i++)
+            src++;
+        if (src)
+            fprintf(stderr, "%5d | %.*s\n", line,
+                    (int)strcspn(src, "\r\n"), src);
+        break;
+    }
+    JS_FreeCString(ctx, s);
+    JS_FreeValue(ctx, stack);
+    JS_FreeValue(ctx, exc);
+}
+
+static int run(lanyt_js *head, lanyt_js *n, int load_only, int silent) {
+    JSContext *ctx = head->ctx;
     JSValue obj, val;
-    obj = JS_ReadObject(ctx, buf, buf_len, JS_READ_OBJ_BYTECODE);
+    const char *name = n->name ? n->name : "<entry>";
+    int mem = mem_enter(ctx, name, MEM_LOAD), span, r;
+
+    obj = read_bytecode(ctx, &head->bundle, n->bytecode, n->bytecode_len,
+                        n->raw_len, record_flags(n), name);
+    mem_leave(ctx, mem);
     if (JS_IsException(obj))
         goto exception;
     if (load_only) {
@@ -338,17 +1857,25 @@ static int run(JSContext *ctx, const uint8_t *buf, size_t buf_len,
         }
     } else {
         if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
-            if (JS_ResolveModule(ctx, obj) < 0) {
+            // imports not carried by the chain are loaded from here
+            span = ljs_trace_begin("link", name);
+            r = JS_ResolveModule(ctx, obj);
+            ljs_trace_end(span);
+            if (r < 0) {
                 JS_FreeValue(ctx, obj);
                 goto exception;
             }
             js_module_set_import_meta(ctx, obj, FALSE, TRUE);
         }
+        mem = mem_enter(ctx, name, MEM_EVAL);
+        span = ljs_trace_begin("evaluate", name);
         val = JS_EvalFunction(ctx, obj);
+        ljs_trace_end(span);
+        mem_leave(ctx, mem);
         if (JS_IsException(val)) {
         exception:
             if (!silent)
-                js_std_dump_error(ctx);
+                dump_error(head);
             return -1;
         }
         JS_FreeValue(ctx, val);
@@ -357,107 +1884,599 @@ static int run(JSContext *ctx, const uint8_t *buf, size_t buf_len,
     return 0;
 }
 
-int lanyt_js_run(lanyt_js *ljs, int silent) {
-    if (!ljs) {
-        printf("ljs is null\n");
-        return -1;
-    }
+static int run_chain(lanyt_js *ljs, int silent, int stop_fd) {
     lanyt_js *n = ljs->next;
     while (n != NULL) {
+        if (n->lazy) {
+            n = n->next;
+            continue;
+        }
         if (n->bytecode == NULL)
             return -2;
-        if (run(ljs->ctx, n->bytecode, n->bytecode_len, 1, silent))
+        if (run(ljs, n, 1, silent))
             return -3;
         n = n->next;
     }
     if (ljs->bytecode == NULL)
         return -2;
-    if (run(ljs->ctx, ljs->bytecode, ljs->bytecode_len, 0, silent))
+    if (run(ljs, ljs, 0, silent))
         return -4;
 
-    js_std_loop(ljs->ctx);
+    int mem = mem_enter(ljs->ctx, "<entry>", MEM_EVAL);
+    int span = ljs_trace_begin("event_loop", NULL);
+    int stopped = ljs_loop_run(ljs->ctx, stop_fd);
+    ljs_trace_end(span);
+    mem_leave(ljs->ctx, mem);
 
-    return 0;
+    return stopped;
 }
 
-int lanyt_js_save(lanyt_js *ljs, const char *filename, int debug) {
+int lanyt_js_run(lanyt_js *ljs, int silent) {
+    return lanyt_js_run2(ljs, silent, -1);
+}
+
+int lanyt_js_run2(lanyt_js *ljs, int silent, int stop_fd) {
+    rt_info *info;
+    JSContext *prev = NULL;
+    JSValue prev_error = JS_UNDEFINED;
+    int r;
+
     if (!ljs) {
         printf("ljs is null\n");
         return -1;
     }
+    for (lanyt_js *n = ljs; n; n = n->next)
+        use_intrinsics(ljs, n->uses);
+    // the interrupt handler only has the runtime; samples need the context
+    info = rt_info_find(JS_GetRuntime(ljs->ctx));
+    if (info) {
+        prev = info->ctx;
+        prev_error = info->error;
+        info->ctx = ljs->ctx;
+        // a script may replace globalThis.Error, samples must not call it
+        info->error = JS_UNDEFINED;
+        if (info->prof) {
+            JSValue global = JS_GetGlobalObject(ljs->ctx);
+            info->error = JS_GetPropertyStr(ljs->ctx, global, "Error");
+            JS_FreeValue(ljs->ctx, global);
+        }
+    }
+    r = run_chain(ljs, silent, stop_fd);
+    if (info) {
+        JS_FreeValue(ljs->ctx, info->error);
+        info->ctx = prev;
+        info->error = prev_error;
+    }
+    return r;
+}
 
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        JS_ThrowInternalError(ljs->ctx, "could not open '%s'", filename);
-        js_std_dump_error(ljs->ctx);
+int lanyt_js_adopt(lanyt_js *ljs, lanyt_js *old, const char *entry,
+                   int (*changed)(void *opaque, const char *name),
+                   void *opaque) {
+    lanyt_js **link = &old->next, *tail = ljs, *n;
+
+    while (tail->next)
+        tail = tail->next;
+    // a node owns its bytecode, so nodes move as they are
+    while ((n = *link)) {
+        if (n->lazy || n->borrowed || !n->name || changed(opaque, n->name)) {
+            link = &n->next;
+            continue;
+        }
+        *link = n->next;
+        n->next = NULL;
+        tail->next = n;
+        tail = n;
+    }
+    if (!old->bytecode || old->borrowed || changed(opaque, entry))
+        return 0;
+    ljs->bytecode = old->bytecode;
+    ljs->bytecode_len = old->bytecode_len;
+    ljs->mi_owned = old->mi_owned;
+    ljs->uses = old->uses;
+    ljs->filename = old->filename;
+    old->bytecode = NULL;
+    old->mi_owned = 0;
+    old->bytecode_len = 0;
+    old->filename = NULL;
+    return 1;
+}
+
+int lanyt_js_files(lanyt_js *ljs, int (*fn)(void *opaque, const char *name),
+                   void *opaque) {
+    return ljs_resolver_files(ljs->resolver, fn, opaque);
+}
+
+int lanyt_js_save(lanyt_js *ljs, const char *filename, int debug) {
+    return lanyt_js_save2(ljs, filename, debug ? LANYT_SAVE_DEBUG : 0);
+}
+
+/* Compress one module record for saving. Modules that do not shrink are
+ * stored as they are. */
+static int pack_module(JSContext *ctx, ljs_bundle_module *m, uint8_t **owned) {
+    size_t cap = ljs_lz_bound(m->size), len;
+    uint8_t *buf = js_malloc(ctx, cap);
+
+    if (!buf)
+        return -1;
+    len = ljs_lz_compress(m->data, m->size, buf, cap);
+    if (len == 0 || len >= m->size) {
+        js_free(ctx, buf);
+        return 0;
+    }
+    m->flags |= LJS_MODULE_LZ;
+    m->data = buf;
+    m->size = len;
+    js_free(ctx, *owned);
+    *owned = buf;
+    return 0;
+}
+
+/* Debug text in the form load_debug reads. */
+static uint8_t *pack_debug(JSContext *ctx, const char *text, size_t *plen) {
+    size_t raw = strlen(text), cap = ljs_lz_bound(raw), len;
+    uint8_t *buf = js_malloc(ctx, 8 + (cap > raw ? cap : raw));
+
+    if (!buf)
+        return NULL;
+    for (int i = 0; i < 8; i++)
+        buf[i] = (uint64_t)raw >> (i * 8);
+    len = ljs_lz_compress((const uint8_t *)text, raw, buf + 8, cap);
+    if (len == 0 || len >= raw) {
+        memcpy(buf + 8, text, raw);
+        len = raw;
+    }
+    *plen = 8 + len;
+    return buf;
+}
+
+/* A module's record as saved, with LANYT_SAVE_ATOMS its atoms moved into
+ * dict. Records read from a bundle are rebuilt, their atoms get indexes in
+ * the new dictionary. */
+static int encode_module(JSContext *ctx, lanyt_js *head, lanyt_js *n,
+                         ljs_bundle_dict *dict, int flags,
+                         ljs_bundle_module *m, uint8_t **owned) {
+    const ljs_bundle *from = n->kept ? &head->incr->bundle : &head->bundle;
+    const uint8_t *plain;
+    uint8_t *tmp;
+    size_t len;
+    int r;
+
+    plain = plain_bytecode(ctx, from, n->bytecode, n->bytecode_len,
+                           n->raw_len, record_flags(n), &len, &tmp);
+    if (!plain)
+        return -1;
+    if (flags & LANYT_SAVE_ATOMS) {
+        r = ljs_bundle_dict_add(dict, plain, len, &m->data, &m->size);
+        js_free(ctx, tmp);
+        if (r < 0) {
+            JS_ThrowOutOfMemory(ctx);
+            return -1;
+        }
+        if (r == 0)
+            m->flags |= LJS_MODULE_ATOMS;
+    } else {
+        m->data = plain;
+        m->size = len;
+        *owned = tmp;
+    }
+    m->raw_size = m->size;
+    if (flags & LANYT_SAVE_COMPRESS)
+        return pack_module(ctx, m, owned);
+    return 0;
+}
+
+typedef struct {
+    const ljs_bundle *from; // bundle the chain was read from, if any
+    ljs_bundle_module *mods; // NULL to only count
+    uint32_t count;
+} alias_list;
+
+static int add_alias(void *opaque, const char *name, const char *target) {
+    alias_list *a = opaque;
+
+    // an alias carried over from the bundle already covers the name
+    if (a->from && ljs_bundle_find(a->from, name) >= 0)
+        return 0;
+    if (a->mods) {
+        ljs_bundle_module *m = &a->mods[a->count];
+        memset(m, 0, sizeof(*m));
+        m->name = name;
+        m->name_len = strlen(name);
+        m->flags = LJS_MODULE_ALIAS;
+        m->data = (const uint8_t *)target;
+        m->size = m->raw_size = strlen(target);
+    }
+    a->count++;
+    return 0;
+}
+
+/* Every other name an import resolved to a module by, so that running the
+ * bundle elsewhere maps it the same way without the files. */
+static void list_aliases(lanyt_js *ljs, alias_list *a) {
+    ljs_bundle_module bm;
+
+    a->count = 0;
+    a->from = NULL;
+    if (ljs->bundle.image) {
+        for (uint32_t i = 0; i < ljs->bundle.count; i++) {
+            ljs_bundle_get(&ljs->bundle, i, &bm);
+            if (!(bm.flags & LJS_MODULE_ALIAS))
+                continue;
+            if (a->mods) {
+                a->mods[a->count] = bm;
+                a->mods[a->count].debug = NULL;
+                a->mods[a->count].debug_size = 0;
+            }
+            a->count++;
+        }
+        a->from = &ljs->bundle;
+    }
+    ljs_resolver_aliases(ljs->resolver, add_alias, a);
+}
+
+int lanyt_js_save2(lanyt_js *ljs, const char *filename, int flags) {
+    alias_list aliases = {NULL, NULL, 0};
+    ljs_bundle_module *mods;
+    ljs_bundle_dict *dict;
+    uint8_t **owned = NULL;
+    JSContext *ctx;
+    lanyt_js *n;
+    uint32_t count = 0, kept = 0, i = 0, bundle_flags;
+    int debug = flags & LANYT_SAVE_DEBUG, verbatim;
+    FILE *fp;
+    long off = 0;
+    int ret = -1;
+    if (!ljs) {
+        printf("ljs is null\n");
         return -1;
     }
+    ctx = ljs->ctx;
 
-    if (fwrite(&debug, sizeof(debug), 1, fp) != 1)
+    for (n = ljs; n != NULL; n = n->next) {
+        if (n->bytecode == NULL) {
+            JS_ThrowInternalError(ctx, "bytecode is null");
+            js_std_dump_error(ctx);
+            return -2;
+        }
+        ++count;
+        kept += n->kept;
+    }
+    list_aliases(ljs, &aliases);
+    mods = js_malloc(ctx, sizeof(*mods) * (count + aliases.count));
+    dict = ljs_bundle_dict_new();
+    // compressed bytecode first, then packed debug blobs
+    owned = js_mallocz(ctx, sizeof(*owned) * count * 2);
+    if (!mods || !dict || !owned) {
+        JS_ThrowOutOfMemory(ctx);
         goto fail;
-    while (ljs != NULL) {
-        if (ljs->bytecode == NULL) {
-            JS_ThrowInternalError(ljs->ctx, "bytecode is null");
+    }
+    /* Records kept by an incremental compile go out byte for byte, their
+     * atom indexes staying valid in a dictionary that starts as the base
+     * bundle's. Atoms only dropped code used stay with it, so once most
+     * of the graph changed it is cheaper to rebuild everything. */
+    verbatim = kept && kept * 2 >= count;
+    if (verbatim && (flags & LANYT_SAVE_ATOMS) &&
+        ljs_bundle_dict_seed(dict, &ljs->incr->bundle)) {
+        JS_ThrowInternalError(ctx, "corrupt bytecode atom table");
+        goto fail;
+    }
+    for (n = ljs; n != NULL; n = n->next, ++i) {
+        ljs_bundle_module *m = &mods[i];
+
+        m->name = n->name ? n->name : "";
+        m->name_len = strlen(m->name);
+        m->flags = (n != ljs && !n->name) ? LJS_MODULE_EAGER : 0;
+        m->intrinsics = n->uses;
+        if (n->kept && verbatim) {
+            m->flags |= record_flags(n);
+            m->data = n->bytecode;
+            m->size = n->bytecode_len;
+            m->raw_size = n->raw_len;
+        } else if (encode_module(ctx, ljs, n, dict, flags, m, &owned[i])) {
             goto fail;
         }
-        if (fwrite(&ljs->bytecode_len, sizeof(ljs->bytecode_len), 1, fp) != 1) {
-            JS_ThrowInternalError(ljs->ctx, "could not write bytecode_len");
-            goto fail;
+        m->debug = NULL;
+        m->debug_size = 0;
+        if (debug) {
+            const char *d = lanyt_js_get_filename(n);
+            m->debug = owned[count + i] =
+                pack_debug(ctx, d ? d : "(external call)", &m->debug_size);
+            if (!m->debug)
+                goto fail;
         }
-        if (fwrite(ljs->bytecode, 1, ljs->bytecode_len, fp) !=
-            ljs->bytecode_len) {
-            JS_ThrowInternalError(ljs->ctx, "could not write bytecode");
-            goto fail;
+    }
+
+    aliases.mods = mods + count;
+    list_aliases(ljs, &aliases);
+
+    fp = fopen(filename, "wb");
+    if (!fp) {
+        JS_ThrowInternalError(ctx, "could not open '%s'", filename);
+        goto fail;
+    }
+    ret = 0;
+    bundle_flags = LJS_BUNDLE_INTRINSICS;
+    if (debug)
+        bundle_flags |= LJS_BUNDLE_DEBUG | LJS_BUNDLE_DEBUG_PACKED;
+    if (flags & LANYT_SAVE_EXE) {
+        ret = ljs_exe_copy_self(fp);
+        if (!ret && (off = ftell(fp)) < 0)
+            ret = -1;
+    }
+    if (!ret)
+        ret = ljs_bundle_write(fp, mods, count + aliases.count, 0,
+                               bundle_flags, dict);
+    if (!ret && (flags & LANYT_SAVE_EXE))
+        ret = ljs_exe_finish(fp, off);
+    if (fclose(fp))
+        ret = -1;
+    if (ret) {
+        JS_ThrowInternalError(ctx, "could not write '%s'", filename);
+        ret = -2;
+    }
+fail:
+    if (owned) {
+        for (i = 0; i < count * 2; i++)
+            js_free(ctx, owned[i]);
+        js_free(ctx, owned);
+    }
+    ljs_bundle_dict_free(dict);
+    js_free(ctx, mods);
+    if (ret)
+        js_std_dump_error(ctx);
+    return ret;
+}
+
+/* The base is only trusted if it is exactly the bundle the dependency file
+ * describes, saved the same way as the next one will be. */
+static int base_usable(incremental *in) {
+    const ljs_deps *d = in->from;
+
+    if (d->save_flags != (uint32_t)in->flags ||
+        d->bundle_size != in->image_len ||
+        d->bundle_hash != ljs_hash64(in->image, in->image_len, 0) ||
+        ljs_bundle_open(&in->bundle, in->image, in->image_len))
+        return 0;
+    for (int i = 0; i < d->len; i++) {
+        if (d->mods[i].offset > in->image_len ||
+            d->mods[i].size > in->image_len - d->mods[i].offset)
+            return 0;
+    }
+    return 1;
+}
+
+int lanyt_js_set_base(lanyt_js *ljs, const char *bundle, const char *deps,
+                      int flags) {
+    JSContext *ctx = ljs->ctx;
+    incremental *in = mi_zalloc(sizeof(*in));
+
+    if (!in || !(in->to = ljs_deps_new())) {
+        mi_free(in);
+        JS_ThrowOutOfMemory(ctx);
+        js_std_dump_error(ctx);
+        return -1;
+    }
+    if (ljs->incr)
+        js_free(ctx, ljs->incr->image);
+    free_incremental(ljs->incr);
+    ljs->incr = in;
+    in->flags = flags;
+    in->from = deps ? ljs_deps_read(deps) : NULL;
+    if (in->from)
+        in->image = load_file(ctx, &in->image_len, bundle);
+    if (!in->image || !base_usable(in)) {
+        js_free(ctx, in->image);
+        in->image = NULL;
+        ljs_deps_free(in->from);
+        in->from = NULL;
+    }
+    return 0;
+}
+
+int lanyt_js_save_deps(lanyt_js *ljs, const char *bundle, const char *deps) {
+    JSContext *ctx = ljs->ctx;
+    incremental *in = ljs->incr;
+    ljs_bundle_module bm;
+    ljs_bundle b;
+    uint8_t *image = NULL;
+    size_t len;
+    int idx, ret = -1;
+
+    if (!in) {
+        JS_ThrowInternalError(ctx, "no dependencies were tracked");
+        goto done;
+    }
+    image = load_file(ctx, &len, bundle);
+    if (!image || ljs_bundle_open(&b, image, len)) {
+        JS_ThrowInternalError(ctx, "could not read bundle '%s'", bundle);
+        goto done;
+    }
+    in->to->bundle_size = len;
+    in->to->bundle_hash = ljs_hash64(image, len, 0);
+    in->to->save_flags = in->flags;
+    for (int i = 0; i < in->to->len; i++) {
+        ljs_deps_module *m = &in->to->mods[i];
+        idx = i == 0 ? (int)b.entry : ljs_bundle_find(&b, m->name);
+        if (idx < 0) {
+            JS_ThrowInternalError(ctx, "module '%s' is not in '%s'", m->name,
+                                  bundle);
+            goto done;
         }
-        if (!debug) {
-            ljs = ljs->next;
+        ljs_bundle_get(&b, idx, &bm);
+        m->offset = bm.data - image;
+        m->size = bm.size;
+        m->raw_size = bm.raw_size;
+        m->flags = bm.flags;
+    }
+    ret = ljs_deps_write(in->to, deps);
+    if (ret)
+        JS_ThrowInternalError(ctx, "could not write '%s'", deps);
+done:
+    js_free(ctx, image);
+    if (ret)
+        js_std_dump_error(ctx);
+    return ret;
+}
+
+/* Undo a partial parse_image or parse_bundle, keeping the head's context. */
+static void drop_chain(lanyt_js *ljs) {
+    free_help(ljs->ctx, ljs->next);
+    ljs->next = NULL;
+    if (ljs->borrowed) {
+        ljs->bytecode = NULL;
+        ljs->bytecode_len = 0;
+        ljs->borrowed = 0;
+    }
+    js_free(ljs->ctx, ljs->name);
+    ljs->name = NULL;
+    js_free(ljs->ctx, ljs->filename);
+    ljs->filename = NULL;
+    ljs->debug = NULL;
+    ljs->debug_size = 0;
+}
+
+/* Build the module chain from a v2 image. Only the entry is run eagerly,
+ * every named module is left to bundle_module_loader. */
+static int parse_bundle(lanyt_js *ljs, int *debug) {
+    JSContext *ctx = ljs->ctx;
+    ljs_bundle_module bm;
+    lanyt_js *tail = ljs, *n;
+
+    if (ljs_bundle_open(&ljs->bundle, ljs->image, ljs->image_len)) {
+        ljs->bundle.image = NULL;
+        JS_ThrowInternalError(ctx, "invalid file format");
+        goto fail;
+    }
+    if (debug)
+        *debug = !!(ljs->bundle.flags & LJS_BUNDLE_DEBUG);
+
+    for (uint32_t i = 0; i < ljs->bundle.count; i++) {
+        ljs_bundle_get(&ljs->bundle, i, &bm);
+        // only jsc_module_normalize reads these
+        if (bm.flags & LJS_MODULE_ALIAS)
             continue;
-        }
-        if (ljs->filename) {
-            uint64_t len = strlen(ljs->filename);
-            if (fwrite(&len, sizeof(len), 1, fp) != 1) {
-                JS_ThrowInternalError(
-                    ljs->ctx, "could not write file len: '%s'", ljs->filename);
-                goto fail;
-            }
-            if (fwrite(ljs->filename, 1, len, fp) != len) {
-                JS_ThrowInternalError(ljs->ctx, "could not write file: %s",
-                                      ljs->filename);
-                goto fail;
-            }
+        if (i == ljs->bundle.entry) {
+            n = ljs;
         } else {
-            char *buf = "(external call)";
-            uint64_t len = strlen(buf);
-            if (fwrite(&len, sizeof(len), 1, fp) != 1) {
-                JS_ThrowInternalError(
-                    ljs->ctx, "could not write file len: '%s'", ljs->filename);
+            n = lanyt_new_js_noctx(JS_GetRuntime(ctx));
+            if (!n) {
+                JS_ThrowOutOfMemory(ctx);
                 goto fail;
             }
-            if (fwrite(buf, 1, len, fp) != len) {
-                JS_ThrowInternalError(ljs->ctx, "could not write file: %s",
-                                      ljs->filename);
+            tail->next = n;
+            tail = n;
+            n->lazy = !(bm.flags & LJS_MODULE_EAGER);
+        }
+        n->borrowed = 1;
+        n->bytecode = (uint8_t *)bm.data;
+        n->bytecode_len = bm.size;
+        n->compressed = !!(bm.flags & LJS_MODULE_LZ);
+        n->atoms = !!(bm.flags & LJS_MODULE_ATOMS);
+        n->raw_len = bm.raw_size;
+        n->uses = (ljs->bundle.flags & LJS_BUNDLE_INTRINSICS)
+                      ? (int)bm.intrinsics
+                      : LANYT_INTRINSIC_ALL;
+        if (bm.name_len) {
+            n->name = js_strndup(ctx, bm.name, bm.name_len);
+            if (!n->name)
+                goto fail;
+        }
+        if (bm.debug && (ljs->bundle.flags & LJS_BUNDLE_DEBUG_PACKED)) {
+            // only read when something asks for it
+            n->debug = bm.debug;
+            n->debug_size = bm.debug_size;
+        } else if (bm.debug) {
+            n->filename = js_strndup(ctx, (const char *)bm.debug,
+                                     bm.debug_size);
+            if (!n->filename)
                 goto fail;
-            }
         }
-        ljs = ljs->next;
     }
+    return 0;
 
-    uint64_t _tmp = 0;
-    if (fwrite(&_tmp, sizeof(_tmp), 1, fp) != 1)
-        goto fail;
+fail:
+    js_std_dump_error(ctx);
+    drop_chain(ljs);
+    ljs->bundle.image = NULL;
+    return -1;
+}
+
+/* Split a legacy (v1) bundle image into the module chain. Every module's
+ * bytecode is left pointing into the image, which the head node keeps alive
+ * until lanyt_free_js. */
+static int parse_image(lanyt_js *ljs, int *debug) {
+    uint8_t *p = ljs->image, *end = ljs->image + ljs->image_len;
+    lanyt_js *tail = ljs, *n;
+    uint64_t len;
+    int is_debug;
+
+    if (ljs->image_len < sizeof(is_debug))
+        goto invalid;
+    memcpy(&is_debug, p, sizeof(is_debug));
+    p += sizeof(is_debug);
+    if (debug)
+        *debug = is_debug;
+
+    for (n = ljs;; n = NULL) {
+        if ((size_t)(end - p) < sizeof(len))
+            goto invalid;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if (len == 0)
+            break;
+        if (len > (size_t)(end - p))
+            goto invalid;
+
+        if (!n) {
+            n = lanyt_new_js_noctx(JS_GetRuntime(ljs->ctx));
+            if (!n) {
+                JS_ThrowOutOfMemory(ljs->ctx);
+                goto fail;
+            }
+            tail->next = n;
+            tail = n;
+        }
+        n->borrowed = 1;
+        n->bytecode = p;
+        n->bytecode_len = len;
+        n->uses = LANYT_INTRINSIC_ALL; // predates the record
+        p += len;
 
-    fclose(fp);
+        if (!is_debug)
+            continue;
+        if ((size_t)(end - p) < sizeof(len))
+            goto invalid;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if (len > (size_t)(end - p))
+            goto invalid;
+        n->filename = js_malloc(ljs->ctx, len + 1);
+        if (!n->filename)
+            goto fail;
+        memcpy(n->filename, p, len);
+        n->filename[len] = '\0';
+        p += len;
+    }
     return 0;
+
+invalid:
+    JS_ThrowInternalError(ljs->ctx, "invalid file format");
 fail:
-    fclose(fp);
     js_std_dump_error(ljs->ctx);
-    return -2;
+    drop_chain(ljs);
+    return -1;
+}
+
+static int load_image(lanyt_js *ljs, int *debug) {
+    if (ljs_bundle_probe(ljs->image, ljs->image_len))
+        return parse_bundle(ljs, debug);
+    return parse_image(ljs, debug);
 }
 
 int lanyt_js_read(lanyt_js *ljs, const char *filename, int *debug) {
-    uint8_t *buf, *buf1;
-    uint64_t buf_len;
-    int is_debug = 0;
+    size_t buf_len;
+    uint8_t *buf;
     if (!ljs) {
         printf("ljs is null\n");
         return -1;
@@ -467,94 +2486,69 @@ int lanyt_js_read(lanyt_js *ljs, const char *filename, int *debug) {
         js_std_dump_error(ljs->ctx);
         return -1;
     }
-    buf = js_load_file(ljs->ctx, &buf_len, filename);
-    buf1 = buf;
+    buf = load_file(ljs->ctx, &buf_len, filename);
     if (!buf) {
         JS_ThrowInternalError(ljs->ctx, "could not load '%s'", filename);
         js_std_dump_error(ljs->ctx);
         return -2;
     }
-    is_debug = *(int *)buf;
-    buf += sizeof(int);
-    buf_len -= sizeof(int);
-    if (debug)
-        *debug = is_debug;
-    int f = 0;
-    while (buf_len > 0) {
-        uint64_t len;
-        uint8_t *p;
-
-        len = *(uint64_t *)buf;
-        if (len == 0)
-            break;
-        p = buf + sizeof(uint64_t);
-        if (len > buf_len) {
-            JS_ThrowInternalError(ljs->ctx, "invalid file format");
-            js_std_dump_error(ljs->ctx);
-            goto fail;
-        }
-
-        lanyt_js *n = lanyt_new_js_noctx(JS_GetRuntime(ljs->ctx));
-        if (!n) {
-        mem_fail:
-            js_std_dump_error(ljs->ctx);
-            goto fail;
-        }
-        n->bytecode_len = len;
-        n->bytecode = js_malloc(ljs->ctx, len);
-        if (!n->bytecode) {
-            js_free(ljs->ctx, n);
-            goto mem_fail;
-        }
-        memcpy(n->bytecode, p, len);
-
-        if (is_debug) {
-            buf += len + sizeof(uint64_t);
-            buf_len -= len + sizeof(uint64_t);
-
-            if (buf_len < sizeof(uint64_t)) {
-                JS_ThrowInternalError(ljs->ctx, "invalid file format");
-                js_std_dump_error(ljs->ctx);
-                goto fail;
-            }
-
-            len = *(uint64_t *)buf;
-            p = buf + sizeof(uint64_t);
-            if (len > buf_len) {
-                JS_ThrowInternalError(ljs->ctx, "invalid file format");
-                js_std_dump_error(ljs->ctx);
-                goto fail;
-            }
-            n->filename = js_malloc(ljs->ctx, len + 1);
-            if (!n->filename) {
-                js_free(ljs->ctx, n->bytecode);
-                js_free(ljs->ctx, n);
-                goto mem_fail;
-            }
-            memcpy(n->filename, p, len);
-            n->filename[len] = '\0';
-        }
-
-        if (!f) {
-            ljs->bytecode_len = len;
-            ljs->bytecode = n->bytecode;
-            f = 1;
-            js_free(ljs->ctx, n);
-        } else {
-            lanyt_js *t = ljs->next;
-            while (t->next != NULL) {
-                t = t->next;
-            }
-            t->next = n;
-        }
+    release_image(ljs->ctx, ljs);
+    ljs->image_kind = LANYT_IMAGE_HEAP;
+    ljs->image = buf;
+    ljs->image_len = buf_len;
+    if (load_image(ljs, debug)) {
+        release_image(ljs->ctx, ljs);
+        return -3;
+    }
+    return 0;
+}
 
-        buf += len + sizeof(uint64_t);
-        buf_len -= len + sizeof(uint64_t);
+int lanyt_js_map(lanyt_js *ljs, const char *filename, int *debug) {
+    size_t buf_len;
+    uint8_t *buf;
+    int span;
+    if (!ljs) {
+        printf("ljs is null\n");
+        return -1;
+    }
+    if (!filename) {
+        JS_ThrowInternalError(ljs->ctx, "filename is null");
+        js_std_dump_error(ljs->ctx);
+        return -1;
+    }
+    span = ljs_trace_begin("load_file", filename);
+    buf = map_file(filename, &buf_len);
+    ljs_trace_end(span);
+    if (!buf) {
+        JS_ThrowInternalError(ljs->ctx, "could not map '%s'", filename);
+        js_std_dump_error(ljs->ctx);
+        return -2;
     }
+    release_image(ljs->ctx, ljs);
+    ljs->image_kind = LANYT_IMAGE_MAP;
+    ljs->image = buf;
+    ljs->image_len = buf_len;
+    if (load_image(ljs, debug)) {
+        release_image(ljs->ctx, ljs);
+        return -3;
+    }
+    return 0;
+}
 
-    js_free(ljs->ctx, buf1);
+int lanyt_js_read_mem(lanyt_js *ljs, const uint8_t *buf, size_t len,
+                      int *debug) {
+    if (!ljs) {
+        printf("ljs is null\n");
+        return -1;
+    }
+    release_image(ljs->ctx, ljs);
+    ljs->image_kind = LANYT_IMAGE_BORROWED;
+    // only ever read, like a mapping
+    ljs->image = (uint8_t *)buf;
+    ljs->image_len = len;
+    if (load_image(ljs, debug)) {
+        release_image(ljs->ctx, ljs);
+        return -3;
+    }
     return 0;
-fail:
-    js_free(ljs->ctx, buf1);
-    return -3;
-}
\ No newline at end of file
+}
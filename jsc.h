@@ -6,21 +6,113 @@
 #include <quickjs-libc.h>
 #include <quickjs.h>
 
+enum {
+    // engine allocations go to a mimalloc heap private to the runtime; the
+    // runtime must then stay on the thread that created it
+    LANYT_RT_HEAP = 1 << 0,
+    // lanyt_free_js and lanyt_jsc_free_rt skip finalizers and per-object
+    // frees and drop the whole heap instead, for use right before exit
+    LANYT_RT_FAST_FREE = 1 << 1,
+    // account allocations by size class and by the module being compiled,
+    // loaded or evaluated; SIGUSR1 prints lanyt_jsc_mem_report to stderr
+    LANYT_RT_MEM_STATS = 1 << 2,
+};
+
+// same as lanyt_jsc_new_rt2(LANYT_RT_HEAP)
 JSRuntime *lanyt_jsc_new_rt();
+JSRuntime *lanyt_jsc_new_rt2(int flags);
 void lanyt_jsc_free_rt(JSRuntime *p);
+// heap totals, peak, size classes, per-module attribution (with
+// LANYT_RT_MEM_STATS) and the engine's JS_ComputeMemoryUsage breakdown
+void lanyt_jsc_mem_report(JSRuntime *rt, FILE *fp);
+// sample the JS stack of rt's running script hz times a second; stop
+// writes the samples to filename as folded stacks for flamegraph tools
+int lanyt_jsc_prof_start(JSRuntime *rt, int hz);
+int lanyt_jsc_prof_stop(JSRuntime *rt, const char *filename);
+
+enum {
+    LANYT_INTRINSIC_DATE = 1 << 0,
+    LANYT_INTRINSIC_EVAL = 1 << 1, // without it, source compiles aside
+    LANYT_INTRINSIC_NORMALIZE = 1 << 2,
+    LANYT_INTRINSIC_REGEXP = 1 << 3,
+    LANYT_INTRINSIC_JSON = 1 << 4,
+    LANYT_INTRINSIC_PROXY = 1 << 5,
+    LANYT_INTRINSIC_MAPSET = 1 << 6,
+    LANYT_INTRINSIC_TYPED_ARRAYS = 1 << 7,
+    LANYT_INTRINSIC_ALL = (1 << 8) - 1,
+    // also add what the modules compiled or read into the context
+    // reference, as recorded in the bundle or found in their source
+    LANYT_INTRINSIC_AUTO = 1 << 8,
+};
 
 typedef struct lanyt_js lanyt_js;
 
+// same as lanyt_new_js2(rt, LANYT_INTRINSIC_ALL)
 lanyt_js *lanyt_new_js(JSRuntime *rt);
+// base objects and Promise, which module evaluation needs, are always there
+lanyt_js *lanyt_new_js2(JSRuntime *rt, int intrinsics);
+// for the contexts of os.Worker threads; AUTO counts as ALL there
+void lanyt_jsc_set_worker_intrinsics(int intrinsics);
 JSContext *lanyt_js_get_ctx(lanyt_js *ljs);
 lanyt_js *lanyt_js_get_next(lanyt_js *ljs);
 char *lanyt_js_get_filename(lanyt_js *ljs);
 void lanyt_free_js(lanyt_js *ljs);
+// cache compiled bytecode under dir, keyed by source, name and engine version
+int lanyt_js_set_cache_dir(lanyt_js *ljs, const char *dir);
+// keep each compiled file's source for lanyt_js_get_filename and the debug
+// section of a saved bundle; off by default, the source is dropped as soon
+// as it is compiled
+void lanyt_js_set_keep_source(lanyt_js *ljs, int keep);
 
 int lanyt_js_eval(lanyt_js *ljs, const char *filename);
+// compile the module graph of filename on a pool of worker runtimes
+int lanyt_js_eval_parallel(lanyt_js *ljs, const char *filename, int workers);
 int lanyt_js_run(lanyt_js *ljs, int silent);
+// like lanyt_js_run, but the event loop returns early once stop_fd is
+// readable, and 1 is returned then
+int lanyt_js_run2(lanyt_js *ljs, int silent, int stop_fd);
+// for a rerun in ljs, a fresh head on old's runtime: move over the
+// modules old compiled whose file changed() is false for. Their bytecode
+// does not depend on what they import, so a changed file only needs its
+// own compile, and its importers are linked again in the new context.
+// Returns 1 if the entry was moved too, 0 if it is to be compiled again
+int lanyt_js_adopt(lanyt_js *ljs, lanyt_js *old, const char *entry,
+                   int (*changed)(void *opaque, const char *name),
+                   void *opaque);
+// calls fn with every file the head compiled or tried to import
+int lanyt_js_files(lanyt_js *ljs, int (*fn)(void *opaque, const char *name),
+                   void *opaque);
+
+enum {
+    LANYT_SAVE_DEBUG = 1 << 0,
+    LANYT_SAVE_COMPRESS = 1 << 1, // compress each module's bytecode
+    // a copy of the running executable with the bundle appended, which runs
+    // the bundle when started (see exe.h)
+    LANYT_SAVE_EXE = 1 << 2,
+    // one atom table shared by all modules: a smaller file, but every load
+    // then copies the module to put its atoms back, so mapping is not free
+    LANYT_SAVE_ATOMS = 1 << 3,
+};
 
 int lanyt_js_save(lanyt_js *ljs, const char *filename, int debug);
+int lanyt_js_save2(lanyt_js *ljs, const char *filename, int flags);
+// Incremental compile, before lanyt_js_eval_parallel: bundle is the last
+// output and deps the dependency file lanyt_js_save_deps wrote with it
+// (see deps.h). A module whose source did not change since is not parsed,
+// and lanyt_js_save2 with the same flags copies its record over as it is.
+// A missing or stale pair is not an error, everything is compiled then,
+// as with NULL for both. The chain can be saved afterwards, but not run
+int lanyt_js_set_base(lanyt_js *ljs, const char *bundle, const char *deps,
+                      int flags);
+// after lanyt_js_save2, the dependency file for the next lanyt_js_set_base
+int lanyt_js_save_deps(lanyt_js *ljs, const char *bundle, const char *deps);
 int lanyt_js_read(lanyt_js *ljs, const char *filename, int *debug);
+// like lanyt_js_read, but maps the file read-only and runs the modules
+// straight from the mapping, which stays alive until lanyt_free_js
+int lanyt_js_map(lanyt_js *ljs, const char *filename, int *debug);
+// like lanyt_js_read, from a bundle image the caller owns; nothing is
+// copied, so buf must stay valid and unchanged until lanyt_free_js
+int lanyt_js_read_mem(lanyt_js *ljs, const uint8_t *buf, size_t len,
+                      int *debug);
 
 #endif // !JSC_H
\ No newline at end of file
@@ -0,0 +1,778 @@
+#include "loop.h"
+#include "clock.h"
+#include "hash.h"
+#include "module.h"
+
+#include <quickjs-libc.h>
+
+static _Thread_local int loop_worker;
+
+void ljs_loop_set_worker_thread(void) { loop_worker = 1; }
+
+#if !defined(__linux__)
+
+int ljs_loop_run(JSContext *ctx, int stop_fd) {
+    js_std_loop(ctx);
+    return 0;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cutils.h>
+#include <mimalloc.h>
+
+#define LOOP_EVENTS 64
+#define LOOP_SIGNALS 64
+// ~35 years, so that a deadline never overflows
+#define LOOP_MAX_DELAY_MS ((int64_t)1 << 40)
+
+typedef struct {
+    int32_t id;
+    uint32_t pos;      // index in the heap
+    uint64_t deadline; // ljs_clock_ns
+    uint64_t seq;      // orders timers with the same deadline
+    JSValue func;
+} loop_timer;
+
+typedef struct {
+    JSValue handler[2]; // read, write; JS_NULL when unset
+    uint32_t events;    // as registered with epoll
+    int always;         // epoll refused it (a regular file): always ready
+} loop_fd;
+
+typedef struct {
+    JSContext *ctx;
+    int epfd;
+    int tfd;           // fires at the earliest deadline
+    uint64_t armed;    // deadline tfd is set to, 0 when disarmed
+    loop_timer **heap; // min-heap by deadline, then seq
+    uint32_t ntimers;
+    uint32_t heap_cap;
+    loop_timer **ids; // open addressing by id, NULL is empty
+    uint32_t ids_mask;
+    int32_t next_id;
+    uint64_t next_seq;
+    loop_fd *fds; // indexed by fd
+    int fds_cap;
+    int nfds; // fds with at least one handler
+    int nalways;
+    JSValue signals[LOOP_SIGNALS];
+    int sig_added; // the signal pipe is in epfd
+    int stop_fd;   // see ljs_loop_run, -1 when unset
+    int stopped;
+    int foreign;   // libc's loop drives this one
+    int attached;  // epfd is one of libc's read handlers
+    JSValue libc_set_read;
+    JSValue libc_ready; // what is registered with it
+} loop_state;
+
+static JSClassID loop_class_id;
+static pthread_once_t loop_class_once = PTHREAD_ONCE_INIT;
+
+// os.signal is main-thread only, so one pipe serves the process
+static int sig_pipe[2] = {-1, -1};
+static atomic_uint_fast64_t sig_pending;
+
+static void loop_new_class_id(void) { JS_NewClassID(&loop_class_id); }
+
+static int loop_busy(const loop_state *l) { return l->ntimers || l->nfds; }
+
+static void drain_jobs(JSContext *ctx) {
+    JSContext *ctx1;
+    int err;
+
+    while ((err = JS_ExecutePendingJob(JS_GetRuntime(ctx), &ctx1)) != 0) {
+        if (err < 0)
+            js_std_dump_error(ctx1);
+    }
+}
+
+static void call_handler(JSContext *ctx, JSValueConst func) {
+    // the handler may drop the last other reference to itself
+    JSValue f = JS_DupValue(ctx, func);
+    JSValue ret = JS_Call(ctx, f, JS_UNDEFINED, 0, NULL);
+
+    if (JS_IsException(ret))
+        js_std_dump_error(ctx);
+    JS_FreeValue(ctx, ret);
+    JS_FreeValue(ctx, f);
+    drain_jobs(ctx);
+}
+
+/* timers */
+
+static int timer_less(const loop_timer *a, const loop_timer *b) {
+    return a->deadline < b->deadline ||
+           (a->deadline == b->deadline && a->seq < b->seq);
+}
+
+static void heap_set(loop_state *l, uint32_t i, loop_timer *t) {
+    l->heap[i] = t;
+    t->pos = i;
+}
+
+static void heap_up(loop_state *l, uint32_t i) {
+    loop_timer *t = l->heap[i];
+    while (i > 0 && timer_less(t, l->heap[(i - 1) / 2])) {
+        heap_set(l, i, l->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_set(l, i, t);
+}
+
+static void heap_down(loop_state *l, uint32_t i) {
+    loop_timer *t = l->heap[i];
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= l->ntimers)
+            break;
+        if (c + 1 < l->ntimers && timer_less(l->heap[c + 1], l->heap[c]))
+            c++;
+        if (!timer_less(l->heap[c], t))
+            break;
+        heap_set(l, i, l->heap[c]);
+        i = c;
+    }
+    heap_set(l, i, t);
+}
+
+static loop_timer **id_slot(loop_timer **ids, uint32_t mask, int32_t id) {
+    uint32_t i = ljs_hash_mix((uint32_t)id) & mask;
+    while (ids[i] && ids[i]->id != id)
+        i = (i + 1) & mask;
+    return &ids[i];
+}
+
+// linear probing without tombstones: pull later entries of the run back
+static void id_remove(loop_state *l, loop_timer **slot) {
+    uint32_t mask = l->ids_mask, i = slot - l->ids, j = i, k;
+
+    l->ids[i] = NULL;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!l->ids[j])
+            break;
+        k = ljs_hash_mix((uint32_t)l->ids[j]->id) & mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            l->ids[i] = l->ids[j];
+            l->ids[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+static int timers_reserve(loop_state *l) {
+    if (l->ntimers == l->heap_cap) {
+        uint32_t cap = l->heap_cap ? l->heap_cap * 2 : 64;
+        loop_timer **heap = mi_realloc(l->heap, cap * sizeof(*heap));
+        if (!heap)
+            return -1;
+        l->heap = heap;
+        l->heap_cap = cap;
+    }
+    if ((l->ntimers + 1) * 2 > l->ids_mask) {
+        uint32_t mask = l->ids_mask ? l->ids_mask * 2 + 1 : 127;
+        loop_timer **ids = mi_calloc(mask + 1, sizeof(*ids));
+        if (!ids)
+            return -1;
+        for (uint32_t i = 0; i < l->ntimers; i++)
+            *id_slot(ids, mask, l->heap[i]->id) = l->heap[i];
+        mi_free(l->ids);
+        l->ids = ids;
+        l->ids_mask = mask;
+    }
+    return 0;
+}
+
+static void timer_unlink(loop_state *l, loop_timer *t) {
+    loop_timer *last = l->heap[--l->ntimers];
+
+    id_remove(l, id_slot(l->ids, l->ids_mask, t->id));
+    if (last != t) {
+        uint32_t i = t->pos;
+        heap_set(l, i, last);
+        heap_up(l, i);
+        heap_down(l, last->pos);
+    }
+}
+
+// point the timerfd at the earliest deadline; always-ready fds want a
+// round right away
+static void arm(loop_state *l) {
+    uint64_t want = l->nalways ? 1 : l->ntimers ? l->heap[0]->deadline : 0;
+    struct itimerspec its = {0};
+
+    if (want == l->armed)
+        return;
+    its.it_value.tv_sec = want / 1000000000ULL;
+    its.it_value.tv_nsec = want % 1000000000ULL;
+    if (!timerfd_settime(l->tfd, TFD_TIMER_ABSTIME, &its, NULL))
+        l->armed = want;
+}
+
+static void fire_timers(loop_state *l) {
+    JSContext *ctx = l->ctx;
+    uint64_t now = ljs_clock_ns();
+
+    // timers set by these callbacks wait for the next round
+    while (l->ntimers && l->heap[0]->deadline <= now) {
+        loop_timer *t = l->heap[0];
+        JSValue func = t->func;
+        timer_unlink(l, t);
+        mi_free(t);
+        call_handler(ctx, func);
+        JS_FreeValue(ctx, func);
+    }
+    arm(l);
+}
+
+/* libc's loop */
+
+static void sync_attach(loop_state *l) {
+    JSContext *ctx = l->ctx;
+    int want = l->foreign && loop_busy(l);
+    JSValue args[2], ret;
+
+    if (want == l->attached || !JS_IsFunction(ctx, l->libc_set_read))
+        return;
+    args[0] = JS_NewInt32(ctx, l->epfd);
+    args[1] = want ? l->libc_ready : JS_NULL;
+    ret = JS_Call(ctx, l->libc_set_read, JS_UNDEFINED, 2, args);
+    if (JS_IsException(ret))
+        js_std_dump_error(ctx);
+    else
+        l->attached = want;
+    JS_FreeValue(ctx, ret);
+}
+
+static void changed(loop_state *l) {
+    if (l->foreign)
+        sync_attach(l);
+}
+
+/* rounds */
+
+static void fire_signals(loop_state *l) {
+    char buf[64];
+    uint64_t pending;
+
+    while (read(sig_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+    pending = atomic_exchange(&sig_pending, 0);
+    for (int sig = 0; sig < LOOP_SIGNALS; sig++) {
+        if ((pending >> sig) & 1 && !JS_IsNull(l->signals[sig]))
+            call_handler(l->ctx, l->signals[sig]);
+    }
+}
+
+static void fire_fd(loop_state *l, int fd, uint32_t events) {
+    // handlers may grow l->fds, so index it again after each call
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+        !JS_IsNull(l->fds[fd].handler[0]))
+        call_handler(l->ctx, l->fds[fd].handler[0]);
+    if (fd < l->fds_cap && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) &&
+        !JS_IsNull(l->fds[fd].handler[1]))
+        call_handler(l->ctx, l->fds[fd].handler[1]);
+}
+
+/* One round: wait up to timeout_ms, then run every ready fd and every
+ * expired timer. */
+static void loop_round(loop_state *l, int timeout_ms) {
+    struct epoll_event ev[LOOP_EVENTS];
+    int n = epoll_wait(l->epfd, ev, LOOP_EVENTS, timeout_ms);
+    uint64_t expired;
+
+    for (int i = 0; i < n; i++) {
+        int fd = ev[i].data.fd;
+        if (fd == l->tfd) {
+            if (read(l->tfd, &expired, sizeof(expired)) > 0)
+                l->armed = 0;
+        } else if (fd == sig_pipe[0]) {
+            fire_signals(l);
+        } else if (fd == l->stop_fd) {
+            // finish the round, the timerfd may have been read already
+            l->stopped = 1;
+        } else if (fd < l->fds_cap) {
+            fire_fd(l, fd, ev[i].events);
+        }
+    }
+    for (int fd = 0; l->nalways && fd < l->fds_cap; fd++) {
+        if (l->fds[fd].always)
+            fire_fd(l, fd, EPOLLIN | EPOLLOUT);
+    }
+    fire_timers(l);
+}
+
+int ljs_loop_run(JSContext *ctx, int stop_fd) {
+    loop_state *l = JS_GetContextOpaque(ctx);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = stop_fd};
+    int stopped;
+
+    if (l && stop_fd >= 0 &&
+        !epoll_ctl(l->epfd, EPOLL_CTL_ADD, stop_fd, &ev))
+        l->stop_fd = stop_fd;
+    for (;;) {
+        drain_jobs(ctx);
+        if (!l || l->foreign || !loop_busy(l) || l->stopped)
+            break;
+        loop_round(l, -1);
+    }
+    if (!l)
+        goto libc;
+    stopped = l->stopped;
+    if (l->stop_fd >= 0)
+        epoll_ctl(l->epfd, EPOLL_CTL_DEL, l->stop_fd, &ev);
+    l->stop_fd = -1;
+    l->stopped = 0;
+    if (stopped)
+        return 1;
+    sync_attach(l);
+libc:
+    // worker ports, and from here on everything for a foreign loop
+    js_std_loop(ctx);
+    return 0;
+}
+
+/* lanyt:loop */
+
+static loop_state *loop_get(JSContext *ctx, JSValueConst *data) {
+    return JS_GetOpaque(data[0], loop_class_id);
+}
+
+static JSValue js_loop_set_timeout(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv, int magic,
+                                   JSValue *data) {
+    loop_state *l = loop_get(ctx, data);
+    loop_timer *t;
+    int64_t delay;
+
+    if (!JS_IsFunction(ctx, argv[0]))
+        return JS_ThrowTypeError(ctx, "not a function");
+    if (JS_ToInt64(ctx, &delay, argv[1]))
+        return JS_EXCEPTION;
+    delay = delay < 0 ? 0 : delay > LOOP_MAX_DELAY_MS ? LOOP_MAX_DELAY_MS
+                                                      : delay;
+    t = mi_malloc(sizeof(loop_timer));
+    if (!t || timers_reserve(l)) {
+        mi_free(t);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    // ids wrap like libc's, skipping any still in use
+    do {
+        t->id = l->next_id;
+        l->next_id = l->next_id == INT32_MAX ? 1 : l->next_id + 1;
+    } while (*id_slot(l->ids, l->ids_mask, t->id));
+    t->deadline = ljs_clock_ns() + (uint64_t)delay * 1000000;
+    t->seq = l->next_seq++;
+    t->func = JS_DupValue(ctx, argv[0]);
+    *id_slot(l->ids, l->ids_mask, t->id) = t;
+    heap_set(l, l->ntimers++, t);
+    heap_up(l, t->pos);
+    arm(l);
+    changed(l);
+    return JS_NewInt32(ctx, t->id);
+}
+
+static JSValue js_loop_clear_timeout(JSContext *ctx, JSValueConst this_val,
+                                     int argc, JSValueConst *argv, int magic,
+                                     JSValue *data) {
+    loop_state *l = loop_get(ctx, data);
+    loop_timer *t;
+    int32_t id;
+
+    if (JS_ToInt32(ctx, &id, argv[0]))
+        return JS_EXCEPTION;
+    if (!l->ids || !(t = *id_slot(l->ids, l->ids_mask, id)))
+        return JS_UNDEFINED;
+    timer_unlink(l, t);
+    JS_FreeValue(ctx, t->func);
+    mi_free(t);
+    arm(l);
+    changed(l);
+    return JS_UNDEFINED;
+}
+
+static JSValue js_loop_sleep_async(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv, int magic,
+                                   JSValue *data) {
+    JSValue funcs[2], promise, args[2], ret;
+
+    promise = JS_NewPromiseCapability(ctx, funcs);
+    if (JS_IsException(promise))
+        return promise;
+    // a timer that calls resolve
+    args[0] = funcs[0];
+    args[1] = argc > 0 ? argv[0] : JS_UNDEFINED;
+    ret = js_loop_set_timeout(ctx, this_val, 2, args, 0, data);
+    JS_FreeValue(ctx, funcs[0]);
+    JS_FreeValue(ctx, funcs[1]);
+    if (JS_IsException(ret)) {
+        JS_FreeValue(ctx, promise);
+        return ret;
+    }
+    return promise;
+}
+
+static int fds_reserve(loop_state *l, int fd) {
+    int cap = l->fds_cap;
+    loop_fd *fds;
+
+    if (fd < cap)
+        return 0;
+    while (cap <= fd)
+        cap = cap ? cap * 2 : 64;
+    fds = mi_realloc(l->fds, cap * sizeof(*fds));
+    if (!fds)
+        return -1;
+    for (int i = l->fds_cap; i < cap; i++) {
+        fds[i].handler[0] = fds[i].handler[1] = JS_NULL;
+        fds[i].events = 0;
+        fds[i].always = 0;
+    }
+    l->fds = fds;
+    l->fds_cap = cap;
+    return 0;
+}
+
+// bring the epoll registration of fd in line with its handlers
+static int fd_update(loop_state *l, int fd) {
+    loop_fd *f = &l->fds[fd];
+    uint32_t want = (JS_IsNull(f->handler[0]) ? 0 : EPOLLIN) |
+                    (JS_IsNull(f->handler[1]) ? 0 : EPOLLOUT);
+    struct epoll_event ev = {.events = want, .data.fd = fd};
+    int r = 0;
+
+    if (f->always) {
+        if (!want) {
+            f->always = 0;
+            l->nalways--;
+        }
+        return 0;
+    }
+    if (want == f->events)
+        return 0;
+    if (!want) {
+        // a closed fd has left the set already
+        epoll_ctl(l->epfd, EPOLL_CTL_DEL, fd, &ev);
+    } else if (f->events) {
+        r = epoll_ctl(l->epfd, EPOLL_CTL_MOD, fd, &ev);
+        // closed and opened again since
+        if (r < 0 && errno == ENOENT)
+            r = epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev);
+    } else {
+        r = epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if (r < 0 && errno == EPERM) {
+        // regular files cannot be polled; select calls them ready
+        f->always = 1;
+        l->nalways++;
+        f->events = 0;
+        return 0;
+    }
+    if (r < 0)
+        return -1;
+    f->events = want;
+    return 0;
+}
+
+static JSValue js_loop_set_handler(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv, int magic,
+                                   JSValue *data) {
+    loop_state *l = loop_get(ctx, data);
+    JSValueConst func = argv[1];
+    JSValue old;
+    loop_fd *f;
+    int fd, had;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (fd < 0)
+        return JS_ThrowRangeError(ctx, "invalid fd");
+    if (!JS_IsNull(func) && !JS_IsFunction(ctx, func))
+        return JS_ThrowTypeError(ctx, "not a function");
+    if (fds_reserve(l, fd))
+        return JS_ThrowOutOfMemory(ctx);
+    f = &l->fds[fd];
+    had = !JS_IsNull(f->handler[0]) || !JS_IsNull(f->handler[1]);
+    old = f->handler[magic];
+    f->handler[magic] = JS_DupValue(ctx, func);
+    if (fd_update(l, fd)) {
+        JS_FreeValue(ctx, f->handler[magic]);
+        f->handler[magic] = old;
+        return JS_ThrowInternalError(ctx, "cannot poll fd %d: %s", fd,
+                                     strerror(errno));
+    }
+    JS_FreeValue(ctx, old);
+    l->nfds += (!JS_IsNull(f->handler[0]) || !JS_IsNull(f->handler[1])) - had;
+    arm(l);
+    changed(l);
+    return JS_UNDEFINED;
+}
+
+static void on_signal(int sig) {
+    int saved = errno;
+    atomic_fetch_or(&sig_pending, (uint64_t)1 << sig);
+    if (write(sig_pipe[1], "", 1) < 0) {
+        // full: a wakeup is pending anyway
+    }
+    errno = saved;
+}
+
+static JSValue js_loop_signal(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv, int magic,
+                              JSValue *data) {
+    loop_state *l = loop_get(ctx, data);
+    JSValueConst func = argv[1];
+    struct epoll_event ev = {.events = EPOLLIN};
+    uint32_t sig;
+
+    if (loop_worker)
+        return JS_ThrowTypeError(
+            ctx, "signal handler can only be set in the main thread");
+    if (JS_ToUint32(ctx, &sig, argv[0]))
+        return JS_EXCEPTION;
+    if (sig >= LOOP_SIGNALS)
+        return JS_ThrowRangeError(ctx, "invalid signal number");
+    if (JS_IsNull(func) || JS_IsUndefined(func)) {
+        JS_FreeValue(ctx, l->signals[sig]);
+        l->signals[sig] = JS_NULL;
+        signal(sig, JS_IsNull(func) ? SIG_DFL : SIG_IGN);
+        return JS_UNDEFINED;
+    }
+    if (!JS_IsFunction(ctx, func))
+        return JS_ThrowTypeError(ctx, "not a function");
+    if (sig_pipe[0] < 0) {
+        if (pipe(sig_pipe) < 0)
+            return JS_ThrowInternalError(ctx, "pipe: %s", strerror(errno));
+        for (int i = 0; i < 2; i++) {
+            fcntl(sig_pipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(sig_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+    if (!l->sig_added) {
+        ev.data.fd = sig_pipe[0];
+        if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, sig_pipe[0], &ev) < 0)
+            return JS_ThrowInternalError(ctx, "epoll: %s", strerror(errno));
+        l->sig_added = 1;
+    }
+    JS_FreeValue(ctx, l->signals[sig]);
+    l->signals[sig] = JS_DupValue(ctx, func);
+    signal(sig, on_signal);
+    return JS_UNDEFINED;
+}
+
+// libc's os.setReadHandler, for handing epfd over once libc runs the loop
+static JSValue js_loop_attach(JSContext *ctx, JSValueConst this_val, int argc,
+                              JSValueConst *argv, int magic, JSValue *data) {
+    loop_state *l = loop_get(ctx, data);
+    JS_FreeValue(ctx, l->libc_set_read);
+    l->libc_set_read = JS_DupValue(ctx, argv[0]);
+    changed(l);
+    return JS_UNDEFINED;
+}
+
+// from now on libc's loop runs: something it owns (a Worker) is in use
+static JSValue js_loop_hand_off(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv, int magic,
+                                JSValue *data) {
+    loop_state *l = loop_get(ctx, data);
+    l->foreign = 1;
+    changed(l);
+    return JS_UNDEFINED;
+}
+
+// the read handler libc calls when epfd is ready
+static JSValue js_loop_ready(JSContext *ctx, JSValueConst this_val, int argc,
+                             JSValueConst *argv, int magic, JSValue *data) {
+    loop_state *l = loop_get(ctx, data);
+    loop_round(l, 0);
+    sync_attach(l);
+    return JS_UNDEFINED;
+}
+
+/* A worker's script is named relative to the module that creates it. libc
+ * takes the module of its caller, which is "os" once Worker is wrapped. */
+static JSValue js_loop_worker_path(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv, int magic,
+                                   JSValue *data) {
+    return lanyt_js_caller_path(ctx, argv[0]);
+}
+
+static void loop_finalizer(JSRuntime *rt, JSValue val) {
+    loop_state *l = JS_GetOpaque(val, loop_class_id);
+
+    if (!l)
+        return;
+    for (uint32_t i = 0; i < l->ntimers; i++) {
+        JS_FreeValueRT(rt, l->heap[i]->func);
+        mi_free(l->heap[i]);
+    }
+    for (int fd = 0; fd < l->fds_cap; fd++) {
+        JS_FreeValueRT(rt, l->fds[fd].handler[0]);
+        JS_FreeValueRT(rt, l->fds[fd].handler[1]);
+    }
+    for (int sig = 0; sig < LOOP_SIGNALS; sig++) {
+        if (!JS_IsNull(l->signals[sig]))
+            signal(sig, SIG_DFL);
+        JS_FreeValueRT(rt, l->signals[sig]);
+    }
+    JS_FreeValueRT(rt, l->libc_set_read);
+    JS_FreeValueRT(rt, l->libc_ready);
+    close(l->epfd);
+    close(l->tfd);
+    mi_free(l->heap);
+    mi_free(l->ids);
+    mi_free(l->fds);
+    mi_free(l);
+}
+
+static void loop_mark(JSRuntime *rt, JSValueConst val,
+                      JS_MarkFunc *mark_func) {
+    loop_state *l = JS_GetOpaque(val, loop_class_id);
+
+    if (!l)
+        return;
+    for (uint32_t i = 0; i < l->ntimers; i++)
+        JS_MarkValue(rt, l->heap[i]->func, mark_func);
+    for (int fd = 0; fd < l->fds_cap; fd++) {
+        JS_MarkValue(rt, l->fds[fd].handler[0], mark_func);
+        JS_MarkValue(rt, l->fds[fd].handler[1], mark_func);
+    }
+    for (int sig = 0; sig < LOOP_SIGNALS; sig++)
+        JS_MarkValue(rt, l->signals[sig], mark_func);
+    JS_MarkValue(rt, l->libc_set_read, mark_func);
+    JS_MarkValue(rt, l->libc_ready, mark_func);
+}
+
+static JSClassDef loop_class = {
+    "Loop",
+    .finalizer = loop_finalizer,
+    .gc_mark = loop_mark,
+};
+
+static const struct {
+    const char *name;
+    int length;
+    int magic;
+    JSCFunctionData *func;
+} loop_funcs[] = {
+    {"setTimeout", 2, 0, js_loop_set_timeout},
+    {"clearTimeout", 1, 0, js_loop_clear_timeout},
+    {"sleepAsync", 1, 0, js_loop_sleep_async},
+    {"setReadHandler", 2, 0, js_loop_set_handler},
+    {"setWriteHandler", 2, 1, js_loop_set_handler},
+    {"signal", 2, 0, js_loop_signal},
+    {"attach", 1, 0, js_loop_attach},
+    {"handOff", 0, 0, js_loop_hand_off},
+    {"workerPath", 1, 0, js_loop_worker_path},
+};
+
+static loop_state *loop_new(JSContext *ctx) {
+    loop_state *l = mi_zalloc(sizeof(loop_state));
+
+    if (!l)
+        return NULL;
+    l->ctx = ctx;
+    l->epfd = epoll_create1(EPOLL_CLOEXEC);
+    l->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (l->epfd >= 0 && l->tfd >= 0) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = l->tfd};
+        if (!epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->tfd, &ev)) {
+            l->next_id = 1;
+            l->stop_fd = -1;
+            for (int sig = 0; sig < LOOP_SIGNALS; sig++)
+                l->signals[sig] = JS_NULL;
+            l->libc_set_read = JS_UNDEFINED;
+            l->libc_ready = JS_UNDEFINED;
+            l->foreign = loop_worker;
+            return l;
+        }
+    }
+    if (l->epfd >= 0)
+        close(l->epfd);
+    if (l->tfd >= 0)
+        close(l->tfd);
+    mi_free(l);
+    return NULL;
+}
+
+static int js_loop_init(JSContext *ctx, JSModuleDef *m) {
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSValue obj;
+    loop_state *l;
+
+    pthread_once(&loop_class_once, loop_new_class_id);
+    if (!JS_IsRegisteredClass(rt, loop_class_id))
+        JS_NewClass(rt, loop_class_id, &loop_class);
+    obj = JS_NewObjectClass(ctx, loop_class_id);
+    if (JS_IsException(obj))
+        return -1;
+    l = loop_new(ctx);
+    if (!l) {
+        JS_FreeValue(ctx, obj);
+        JS_ThrowInternalError(ctx, "cannot create event loop: %s",
+                              strerror(errno));
+        return -1;
+    }
+    JS_SetOpaque(obj, l);
+    // the functions keep the state alive for as long as the module lives
+    l->libc_ready = JS_NewCFunctionData(ctx, js_loop_ready, 0, 0, 1, &obj);
+    for (size_t i = 0; i < countof(loop_funcs); i++) {
+        JSValue f = JS_NewCFunctionData(ctx, loop_funcs[i].func,
+                                        loop_funcs[i].length,
+                                        loop_funcs[i].magic, 1, &obj);
+        if (JS_SetModuleExport(ctx, m, loop_funcs[i].name, f)) {
+            JS_FreeValue(ctx, obj);
+            return -1;
+        }
+    }
+    JS_SetContextOpaque(ctx, l);
+    JS_FreeValue(ctx, obj);
+    return 0;
+}
+
+JSModuleDef *ljs_loop_init_module(JSContext *ctx, const char *module_name) {
+    JSModuleDef *m = JS_NewCModule(ctx, module_name, js_loop_init);
+    if (!m)
+        return NULL;
+    for (size_t i = 0; i < countof(loop_funcs); i++)
+        JS_AddModuleExport(ctx, m, loop_funcs[i].name);
+    return m;
+}
+
+/* os: libc's module re-exported, with the functions above shadowing its
+ * own (local exports win over export *). Worker is wrapped to hand the
+ * loop to libc, whose loop alone polls worker message ports, and names
+ * its script for libc, which would resolve it against "os". */
+static const char os_source[] =
+    "import * as libc from 'lanyt:os_libc';\n"
+    "import * as loop from 'lanyt:loop';\n"
+    "export * from 'lanyt:os_libc';\n"
+    "export { setTimeout, clearTimeout, sleepAsync, setReadHandler,\n"
+    "         setWriteHandler, signal } from 'lanyt:loop';\n"
+    "loop.attach(libc.setReadHandler);\n"
+    "export class Worker extends libc.Worker {\n"
+    "    constructor(filename, ...args) {\n"
+    "        super(loop.workerPath(filename), ...args);\n"
+    "        loop.handOff();\n"
+    "    }\n"
+    "}\n";
+
+static lanyt_js_builtin os_shim = {os_source};
+
+JSModuleDef *ljs_loop_init_module_os(JSContext *ctx, const char *module_name) {
+    return lanyt_js_load_builtin(ctx, module_name, &os_shim);
+}
+
+#endif
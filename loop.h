@@ -0,0 +1,32 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <quickjs.h>
+
+/* The event loop lanyt_js_run drains. On Linux the os module is libc's
+ * with setTimeout, clearTimeout, sleepAsync, setReadHandler,
+ * setWriteHandler and signal taken over by this loop: fds sit in an epoll
+ * set, timers in a binary heap behind one timerfd, so a round costs the
+ * same with thousands of either. Every callback is followed by the
+ * pending jobs, as with js_std_loop.
+ *
+ * libc still owns os.Worker message ports, which only its own loop polls.
+ * Once a context creates a Worker, and in a worker's context from the
+ * start, the epoll fd is handed to libc as one read handler and libc's
+ * loop drives both. Elsewhere the os module and the loop are libc's. */
+
+// run the jobs, timers and handlers of ctx until none is left, or until
+// stop_fd (if not -1) is readable; 1 in that case. libc's part of the loop
+// (worker ports, see above) is not interrupted
+int ljs_loop_run(JSContext *ctx, int stop_fd);
+// contexts created on the calling thread are driven by libc's loop
+void ljs_loop_set_worker_thread(void);
+
+#if defined(__linux__)
+// the os module described above
+JSModuleDef *ljs_loop_init_module_os(JSContext *ctx, const char *module_name);
+// lanyt:loop, the replaced functions on their own
+JSModuleDef *ljs_loop_init_module(JSContext *ctx, const char *module_name);
+#endif
+
+#endif // LOOP_H
@@ -0,0 +1,143 @@
+#include "lz.h"
+
+#include <string.h>
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_LOG 13
+// the format requires the last 5 bytes to be literals and the last match
+// to start at least 12 bytes before the end of the block
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+static uint8_t *put_len(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+size_t ljs_lz_bound(size_t len) { return len + len / 255 + 16; }
+
+size_t ljs_lz_compress(const uint8_t *src, size_t len, uint8_t *dst,
+                       size_t cap) {
+    uint32_t table[1 << HASH_LOG];
+    const uint8_t *ip = src, *anchor = src, *end = src + len;
+    uint8_t *op = dst, *oend = dst + cap;
+    size_t lit;
+
+    memset(table, 0, sizeof(table));
+    if (len > MF_LIMIT) {
+        const uint8_t *mf_limit = end - MF_LIMIT;
+        const uint8_t *m_limit = end - LAST_LITERALS;
+
+        while (ip < mf_limit) {
+            uint32_t seq = read32(ip), h = hash32(seq);
+            const uint8_t *ref = src + table[h], *m;
+            size_t off, ml;
+
+            table[h] = ip - src;
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+                ++ip;
+                continue;
+            }
+            for (m = ip + MIN_MATCH; m < m_limit && *m == ref[m - ip]; ++m)
+                ;
+
+            lit = ip - anchor;
+            off = ip - ref;
+            ml = m - ip - MIN_MATCH;
+            if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 +
+                                          ml / 255 + 1)
+                return 0;
+            *op++ = (lit >= 15 ? 15 : lit) << 4 | (ml >= 15 ? 15 : ml);
+            if (lit >= 15)
+                op = put_len(op, lit - 15);
+            memcpy(op, anchor, lit);
+            op += lit;
+            *op++ = off;
+            *op++ = off >> 8;
+            if (ml >= 15)
+                op = put_len(op, ml - 15);
+            ip = anchor = m;
+        }
+    }
+
+    lit = end - anchor;
+    if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit)
+        return 0;
+    *op++ = (lit >= 15 ? 15 : lit) << 4;
+    if (lit >= 15)
+        op = put_len(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+int ljs_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst,
+                      size_t raw_len) {
+    const uint8_t *ip = src, *iend = src + len;
+    uint8_t *op = dst, *oend = dst + raw_len;
+
+    while (ip < iend) {
+        unsigned token = *ip++, b;
+        size_t lit = token >> 4, ml = token & 15, off;
+        const uint8_t *ref;
+
+        if (lit == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - dst))
+            return -1;
+        if (ml == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                ml += b;
+            } while (b == 255);
+        }
+        ml += MIN_MATCH;
+        if (ml > (size_t)(oend - op))
+            return -1;
+
+        ref = op - off;
+        if (off >= ml) {
+            memcpy(op, ref, ml);
+            op += ml;
+        } else {
+            while (ml--)
+                *op++ = *ref++;
+        }
+    }
+    return op == oend ? 0 : -1;
+}
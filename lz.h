@@ -0,0 +1,19 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Byte-oriented LZ77 codec producing the LZ4 block format: greedy matching
+ * with a single-probe hash table on the way in, a plain copy loop on the
+ * way out. It favours decode speed over ratio. */
+
+size_t ljs_lz_bound(size_t len);
+// returns the compressed size, or 0 if it does not fit in cap bytes
+size_t ljs_lz_compress(const uint8_t *src, size_t len, uint8_t *dst,
+                       size_t cap);
+// dst must hold exactly raw_len bytes, returns -1 on malformed input
+int ljs_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst,
+                      size_t raw_len);
+
+#endif // LZ_H
@@ -1,19 +1,31 @@
+#include "clock.h"
+#include "exe.h"
+#include "intrin.h"
 #include "jsc.h"
 #include "module.h"
+#include "pool.h"
+#include "trace.h"
+#include "watch.h"
+#include <math.h>
+#include <mimalloc.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define ljs_VERSION "0.0.1"
 
 enum {
     COMMAND_RUN,
     COMMAND_COMPILE,
+    COMMAND_BENCH,
     COMMAND_HELP,
     OPTION_VERSION,
     COMMAND_COUNT,
 };
 
 static const char *command_str[] = {
-    "run", "compile", "help", "--version", "r", "c", "h", "-v",
+    "run", "compile", "bench", "help", "--version",
+    "r",   "c",       "b",     "h",    "-v",
 };
 typedef int (*command_func)(int argc, char **argv);
 
@@ -21,79 +33,442 @@ enum {
     OPTION_RUN_BYTECODE,
     OPTION_RUN_ARGS,
     OPTION_RUN_SILENT,
+    OPTION_RUN_MMAP,
+    OPTION_RUN_CACHE,
+    OPTION_RUN_WORKERS,
+    OPTION_RUN_MANIFEST,
+    OPTION_RUN_PRELOAD,
+    OPTION_RUN_FAST_EXIT,
+    OPTION_RUN_MEM_REPORT,
+    OPTION_RUN_PROF,
+    OPTION_RUN_PROF_HZ,
+    OPTION_RUN_TRACE,
+    OPTION_RUN_INTRINSICS,
+    OPTION_RUN_WATCH,
     OPTION_RUN_COUNT,
 };
 
 static const char *option_str[] = {
-    "--bytecode", "--args", "--silent", "-b", "-a", "-s",
+    "--bytecode",  "--args",       "--silent",   "--mmap",
+    "--cache",     "--workers",    "--manifest", "--preload",
+    "--fast-exit", "--mem-report", "--prof",     "--prof-hz",
+    "--trace-startup", "--intrinsics", "--watch",
+    "-b",          "-a",           "-s",         "-m",
+    "-C",          "-w",           "-M",         "-p",
+    "-F",          "-R",           "-P",         "-H",
+    "-T",          "-I",           "-W",
 };
 
 enum {
     OPTION_O,
+    OPTION_COMPRESS,
+    OPTION_CACHE,
+    OPTION_JOBS,
+    OPTION_DEBUG,
+    OPTION_EXE,
+    OPTION_FULL,
+    OPTION_ATOMS,
     OPTION_COMPILE_COUNT,
 };
 
 static const char *option_compile_str[] = {
-    "--output",
-    "-o",
+    "--output", "--compress", "--cache", "--jobs", "--debug",
+    "--exe",    "--full",     "--atoms", "-o",     "-z",
+    "-C",       "-j",         "-g",      "-x",     "-f",
+    "-a",
 };
 
-static int run(int argc, char **argv) {
-    int sargc = 0, silent = 0, pos = 0, bc = 0;
-    char **sargv = NULL;
-    JSContext *ctx;
-    JSRuntime *rt = lanyt_jsc_new_rt();
-    if (!rt) {
-        fprintf(stderr, "create runtime failed\n");
-        return 1;
-    }
-    lanyt_js *ljs = lanyt_new_js(rt);
+enum {
+    OPTION_BENCH_WARMUP,
+    OPTION_BENCH_ITERATIONS,
+    OPTION_BENCH_TIME,
+    OPTION_BENCH_JSON,
+    OPTION_BENCH_COUNT,
+};
+
+static const char *option_bench_str[] = {
+    "--warmup", "--iterations", "--time", "--json",
+    "-W",       "-n",           "-t",     "-J",
+};
+
+typedef struct {
+    int bc;
+    int map;
+    int silent;
+    const char *cache_dir;
+    int rt_flags;
+    int intrinsics;
+    int sargc;
+    char **sargv;
+    atomic_int failed;
+} batch_opts;
+
+static int run_one(JSRuntime *rt, const char *path, batch_opts *o) {
+    int span = ljs_trace_begin("new_context", path);
+    lanyt_js *ljs = lanyt_new_js2(rt, o->intrinsics);
+    int r = -1;
+    ljs_trace_end(span);
     if (!ljs) {
         fprintf(stderr, "create js context failed\n");
-        return 1;
+        return -1;
     }
-    ctx = lanyt_js_get_ctx(ljs);
+    if (o->cache_dir && lanyt_js_set_cache_dir(ljs, o->cache_dir))
+        goto done;
+    span = ljs_trace_begin("std_helpers", NULL);
+    js_std_add_helpers(lanyt_js_get_ctx(ljs), o->sargc, o->sargv);
+    ljs_trace_end(span);
+    if (o->map)
+        r = lanyt_js_map(ljs, path, NULL);
+    else if (o->bc)
+        r = lanyt_js_read(ljs, path, NULL);
+    else
+        r = lanyt_js_eval(ljs, path);
+    if (r == 0)
+        r = lanyt_js_run(ljs, o->silent);
+    if (o->rt_flags & LANYT_RT_MEM_STATS)
+        lanyt_jsc_mem_report(rt, stderr);
+done:
+    span = ljs_trace_begin("free_context", NULL);
+    lanyt_free_js(ljs);
+    ljs_trace_end(span);
+    return r;
+}
+
+static JSRuntime *new_rt(int flags) {
+    int span = ljs_trace_begin("new_runtime", NULL);
+    JSRuntime *rt = lanyt_jsc_new_rt2(flags);
+    ljs_trace_end(span);
+    if (!rt)
+        fprintf(stderr, "create runtime failed\n");
+    return rt;
+}
+
+static void free_rt(JSRuntime *rt) {
+    int span = ljs_trace_begin("free_runtime", NULL);
+    lanyt_jsc_free_rt(rt);
+    ljs_trace_end(span);
+}
+
+/* An empty value or "1" prints the per-phase table on stderr; anything
+ * else names the file that gets the Chrome trace-event JSON. */
+static int write_trace(const char *out) {
+    FILE *fp;
+    int r;
+
+    if (!*out || !strcmp(out, "1"))
+        return ljs_trace_write_table(stderr);
+    fp = fopen(out, "w");
+    if (!fp) {
+        fprintf(stderr, "could not open '%s'\n", out);
+        return -1;
+    }
+    r = ljs_trace_write_json(fp);
+    if (fclose(fp))
+        r = -1;
+    return r;
+}
+
+static void *batch_init(void *opaque, int idx) {
+    batch_opts *o = opaque;
+    // the runtime outlives each script, so its contexts are freed normally
+    return new_rt(o->rt_flags & ~LANYT_RT_FAST_FREE);
+}
+
+static void batch_fini(void *opaque, void *state) {
+    if (state)
+        free_rt(state);
+}
+
+/* One job on a worker's runtime: a fresh context per script keeps jobs
+ * isolated, while the runtime, its handlers and its heap are reused. */
+static void batch_run(void *opaque, void *state, void *job) {
+    batch_opts *o = opaque;
+    JSRuntime *rt = state;
+    const char *path = job;
+
+    if (!rt || run_one(rt, path, o)) {
+        atomic_fetch_add(&o->failed, 1);
+        fprintf(stderr, "%s: failed\n", path);
+    }
+    if (rt)
+        JS_RunGC(rt);
+}
+
+static char **read_manifest(const char *filename, int *plen) {
+    char line[4096], **list = NULL;
+    int len = 0, cap = 0;
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp) {
+        fprintf(stderr, "could not open manifest '%s'\n", filename);
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        size_t n = strcspn(line, "\r\n");
+        line[n] = '\0';
+        if (n == 0 || line[0] == '#')
+            continue;
+        if (len >= cap) {
+            int newcap = cap + (cap >> 1) + 16;
+            char **a = mi_realloc(list, sizeof(list[0]) * newcap);
+            if (!a)
+                break;
+            list = a;
+            cap = newcap;
+        }
+        list[len] = mi_strdup(line);
+        if (!list[len])
+            break;
+        ++len;
+    }
+    fclose(fp);
+    *plen = len;
+    return list;
+}
+
+static int run_batch(int workers, char **inputs, int ninputs,
+                     const char *manifest, batch_opts *o) {
+    char **listed = NULL;
+    int nlisted = 0, ret = 0;
+    ljs_pool *pool;
+
+    if (manifest) {
+        listed = read_manifest(manifest, &nlisted);
+        if (!listed && nlisted == 0 && ninputs == 0)
+            return 1;
+    }
+    pool = ljs_pool_new(workers, batch_init, batch_fini, batch_run, o);
+    if (!pool) {
+        fprintf(stderr, "create worker pool failed\n");
+        ret = 1;
+        goto done;
+    }
+    for (int i = 0; i < ninputs; i++) {
+        if (ljs_pool_submit(pool, inputs[i]))
+            atomic_fetch_add(&o->failed, 1);
+    }
+    for (int i = 0; i < nlisted; i++) {
+        if (ljs_pool_submit(pool, listed[i]))
+            atomic_fetch_add(&o->failed, 1);
+    }
+    ljs_pool_free(pool);
+    if (atomic_load(&o->failed))
+        ret = 1;
+done:
+    for (int i = 0; i < nlisted; i++)
+        mi_free(listed[i]);
+    mi_free(listed);
+    return ret;
+}
+
+static int run(int argc, char **argv) {
+    int workers = 0, ninputs = 0;
+    char **inputs;
+    const char *manifest = NULL;
+    const char *preload = getenv("LJS_PRELOAD");
+    const char *prof = NULL;
+    const char *trace = getenv("LJS_TRACE_STARTUP");
+    int prof_hz = 99, watch = 0;
+    batch_opts o = {0};
+    JSRuntime *rt;
+    int ret;
+
+    o.cache_dir = getenv("LJS_CACHE_DIR");
+    o.rt_flags = LANYT_RT_HEAP;
+    o.intrinsics = LANYT_INTRINSIC_ALL;
+    inputs = mi_malloc(sizeof(inputs[0]) * argc);
+    if (!inputs)
+        return 1;
 
     for (size_t i = 2; i < argc; i++) {
         if (!strcmp(argv[i], option_str[OPTION_RUN_BYTECODE]) ||
             !strcmp(argv[i],
                     option_str[OPTION_RUN_BYTECODE + OPTION_RUN_COUNT])) {
-            bc = 1;
+            o.bc = 1;
         } else if (!strcmp(argv[i], option_str[OPTION_RUN_ARGS]) ||
                    !strcmp(argv[i],
                            option_str[OPTION_RUN_ARGS + OPTION_RUN_COUNT])) {
-            sargc = argc - i - 1;
-            sargv = &argv[i + 1];
+            o.sargc = argc - i - 1;
+            o.sargv = &argv[i + 1];
             break;
         } else if (!strcmp(argv[i], option_str[OPTION_RUN_SILENT]) ||
                    !strcmp(argv[i],
                            option_str[OPTION_RUN_SILENT + OPTION_RUN_COUNT])) {
-            silent = 1;
-        } else if (pos == 0) {
-            pos = i;
+            o.silent = 1;
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_MMAP]) ||
+                   !strcmp(argv[i],
+                           option_str[OPTION_RUN_MMAP + OPTION_RUN_COUNT])) {
+            o.bc = 1;
+            o.map = 1;
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_CACHE]) ||
+                   !strcmp(argv[i],
+                           option_str[OPTION_RUN_CACHE + OPTION_RUN_COUNT])) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "cache option need a directory\n");
+                goto fail;
+            }
+            o.cache_dir = argv[++i];
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_WORKERS]) ||
+                   !strcmp(argv[i],
+                           option_str[OPTION_RUN_WORKERS + OPTION_RUN_COUNT])) {
+            if (i + 1 >= argc || (workers = atoi(argv[i + 1])) < 1) {
+                fprintf(stderr, "workers option need a positive number\n");
+                goto fail;
+            }
+            ++i;
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_MANIFEST]) ||
+                   !strcmp(argv[i], option_str[OPTION_RUN_MANIFEST +
+                                               OPTION_RUN_COUNT])) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "manifest option need a file name\n");
+                goto fail;
+            }
+            manifest = argv[++i];
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_PRELOAD]) ||
+                   !strcmp(argv[i],
+                           option_str[OPTION_RUN_PRELOAD + OPTION_RUN_COUNT])) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "preload option need a library list\n");
+                goto fail;
+            }
+            preload = argv[++i];
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_FAST_EXIT]) ||
+                   !strcmp(argv[i], option_str[OPTION_RUN_FAST_EXIT +
+                                               OPTION_RUN_COUNT])) {
+            o.rt_flags |= LANYT_RT_FAST_FREE;
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_MEM_REPORT]) ||
+                   !strcmp(argv[i], option_str[OPTION_RUN_MEM_REPORT +
+                                               OPTION_RUN_COUNT])) {
+            o.rt_flags |= LANYT_RT_MEM_STATS;
+        } else if (!strncmp(argv[i], "--prof=", 7)) {
+            prof = argv[i] + 7;
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_PROF]) ||
+                   !strcmp(argv[i],
+                           option_str[OPTION_RUN_PROF + OPTION_RUN_COUNT])) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "prof option need a file name\n");
+                goto fail;
+            }
+            prof = argv[++i];
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_PROF_HZ]) ||
+                   !strcmp(argv[i], option_str[OPTION_RUN_PROF_HZ +
+                                               OPTION_RUN_COUNT])) {
+            if (i + 1 >= argc || (prof_hz = atoi(argv[i + 1])) < 1) {
+                fprintf(stderr, "prof-hz option need a positive number\n");
+                goto fail;
+            }
+            ++i;
+        } else if (!strncmp(argv[i], "--trace-startup=", 16)) {
+            trace = argv[i] + 16;
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_TRACE]) ||
+                   !strcmp(argv[i],
+                           option_str[OPTION_RUN_TRACE + OPTION_RUN_COUNT])) {
+            trace = "";
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_INTRINSICS]) ||
+                   !strcmp(argv[i], option_str[OPTION_RUN_INTRINSICS +
+                                               OPTION_RUN_COUNT])) {
+            if (i + 1 >= argc ||
+                (o.intrinsics = ljs_intrin_parse(argv[i + 1])) < 0) {
+                fprintf(stderr, "intrinsics option need a profile or a "
+                                "list of intrinsics\n");
+                goto fail;
+            }
+            ++i;
+        } else if (!strcmp(argv[i], option_str[OPTION_RUN_WATCH]) ||
+                   !strcmp(argv[i],
+                           option_str[OPTION_RUN_WATCH + OPTION_RUN_COUNT])) {
+            watch = 1;
         } else {
-            fprintf(stderr, "unknown option: %s\n", argv[i]);
-            return 1;
+            inputs[ninputs++] = argv[i];
         }
     }
-    js_std_add_helpers(ctx, sargc, sargv);
-    if (bc) {
-        if (lanyt_js_read(ljs, argv[pos], NULL))
-            return 1;
-    } else {
-        if (lanyt_js_eval(ljs, argv[pos]))
-            return 1;
+
+    if (trace)
+        ljs_trace_enable();
+    lanyt_jsc_set_worker_intrinsics(o.intrinsics);
+    // native modules are opened once here, before any script imports them
+    if (preload && lanyt_js_preload(preload) < 0)
+        goto fail;
+
+    if (workers > 0 || manifest) {
+        if (prof)
+            fprintf(stderr, "prof option is ignored in batch mode\n");
+        ret = run_batch(workers > 0 ? workers : 1, inputs, ninputs, manifest,
+                        &o);
+        if (trace && write_trace(trace))
+            ret = 1;
+        mi_free(inputs);
+        return ret;
     }
-    if (lanyt_js_run(ljs, silent))
+    if (ninputs > 1) {
+        fprintf(stderr, "unknown option: %s\n", inputs[1]);
+        goto fail;
+    }
+    if (watch) {
+        ljs_watch_opts wo = {o.intrinsics, o.cache_dir, o.silent, o.sargc,
+                             o.sargv};
+        if (o.bc || !ninputs) {
+            fprintf(stderr, "watch option needs a source file\n");
+            goto fail;
+        }
+        // every rerun frees the last context, so no fast teardown here
+        rt = new_rt(o.rt_flags & ~LANYT_RT_FAST_FREE);
+        if (!rt)
+            goto fail;
+        ljs_watch(rt, inputs[0], &wo);
+        free_rt(rt);
+        goto fail;
+    }
+
+    rt = new_rt(o.rt_flags);
+    if (!rt)
+        goto fail;
+    if (prof && lanyt_jsc_prof_start(rt, prof_hz))
+        fprintf(stderr, "could not start the profiler\n");
+    ret = run_one(rt, ninputs ? inputs[0] : argv[0], &o);
+    if (prof && lanyt_jsc_prof_stop(rt, prof))
+        ret = -1;
+    free_rt(rt);
+    if (trace && write_trace(trace))
+        ret = -1;
+    mi_free(inputs);
+    return ret ? 1 : 0;
+fail:
+    mi_free(inputs);
+    return 1;
+}
+
+/* An executable written by `compile --exe` runs the bundle it carries and
+ * hands every argument to the script. */
+static int run_self(int argc, char **argv, const uint8_t *image,
+                    size_t len) {
+    JSRuntime *rt = new_rt(LANYT_RT_HEAP);
+    lanyt_js *ljs;
+    int r = -1;
+
+    if (!rt)
+        return 1;
+    // the toc records which intrinsics the modules reference
+    ljs = lanyt_new_js2(rt, LANYT_INTRINSIC_AUTO);
+    if (!ljs) {
+        fprintf(stderr, "create js context failed\n");
+        free_rt(rt);
         return 1;
+    }
+    js_std_add_helpers(lanyt_js_get_ctx(ljs), argc - 1, argv + 1);
+    if (lanyt_js_read_mem(ljs, image, len, NULL) == 0)
+        r = lanyt_js_run(ljs, 0);
     lanyt_free_js(ljs);
-    lanyt_jsc_free_rt(rt);
-    return 0;
+    free_rt(rt);
+    return r ? 1 : 0;
 }
 
 static int compile(int argc, char **argv) {
-    int debug = 0, pos = 0, o_pos = 0;
-    JSRuntime *rt = lanyt_jsc_new_rt();
+    int flags = 0, pos = 0, o_pos = 0, jobs = 1, full = 0;
+    const char *cache_dir = getenv("LJS_CACHE_DIR"), *output;
+    char *deps = NULL;
+    // nothing runs at teardown, so drop the heap instead of walking it
+    JSRuntime *rt = lanyt_jsc_new_rt2(LANYT_RT_FAST_FREE);
     if (!rt) {
         fprintf(stderr, "create runtime failed\n");
         return 1;
@@ -114,6 +489,42 @@ static int compile(int argc, char **argv) {
             }
             o_pos = i + 1;
             ++i;
+        } else if (!strcmp(argv[i], option_compile_str[OPTION_COMPRESS]) ||
+                   !strcmp(argv[i], option_compile_str[OPTION_COMPRESS +
+                                                       OPTION_COMPILE_COUNT])) {
+            flags |= LANYT_SAVE_COMPRESS;
+        } else if (!strcmp(argv[i], option_compile_str[OPTION_CACHE]) ||
+                   !strcmp(argv[i], option_compile_str[OPTION_CACHE +
+                                                       OPTION_COMPILE_COUNT])) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "cache option need a directory\n");
+                return 1;
+            }
+            cache_dir = argv[++i];
+        } else if (!strcmp(argv[i], option_compile_str[OPTION_JOBS]) ||
+                   !strcmp(argv[i], option_compile_str[OPTION_JOBS +
+                                                       OPTION_COMPILE_COUNT])) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "jobs option need a number\n");
+                return 1;
+            }
+            jobs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], option_compile_str[OPTION_DEBUG]) ||
+                   !strcmp(argv[i], option_compile_str[OPTION_DEBUG +
+                                                       OPTION_COMPILE_COUNT])) {
+            flags |= LANYT_SAVE_DEBUG;
+        } else if (!strcmp(argv[i], option_compile_str[OPTION_EXE]) ||
+                   !strcmp(argv[i], option_compile_str[OPTION_EXE +
+                                                       OPTION_COMPILE_COUNT])) {
+            flags |= LANYT_SAVE_EXE;
+        } else if (!strcmp(argv[i], option_compile_str[OPTION_FULL]) ||
+                   !strcmp(argv[i], option_compile_str[OPTION_FULL +
+                                                       OPTION_COMPILE_COUNT])) {
+            full = 1;
+        } else if (!strcmp(argv[i], option_compile_str[OPTION_ATOMS]) ||
+                   !strcmp(argv[i], option_compile_str[OPTION_ATOMS +
+                                                       OPTION_COMPILE_COUNT])) {
+            flags |= LANYT_SAVE_ATOMS;
         } else if (pos == 0) {
             pos = i;
         } else {
@@ -121,17 +532,258 @@ static int compile(int argc, char **argv) {
             return 1;
         }
     }
-    if (lanyt_js_eval(ljs, argv[pos]))
+    if (cache_dir && lanyt_js_set_cache_dir(ljs, cache_dir))
+        return 1;
+    lanyt_js_set_keep_source(ljs, flags & LANYT_SAVE_DEBUG);
+    output = o_pos ? argv[o_pos]
+                   : ((flags & LANYT_SAVE_EXE) ? "a.out" : "a.pbc");
+    // the last bundle and its .deps spare unchanged modules the parser; an
+    // executable is always written whole
+    if (!(flags & LANYT_SAVE_EXE)) {
+        deps = mi_malloc(strlen(output) + 6);
+        if (!deps)
+            return 1;
+        sprintf(deps, "%s.deps", output);
+        if (lanyt_js_set_base(ljs, full ? NULL : output, full ? NULL : deps,
+                              flags))
+            return 1;
+    }
+    if (lanyt_js_eval_parallel(ljs, argv[pos], jobs))
         return 1;
-    if (o_pos && lanyt_js_save(ljs, argv[o_pos], debug))
+    if (lanyt_js_save2(ljs, output, flags))
         return 1;
-    if (!o_pos && lanyt_js_save(ljs, "a.pbc", debug))
+    if (deps && lanyt_js_save_deps(ljs, output, deps))
         return 1;
+    mi_free(deps);
     lanyt_free_js(ljs);
     lanyt_jsc_free_rt(rt);
     return 0;
 }
 
+typedef struct {
+    int warmup;
+    int iterations; // 0: run for time_ms instead
+    int time_ms;
+    int json;
+} bench_opts;
+
+static int bench_cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static const char *bench_fmt(char *buf, size_t size, double ns) {
+    if (ns < 1e3)
+        snprintf(buf, size, "%.1fns", ns);
+    else if (ns < 1e6)
+        snprintf(buf, size, "%.2fus", ns / 1e3);
+    else if (ns < 1e9)
+        snprintf(buf, size, "%.2fms", ns / 1e6);
+    else
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    return buf;
+}
+
+static int bench_call(JSContext *ctx, JSValueConst fn) {
+    JSContext *c;
+    JSValue r = JS_Call(ctx, fn, JS_UNDEFINED, 0, NULL);
+    int err;
+
+    if (JS_IsException(r))
+        return -1;
+    JS_FreeValue(ctx, r);
+    // an async benchmark settles through its jobs
+    while ((err = JS_ExecutePendingJob(JS_GetRuntime(ctx), &c)) > 0)
+        ;
+    return err;
+}
+
+/* Times one exported function. Calls too short for the clock are
+ * repeated inside a sample, so a sample always spans about 10us and the
+ * reported figures are per call. */
+static int bench_one(JSContext *ctx, const char *name, JSValueConst fn,
+                     bench_opts *o) {
+    uint64_t t0, per = 0, reps = 1, start, budget;
+    double *s = NULL, mean = 0, var = 0;
+    int n = 0, cap = 0;
+    char b0[32], b1[32], b2[32];
+
+    t0 = ljs_clock_ns();
+    for (int i = 0; i < o->warmup; ++i)
+        if (bench_call(ctx, fn))
+            return -1;
+    if (o->warmup)
+        per = (ljs_clock_ns() - t0) / o->warmup;
+    if (per < 10000)
+        reps = 10000 / (per ? per : 1);
+    if (reps > 1000000)
+        reps = 1000000;
+
+    budget = (uint64_t)o->time_ms * 1000000;
+    start = ljs_clock_ns();
+    while (o->iterations ? n < o->iterations
+                         : n < 3 || ljs_clock_ns() - start < budget) {
+        if (n >= cap) {
+            cap = cap ? cap * 2 : 256;
+            double *a = mi_realloc(s, sizeof(s[0]) * cap);
+            if (!a) {
+                mi_free(s);
+                return -1;
+            }
+            s = a;
+        }
+        t0 = ljs_clock_ns();
+        for (uint64_t k = 0; k < reps; ++k) {
+            if (bench_call(ctx, fn)) {
+                mi_free(s);
+                return -1;
+            }
+        }
+        s[n++] = (double)(ljs_clock_ns() - t0) / reps;
+    }
+
+    qsort(s, n, sizeof(s[0]), bench_cmp);
+    for (int i = 0; i < n; ++i)
+        mean += s[i];
+    mean /= n;
+    for (int i = 0; i < n; ++i)
+        var += (s[i] - mean) * (s[i] - mean);
+    var = n > 1 ? var / (n - 1) : 0;
+
+    double median = n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+    double p99 = s[(int)ceil(n * 0.99) - 1];
+
+    if (o->json) {
+        printf("{\"name\":\"");
+        for (const char *c = name; *c; ++c)
+            printf(*c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+        printf("\",\"samples\":%d,\"reps\":%llu,\"median_ns\":%.1f,"
+               "\"p99_ns\":%.1f,\"mean_ns\":%.1f,\"stddev_ns\":%.1f,"
+               "\"min_ns\":%.1f}\n",
+               n, (unsigned long long)reps, median, p99, mean, sqrt(var),
+               s[0]);
+    } else {
+        printf("%-24s %8d x %-6llu median %10s  p99 %10s  stddev %10s\n",
+               name, n, (unsigned long long)reps,
+               bench_fmt(b0, sizeof(b0), median),
+               bench_fmt(b1, sizeof(b1), p99),
+               bench_fmt(b2, sizeof(b2), sqrt(var)));
+    }
+    mi_free(s);
+    return 0;
+}
+
+static int bench(int argc, char **argv) {
+    bench_opts o = {.warmup = 10, .time_ms = 1000};
+    const char *file = NULL;
+    char *path = NULL, *src = NULL;
+    JSRuntime *rt = NULL;
+    lanyt_js *ljs = NULL;
+    JSContext *ctx = NULL;
+    JSValue global = JS_UNDEFINED, ns = JS_UNDEFINED;
+    JSPropertyEnum *tab = NULL;
+    uint32_t len = 0;
+    int ret = 1;
+
+    for (size_t i = 2; i < argc; i++) {
+        int opt = -1;
+        for (int k = 0; k < OPTION_BENCH_COUNT; ++k)
+            if (!strcmp(argv[i], option_bench_str[k]) ||
+                !strcmp(argv[i], option_bench_str[k + OPTION_BENCH_COUNT]))
+                opt = k;
+        if (opt == OPTION_BENCH_JSON) {
+            o.json = 1;
+        } else if (opt >= 0) {
+            int v;
+            if (i + 1 >= argc || (v = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s option need a number\n", argv[i]);
+                return 1;
+            }
+            ++i;
+            if (opt == OPTION_BENCH_WARMUP)
+                o.warmup = v;
+            else if (opt == OPTION_BENCH_ITERATIONS)
+                o.iterations = v;
+            else
+                o.time_ms = v;
+        } else if (!file) {
+            file = argv[i];
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!file) {
+        fprintf(stderr, "bench need a file\n");
+        return 1;
+    }
+
+    /* Import the file from a one-line entry module to reach its exports.
+     * Absolute specifiers are taken as they are by the normalizer. */
+#if defined(_WIN32) || defined(_WIN64)
+    path = _fullpath(NULL, file, 0);
+#else
+    path = realpath(file, NULL);
+#endif
+    if (!path) {
+        perror(file);
+        return 1;
+    }
+    for (char *c = path; *c; ++c)
+        if (*c == '\\')
+            *c = '/';
+    size_t src_len = strlen(path) + 96;
+    src = mi_malloc(src_len);
+    if (!src)
+        goto done;
+    snprintf(src, src_len,
+             "<lanyt>import * as m from \"%s\"; globalThis.__ljs_bench = m;",
+             path);
+
+    rt = lanyt_jsc_new_rt();
+    if (!rt || !(ljs = lanyt_new_js(rt))) {
+        fprintf(stderr, "create runtime failed\n");
+        goto done;
+    }
+    ctx = lanyt_js_get_ctx(ljs);
+    js_std_add_helpers(ctx, 0, NULL);
+    if (lanyt_js_eval(ljs, src) || lanyt_js_run(ljs, 0))
+        goto done;
+
+    global = JS_GetGlobalObject(ctx);
+    ns = JS_GetPropertyStr(ctx, global, "__ljs_bench");
+    if (JS_GetOwnPropertyNames(ctx, &tab, &len, ns,
+                               JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY)) {
+        js_std_dump_error(ctx);
+        goto done;
+    }
+    ret = 0;
+    for (uint32_t i = 0; i < len && !ret; ++i) {
+        JSValue fn = JS_GetProperty(ctx, ns, tab[i].atom);
+        const char *name = JS_AtomToCString(ctx, tab[i].atom);
+        if (name && JS_IsFunction(ctx, fn) && bench_one(ctx, name, fn, &o)) {
+            js_std_dump_error(ctx);
+            ret = 1;
+        }
+        JS_FreeCString(ctx, name);
+        JS_FreeValue(ctx, fn);
+    }
+done:
+    if (ljs) {
+        for (uint32_t i = 0; i < len; ++i)
+            JS_FreeAtom(ctx, tab[i].atom);
+        js_free(ctx, tab);
+        JS_FreeValue(ctx, ns);
+        JS_FreeValue(ctx, global);
+        lanyt_free_js(ljs);
+    }
+    if (rt)
+        lanyt_jsc_free_rt(rt);
+    mi_free(src);
+    free(path);
+    return ret;
+}
+
 static int help(int argc, char **argv) {
     if (argc == 2) {
         printf("Usage: ljs <command> [options]\n");
@@ -141,6 +793,8 @@ static int help(int argc, char **argv) {
         printf("  run, r:           run <file>, run js file\n");
         printf(
             "  compile, c:       compile <file>, compile js file to binary\n");
+        printf("  bench, b:         bench <file>, time the file's exported "
+               "functions\n");
         printf("  help, h:          help [command], print help\n");
         printf("More help use: ljs help [command]\n");
         return 0;
@@ -157,10 +811,70 @@ static int help(int argc, char **argv) {
                            "args for js "
                            "file\n");
                     printf("  --silent, -s:      silent mode\n");
+                    printf("  --mmap, -m:        run bytecode mapped "
+                           "read-only from the file\n");
+                    printf("  --cache, -C:       --cache <dir> reuse compiled "
+                           "modules from dir (or $LJS_CACHE_DIR)\n");
+                    printf("  --workers, -w:     --workers <n> run every given "
+                           "file on a pool of n runtimes\n");
+                    printf("  --manifest, -M:    --manifest <file> also run "
+                           "the files listed one per line\n");
+                    printf("  --preload, -p:     --preload <libs> open native "
+                           "modules before running (or $LJS_PRELOAD)\n");
+                    printf("  --fast-exit, -F:   free the runtime heap at "
+                           "once, skipping finalizers\n");
+                    printf("  --mem-report, -R:  print memory use by size "
+                           "class and module at exit or on SIGUSR1\n");
+                    printf("  --prof, -P:        --prof <file> write sampled "
+                           "JS stacks as folded stacks\n");
+                    printf("  --prof-hz, -H:     --prof-hz <n> samples per "
+                           "second (default 99)\n");
+                    printf("  --trace-startup, -T: time each startup phase, "
+                           "as a table on stderr or, with\n"
+                           "                     --trace-startup=<file>, "
+                           "as Chrome trace JSON (or "
+                           "$LJS_TRACE_STARTUP)\n");
+                    printf("  --intrinsics, -I:  --intrinsics <spec> build "
+                           "contexts with only some intrinsics:\n"
+                           "                     full (default), compute, "
+                           "minimal, auto (what the code\n"
+                           "                     references) or a list like "
+                           "json,mapset,date\n");
+                    printf("  --watch, -W:       run again whenever the file "
+                           "or a module it imports\n"
+                           "                     changes, recompiling only "
+                           "what changed\n");
                     break;
                 case COMMAND_COMPILE:
                     printf("  --output, -o:      --output <file> set output "
                            "file\n");
+                    printf("  --compress, -z:    compress module bytecode\n");
+                    printf("  --jobs, -j:        --jobs <n> compile modules on "
+                           "n threads\n");
+                    printf("  --cache, -C:       --cache <dir> reuse compiled "
+                           "modules from dir (or $LJS_CACHE_DIR)\n");
+                    printf("  --debug, -g:       keep module source in a "
+                           "section read only on errors\n");
+                    printf("  --exe, -x:         write an executable that runs "
+                           "the bundle (default a.out)\n");
+                    printf("  --full, -f:        compile every module, even "
+                           "those unchanged since\n"
+                           "                     the output and its .deps "
+                           "file were written\n");
+                    printf("  --atoms, -a:       share one atom table across "
+                           "modules; smaller, but\n"
+                           "                     modules are copied when "
+                           "loaded\n");
+                    break;
+                case COMMAND_BENCH:
+                    printf("  --warmup, -W:      --warmup <n> untimed calls "
+                           "first (default 10)\n");
+                    printf("  --iterations, -n:  --iterations <n> take n "
+                           "samples\n");
+                    printf("  --time, -t:        --time <ms> sample for ms "
+                           "instead (default 1000)\n");
+                    printf("  --json, -J:        one JSON object per "
+                           "function\n");
                     break;
                 default:
                     break;
@@ -182,6 +896,7 @@ static int version(int argc, char **argv) {
 static const command_func command_func_list[] = {
     run,
     compile,
+    bench,
     help,
     version,
 };
@@ -189,7 +904,12 @@ static const command_func command_func_list[] = {
 int main(int argc, char **argv) {
     int ret = 0;
     lanyt_js_module_init();
-    size_t i;
+    size_t i, self_len;
+    const uint8_t *self = ljs_exe_bundle(&self_len);
+    if (self) {
+        ret = run_self(argc, argv, self, self_len);
+        goto done;
+    }
     for (i = 0; i < COMMAND_COUNT; i++) {
         if (!strcmp(argv[1], command_str[i]) ||
             !strcmp(argv[1], command_str[i + COMMAND_COUNT])) {
@@ -202,6 +922,8 @@ int main(int argc, char **argv) {
         ret = 1;
         help(2, argv);
     }
+done:
     lanyt_js_module_free();
+    ljs_trace_free();
     return ret;
 }
\ No newline at end of file
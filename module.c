@@ -1,6 +1,11 @@
 
 #include "module.h"
+#include "hash.h"
+#include "loop.h"
+#include "resolve.h"
 
+#include <limits.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <string.h>
@@ -13,7 +18,7 @@
 #ifndef MODULE_MAX_NAME
 #define MODULE_MAX_NAME 256
 #endif
-#define cl_load atomic_load_explicit(&cmodule_list, memory_order_acquire)
+#define CALLER_LEVELS 16
 
 static char *concat(const char *s1, const char *s2) {
     char *result = mi_malloc(strlen(s1) + strlen(s2) + 1);
@@ -30,164 +35,498 @@ static bool has_prefix(const char *str, const char *prefix) {
     return strncmp(str, prefix, strlen(prefix)) == 0;
 }
 
+/* Native module registry: an open-addressed hash table that readers probe
+ * without taking a lock. A single writer (under cmodule_lock) appends the
+ * entry first and then publishes its slot with a release store, so a reader
+ * never sees a slot whose entry is incomplete. When the table fills up, the
+ * writer builds a larger generation and swaps the root pointer. The old one
+ * stays alive, because threads may still be probing it, and it is freed with
+ * the registry in lanyt_js_module_free. Generations double, so the retired
+ * memory is bounded by the live table. */
 typedef struct {
     char *name;
-    init_cmodule_fn_t fn;
+    uint64_t hash;
+    _Atomic(init_cmodule_fn_t) fn;
 } cmodule_t;
 
-typedef struct {
+typedef struct cmodule_list_t {
+    struct cmodule_list_t *retired; // previous generation
     cmodule_t *array;
+    _Atomic(int32_t) *table; // index + 1 into array, 0 = empty slot
+    uint32_t mask;
     int cap;
     int len;
 } cmodule_list_t;
 
 _Atomic(cmodule_list_t *) cmodule_list = NULL;
 #define cl_load atomic_load_explicit(&cmodule_list, memory_order_acquire)
+static pthread_mutex_t cmodule_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void cmodule_list_free() {
+static cmodule_t *cmodule_probe(cmodule_list_t *l, const char *name,
+                                uint64_t hash) {
+    for (uint32_t i = hash & l->mask;; i = (i + 1) & l->mask) {
+        int32_t k = atomic_load_explicit(&l->table[i], memory_order_acquire);
+        if (k == 0)
+            return NULL;
+        cmodule_t *e = &l->array[k - 1];
+        if (e->hash == hash && strcmp(e->name, name) == 0)
+            return e;
+    }
+}
 
-    if (cl_load == NULL)
-        return;
-    while (cl_load->len > 0) {
-        cmodule_t *t = &cl_load->array[--cl_load->len];
-        mi_free(t->name);
+static void cmodule_insert(cmodule_list_t *l, int index) {
+    uint32_t i = l->array[index].hash & l->mask;
+    while (atomic_load_explicit(&l->table[i], memory_order_relaxed) != 0)
+        i = (i + 1) & l->mask;
+    atomic_store_explicit(&l->table[i], index + 1, memory_order_release);
+}
+
+static cmodule_list_t *cmodule_grow(cmodule_list_t *old) {
+    int cap = old ? old->cap * 2 : 16;
+    // table at least twice the capacity keeps the load factor under 1/2
+    uint32_t size = 1;
+    while (size < (uint32_t)cap * 2)
+        size <<= 1;
+
+    cmodule_list_t *l = mi_zalloc(sizeof(cmodule_list_t));
+    if (!l)
+        return NULL;
+    l->array = mi_calloc(cap, sizeof(cmodule_t));
+    l->table = mi_calloc(size, sizeof(l->table[0]));
+    if (!l->array || !l->table) {
+        mi_free(l->array);
+        mi_free((void *)l->table);
+        mi_free(l);
+        return NULL;
     }
-    mi_free(cl_load->array);
-    cl_load->array = NULL;
-    cl_load->cap = 0;
+    l->mask = size - 1;
+    l->cap = cap;
+    l->retired = old;
+
+    // names are shared with the older generations and owned by the newest
+    for (int i = 0; old && i < old->len; ++i) {
+        l->array[i].name = old->array[i].name;
+        l->array[i].hash = old->array[i].hash;
+        atomic_init(&l->array[i].fn, atomic_load_explicit(
+                                         &old->array[i].fn,
+                                         memory_order_relaxed));
+        cmodule_insert(l, i);
+    }
+    l->len = old ? old->len : 0;
+    return l;
+}
 
-    mi_free(cl_load);
+void cmodule_list_free() {
+    cmodule_list_t *l = cl_load;
+
+    if (l == NULL)
+        return;
     atomic_store_explicit(&cmodule_list, NULL, memory_order_release);
+    for (int i = 0; i < l->len; ++i)
+        mi_free(l->array[i].name);
+    while (l) {
+        cmodule_list_t *next = l->retired;
+        mi_free(l->array);
+        mi_free((void *)l->table);
+        mi_free(l);
+        l = next;
+    }
 }
 
 int cmodule_list_add(const char *name, init_cmodule_fn_t fn) {
+    uint64_t hash = ljs_hash_str(name);
+    int ret = 0;
 
-    if (!cl_load) {
-        atomic_store_explicit(&cmodule_list, mi_malloc(sizeof(cmodule_list_t)),
-                              memory_order_release);
-        cl_load->array = NULL;
-        cl_load->cap = 0;
-        cl_load->len = 0;
-    }
+    pthread_mutex_lock(&cmodule_lock);
+    cmodule_list_t *l = cl_load;
+    cmodule_t *e = l ? cmodule_probe(l, name, hash) : NULL;
 
-    if (cl_load->len >= cl_load->cap) {
-        size_t newcap = cl_load->cap + (cl_load->cap >> 1) + 4;
-        cmodule_t *a =
-            mi_realloc(cl_load->array, sizeof(cl_load->array[0]) * newcap);
+    if (e) {
+        // re-registering a name replaces its init function
+        atomic_store_explicit(&e->fn, fn, memory_order_release);
+        goto done;
+    }
 
-        if (!a)
-            return -1;
+    if (!l || l->len >= l->cap) {
+        cmodule_list_t *n = cmodule_grow(l);
+        if (!n) {
+            ret = -1;
+            goto done;
+        }
+        atomic_store_explicit(&cmodule_list, n, memory_order_release);
+        l = n;
+    }
 
-        cl_load->array = a;
-        cl_load->cap = newcap;
+    e = &l->array[l->len];
+    e->name = mi_strdup(name);
+    if (!e->name) {
+        ret = -1;
+        goto done;
     }
+    e->hash = hash;
+    atomic_init(&e->fn, fn);
+    cmodule_insert(l, l->len);
+    ++l->len;
+done:
+    pthread_mutex_unlock(&cmodule_lock);
+    return ret;
+}
 
-    cl_load->array[cl_load->len].name = mi_strdup(name);
-    cl_load->array[cl_load->len].fn = fn;
-    ++cl_load->len;
+int cmodule_list_find(const char *name, init_cmodule_fn_t *fn) {
+    cmodule_list_t *l = cl_load;
+    cmodule_t *e;
 
+    if (l == NULL)
+        return -2;
+
+    e = cmodule_probe(l, name, ljs_hash_str(name));
+    if (!e)
+        return -1;
+
+    *fn = atomic_load_explicit(&e->fn, memory_order_acquire);
     return 0;
 }
 
-int cmodule_list_find(const char *name, init_cmodule_fn_t *fn) {
-    bool i = false;
-    if (cl_load == NULL)
-        return -2;
+static pthread_mutex_t builtin_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    for (int i = 0; i < cl_load->len; ++i) {
-        if (strcmp(name, cl_load->array[i].name) == 0) {
-            *fn = cl_load->array[i].fn;
-            i = true;
+static int builtin_stub_init(JSContext *ctx, JSModuleDef *m) { return 0; }
+
+static JSModuleDef *builtin_stub_loader(JSContext *ctx,
+                                        const char *module_name,
+                                        void *opaque) {
+    return JS_NewCModule(ctx, module_name, builtin_stub_init);
+}
+
+// compiled in a scratch runtime, so that contexts built without eval can
+// still load it; imports are only named, never linked, there
+static void builtin_compile(lanyt_js_builtin *b, const char *module_name) {
+    JSRuntime *rt = JS_NewRuntime();
+    JSContext *ctx = rt ? JS_NewContext(rt) : NULL;
+    JSValue obj;
+    uint8_t *buf;
+    size_t len;
+
+    if (!ctx)
+        goto done;
+    JS_SetModuleLoaderFunc(rt, NULL, builtin_stub_loader, NULL);
+    obj = JS_Eval(ctx, b->source, strlen(b->source), module_name,
+                  JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+    if (JS_IsException(obj)) {
+        js_std_dump_error(ctx);
+        goto done;
+    }
+    buf = JS_WriteObject(ctx, &len, obj, JS_WRITE_OBJ_BYTECODE);
+    JS_FreeValue(ctx, obj);
+    if (buf) {
+        b->bytecode = mi_malloc(len);
+        if (b->bytecode) {
+            memcpy(b->bytecode, buf, len);
+            b->len = len;
         }
+        js_free(ctx, buf);
     }
+done:
+    if (ctx)
+        JS_FreeContext(ctx);
+    if (rt)
+        JS_FreeRuntime(rt);
+}
 
-    if (i)
-        return 0;
+JSModuleDef *lanyt_js_load_builtin(JSContext *ctx, const char *module_name,
+                                   lanyt_js_builtin *b) {
+    JSValue obj;
+    JSModuleDef *m;
 
-    return -1;
+    pthread_mutex_lock(&builtin_lock);
+    if (!b->bytecode)
+        builtin_compile(b, module_name);
+    pthread_mutex_unlock(&builtin_lock);
+    if (!b->bytecode) {
+        JS_ThrowInternalError(ctx, "could not build module '%s'",
+                              module_name);
+        return NULL;
+    }
+    obj = JS_ReadObject(ctx, b->bytecode, b->len, JS_READ_OBJ_BYTECODE);
+    if (JS_IsException(obj))
+        return NULL;
+    /* the module is already referenced, so we must free it */
+    m = JS_VALUE_GET_PTR(obj);
+    JS_FreeValue(ctx, obj);
+    return m;
 }
 
 #if defined(_WIN32) || defined(_WIN64)
 #include <windows.h>
 #define LIB_T HMODULE
+#define PATH_LIST_SEP ';'
 #else
 #include <dlfcn.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #define LIB_T void *
+#define PATH_LIST_SEP ':'
 #endif
 
+/* Shared library cache. Each library is opened once and keyed by its
+ * canonical path. The spelling an importer used is recorded as an alias,
+ * so a repeated import costs one hash probe and no syscalls. Two paths
+ * that reach the same file (symlinks, hard links) are merged by device and
+ * inode. dlopen serializes internally anyway, so the cache takes a plain
+ * mutex. */
 typedef struct {
-    char *filename;
+    char *path; // canonical path
+    uint64_t dev;
+    uint64_t ino; // 0 when the file could not be identified
     LIB_T lib;
+    int refs;
+    char *fn_name; // last symbol resolved in lib
+    init_cmodule_fn_t fn;
 } lib_t;
 
+typedef struct alias_t {
+    struct alias_t *next;
+    uint64_t hash;
+    char *name;
+    lib_t *lib;
+} alias_t;
+
 typedef struct {
-    lib_t *array;
+    alias_t **buckets;
+    uint32_t mask;
+    int count; // aliases
+    lib_t **array;
     int cap;
     int len;
 } lib_list_t;
 
-static _Atomic(lib_list_t *) list = NULL;
-#define l_load atomic_load_explicit(&list, memory_order_acquire)
-
-static void dll_list_free() {
+static lib_list_t dll_cache;
+static pthread_mutex_t dll_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    if (l_load == NULL)
-        return;
-    while (l_load->len > 0) {
-        lib_t *t = &l_load->array[--l_load->len];
-        mi_free(t->filename);
+static void dll_close(LIB_T lib) {
 #if defined(_WIN32) || defined(_WIN64)
-        if (t->lib)
-            FreeLibrary(t->lib);
+    if (lib)
+        FreeLibrary(lib);
 #else
-        if (t->lib)
-            dlclose(t->lib);
+    if (lib)
+        dlclose(lib);
 #endif
-    }
-    mi_free(l_load->array);
-    l_load->array = NULL;
-    l_load->cap = 0;
+}
 
-    mi_free(l_load);
-    atomic_store_explicit(&list, NULL, memory_order_release);
+static void dll_lib_free(lib_t *t) {
+    dll_close(t->lib);
+    mi_free(t->path);
+    mi_free(t->fn_name);
+    mi_free(t);
 }
 
-static int dll_list_add(const char *filename, LIB_T lib) {
-    if (!l_load) {
-        atomic_store_explicit(&list, mi_malloc(sizeof(lib_list_t)),
-                              memory_order_release);
-        l_load->array = NULL;
-        l_load->cap = 0;
-        l_load->len = 0;
+static void dll_list_free() {
+    pthread_mutex_lock(&dll_lock);
+    for (uint32_t i = 0; dll_cache.buckets && i <= dll_cache.mask; ++i) {
+        alias_t *a = dll_cache.buckets[i];
+        while (a) {
+            alias_t *next = a->next;
+            mi_free(a->name);
+            mi_free(a);
+            a = next;
+        }
     }
+    while (dll_cache.len > 0)
+        dll_lib_free(dll_cache.array[--dll_cache.len]);
+    mi_free(dll_cache.buckets);
+    mi_free(dll_cache.array);
+    memset(&dll_cache, 0, sizeof(dll_cache));
+    pthread_mutex_unlock(&dll_lock);
+}
+
+static lib_t *dll_alias_find(const char *name, uint64_t hash) {
+    if (!dll_cache.buckets)
+        return NULL;
+    for (alias_t *a = dll_cache.buckets[hash & dll_cache.mask]; a; a = a->next)
+        if (a->hash == hash && strcmp(a->name, name) == 0)
+            return a->lib;
+    return NULL;
+}
+
+static int dll_alias_add(const char *name, lib_t *lib) {
+    uint64_t hash = ljs_hash_str(name);
+    alias_t *a;
 
-    if (l_load->len >= l_load->cap) {
-        size_t newcap = l_load->cap + (l_load->cap >> 1) + 4;
-        lib_t *a = (lib_t *)mi_realloc(l_load->array,
-                                       sizeof(l_load->array[0]) * newcap);
-        if (!a)
+    if (dll_alias_find(name, hash))
+        return 0;
+
+    if (!dll_cache.buckets ||
+        dll_cache.count >= (int)(dll_cache.mask + 1)) {
+        uint32_t size = dll_cache.buckets ? (dll_cache.mask + 1) * 2 : 16;
+        alias_t **b = mi_calloc(size, sizeof(b[0]));
+        if (!b)
             return -1;
-        l_load->array = a;
-        l_load->cap = newcap;
+        for (uint32_t i = 0; dll_cache.buckets && i <= dll_cache.mask; ++i) {
+            while ((a = dll_cache.buckets[i])) {
+                dll_cache.buckets[i] = a->next;
+                a->next = b[a->hash & (size - 1)];
+                b[a->hash & (size - 1)] = a;
+            }
+        }
+        mi_free(dll_cache.buckets);
+        dll_cache.buckets = b;
+        dll_cache.mask = size - 1;
     }
 
-    l_load->array[l_load->len].filename = mi_strdup(filename);
-    if (!l_load->array[l_load->len].filename)
+    a = mi_malloc(sizeof(alias_t));
+    if (!a)
         return -1;
-    l_load->array[l_load->len].lib = lib;
-    ++l_load->len;
-
+    a->name = mi_strdup(name);
+    if (!a->name) {
+        mi_free(a);
+        return -1;
+    }
+    a->hash = hash;
+    a->lib = lib;
+    a->next = dll_cache.buckets[hash & dll_cache.mask];
+    dll_cache.buckets[hash & dll_cache.mask] = a;
+    ++dll_cache.count;
     return 0;
 }
 
-static LIB_T search_dll_list(const char *filename) {
-    if (!l_load)
+// drops every alias of lib and lib itself from the cache, without closing it
+static void dll_remove(lib_t *lib) {
+    for (uint32_t i = 0; dll_cache.buckets && i <= dll_cache.mask; ++i) {
+        for (alias_t **p = &dll_cache.buckets[i]; *p;) {
+            alias_t *a = *p;
+            if (a->lib == lib) {
+                *p = a->next;
+                mi_free(a->name);
+                mi_free(a);
+                --dll_cache.count;
+            } else {
+                p = &a->next;
+            }
+        }
+    }
+    for (int i = 0; i < dll_cache.len; ++i) {
+        if (dll_cache.array[i] == lib) {
+            dll_cache.array[i] = dll_cache.array[--dll_cache.len];
+            break;
+        }
+    }
+}
+
+/* Canonical path and file identity of filename. A name that does not
+ * exist as given (a bare soname left to the loader's search path) keeps its
+ * spelling and gets no identity. */
+static char *dll_canonical(const char *filename, uint64_t *dev,
+                           uint64_t *ino) {
+    *dev = *ino = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    char buf[MAX_PATH];
+    DWORD n = GetFullPathNameA(filename, MAX_PATH, buf, NULL);
+    if (n == 0 || n >= MAX_PATH)
+        return mi_strdup(filename);
+    HANDLE h = CreateFileA(buf, 0,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE |
+                               FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS,
+                           NULL);
+    if (h != INVALID_HANDLE_VALUE) {
+        BY_HANDLE_FILE_INFORMATION fi;
+        if (GetFileInformationByHandle(h, &fi)) {
+            *dev = fi.dwVolumeSerialNumber;
+            *ino = ((uint64_t)fi.nFileIndexHigh << 32) | fi.nFileIndexLow;
+        }
+        CloseHandle(h);
+    }
+    return mi_strdup(buf);
+#else
+    struct stat st;
+    char *path;
+    char *real = realpath(filename, NULL);
+    if (!real)
+        return mi_strdup(filename);
+    path = mi_strdup(real);
+    if (path && stat(real, &st) == 0) {
+        *dev = st.st_dev;
+        *ino = st.st_ino;
+    }
+    free(real);
+    return path;
+#endif
+}
+
+// called with dll_lock held
+static lib_t *dll_open(const char *filename, char **error) {
+    uint64_t dev, ino;
+    size_t pos;
+    lib_t *t = dll_alias_find(filename, ljs_hash_str(filename));
+
+    if (t)
+        return t;
+
+    char *path = dll_canonical(filename, &dev, &ino);
+    if (!path)
+        goto oom;
+
+    t = dll_alias_find(path, ljs_hash_str(path));
+    for (int i = 0; !t && ino && i < dll_cache.len; ++i) {
+        if (dll_cache.array[i]->dev == dev && dll_cache.array[i]->ino == ino)
+            t = dll_cache.array[i];
+    }
+    if (t) {
+        if (dll_alias_add(filename, t) || dll_alias_add(path, t)) {
+            mi_free(path);
+            goto oom;
+        }
+        mi_free(path);
+        return t;
+    }
+
+    t = mi_zalloc(sizeof(lib_t));
+    if (!t) {
+        mi_free(path);
+        goto oom;
+    }
+    t->path = path;
+    t->dev = dev;
+    t->ino = ino;
+#if defined(_WIN32) || defined(_WIN64)
+    t->lib = LoadLibrary(path);
+    if (!t->lib) {
+        *error = mi_malloc(256);
+        snprintf(*error, 256, "LoadLibrary error: %s", filename);
+        dll_lib_free(t);
+        return NULL;
+    }
+#else
+    t->lib = dlopen(path, RTLD_LAZY);
+    if (!t->lib) {
+        *error = mi_malloc(256);
+        pos = snprintf(*error, 256, "dlopen error: %s", filename);
+        snprintf(*error + pos, 256 - pos, "\n  dlerror: %s", dlerror());
+        dll_lib_free(t);
         return NULL;
-    for (int i = 0; i < l_load->len; ++i) {
-        if (l_load->array[i].filename == filename) {
-            return l_load->array[i].lib;
+    }
+#endif
+
+    if (dll_cache.len >= dll_cache.cap) {
+        int newcap = dll_cache.cap + (dll_cache.cap >> 1) + 4;
+        lib_t **a =
+            mi_realloc(dll_cache.array, sizeof(dll_cache.array[0]) * newcap);
+        if (!a) {
+            dll_lib_free(t);
+            goto oom;
         }
+        dll_cache.array = a;
+        dll_cache.cap = newcap;
+    }
+    dll_cache.array[dll_cache.len++] = t;
+    if (dll_alias_add(path, t) || dll_alias_add(filename, t)) {
+        dll_remove(t);
+        dll_lib_free(t);
+        goto oom;
     }
+    return t;
+oom:
+    *error = mi_malloc(256);
+    snprintf(*error, 256, "dll_list: memory can't apply");
     return NULL;
 }
 
@@ -196,13 +535,17 @@ init_cmodule_fn_t load_dynamic(const char *filename, const char *fn_name,
     size_t pos = 0;
     char *error = NULL;
     init_cmodule_fn_t func = NULL;
-    LIB_T lib = search_dll_list(filename);
 
+    pthread_mutex_lock(&dll_lock);
+    lib_t *t = dll_open(filename, &error);
+    if (!t)
+        goto fail;
+
+    if (t->fn_name && strcmp(t->fn_name, fn_name) == 0) {
+        func = t->fn;
+    } else {
 #if defined(_WIN32) || defined(_WIN64)
-    if (!lib)
-        lib = LoadLibrary(filename);
-    if (lib) {
-        func = (init_cmodule_fn_t)GetProcAddress(lib, fn_name);
+        func = (init_cmodule_fn_t)GetProcAddress(t->lib, fn_name);
         if (func == NULL) {
             error = mi_malloc(256);
             pos = snprintf(error, 256, "GetProcAddress error: %s", fn_name);
@@ -210,38 +553,30 @@ init_cmodule_fn_t load_dynamic(const char *filename, const char *fn_name,
                      GetLastError());
             goto fail;
         }
-    } else {
-        error = mi_malloc(256);
-        snprintf(error, 256, "LoadLibrary error: %s", filename);
-        goto fail;
-    }
 #else
-    if (!lib)
-        lib = dlopen(filename, RTLD_LAZY);
-    if (lib) {
-        func = (init_cmodule_fn_t)dlsym(lib, fn_name);
+        func = (init_cmodule_fn_t)dlsym(t->lib, fn_name);
         if (func == NULL) {
             error = mi_malloc(256);
             pos = snprintf(error, 256, "dlsym error: %s", fn_name);
             snprintf(error + pos, 256 - pos, "\n  dlerror: %s", dlerror());
             goto fail;
         }
-    } else {
-        error = mi_malloc(256);
-        pos = snprintf(error, 256, "dlopen error: %s", filename);
-        snprintf(error + pos, 256 - pos, "\n  dlerror: %s", dlerror());
-        goto fail;
-    }
-
 #endif
-
-    if (dll_list_add(filename, lib) != 0) {
-        error = mi_malloc(256);
-        snprintf(error, 256, "dll_list: memory can't apply");
-        goto fail;
+        mi_free(t->fn_name);
+        t->fn_name = mi_strdup(fn_name);
+        t->fn = func;
     }
+
+    ++t->refs;
+    pthread_mutex_unlock(&dll_lock);
     return func;
 fail:
+    // a library that never handed out a symbol is not worth keeping open
+    if (t && t->refs == 0) {
+        dll_remove(t);
+        dll_lib_free(t);
+    }
+    pthread_mutex_unlock(&dll_lock);
     if (error_msg) {
         *error_msg = error;
     } else {
@@ -250,22 +585,80 @@ fail:
     return NULL;
 }
 
-static const JSCFunctionListEntry js_ffi_funcs[] = {
-    JS_PROP_STRING_DEF("p_suffix", p_suffix, JS_PROP_ENUMERABLE),
-};
+void *lanyt_js_dll_open(const char *filename, char **error_msg) {
+    char *error = NULL;
+
+    pthread_mutex_lock(&dll_lock);
+    lib_t *t = dll_open(filename, &error);
+    if (t)
+        ++t->refs;
+    pthread_mutex_unlock(&dll_lock);
+    if (error_msg) {
+        *error_msg = error;
+    } else {
+        mi_free(error);
+    }
+    return t;
+}
+
+void *lanyt_js_dll_sym(void *handle, const char *name) {
+    lib_t *t = handle;
+#if defined(_WIN32) || defined(_WIN64)
+    return (void *)GetProcAddress(t->lib, name);
+#else
+    return dlsym(t->lib, name);
+#endif
+}
 
-static int js_ffi_init(JSContext *ctx, JSModuleDef *m) {
-    return JS_SetModuleExportList(ctx, m, js_ffi_funcs, countof(js_ffi_funcs));
+int lanyt_js_dll_release(const char *filename) {
+    uint64_t dev, ino;
+    int ret = -1;
+
+    pthread_mutex_lock(&dll_lock);
+    lib_t *t = dll_alias_find(filename, ljs_hash_str(filename));
+    if (!t) {
+        char *path = dll_canonical(filename, &dev, &ino);
+        if (path)
+            t = dll_alias_find(path, ljs_hash_str(path));
+        mi_free(path);
+    }
+    if (t && t->refs > 0) {
+        ret = --t->refs;
+        if (ret == 0) {
+            dll_remove(t);
+            dll_lib_free(t);
+        }
+    }
+    pthread_mutex_unlock(&dll_lock);
+    return ret;
 }
 
-static JSModuleDef *js_ffi_init_module(JSContext *ctx,
-                                       const char *module_name) {
-    JSModuleDef *m;
-    m = JS_NewCModule(ctx, module_name, js_ffi_init);
-    if (!m)
-        return NULL;
-    JS_AddModuleExportList(ctx, m, js_ffi_funcs, countof(js_ffi_funcs));
-    return m;
+int lanyt_js_preload(const char *list) {
+    char path[PATH_MAX];
+    char *error = NULL;
+    int count = 0;
+
+    while (list && *list) {
+        const char *end = strchr(list, PATH_LIST_SEP);
+        size_t len = end ? (size_t)(end - list) : strlen(list);
+
+        if (len >= sizeof(path)) {
+            fprintf(stderr, "preload: path too long: %.*s\n", (int)len, list);
+            return -1;
+        }
+        if (len > 0) {
+            memcpy(path, list, len);
+            path[len] = '\0';
+            if (!load_dynamic(path, "js_init_module", &error)) {
+                fprintf(stderr, "preload: %s\n", error);
+                mi_free(error);
+                return -1;
+            }
+            ++count;
+        }
+        list = end ? end + 1 : NULL;
+    }
+    return count;
 }
 
 JSModuleDef *lanyt_js_init_module(JSContext *ctx, const char *module_name) {
@@ -279,9 +672,19 @@ JSModuleDef *lanyt_js_init_module(JSContext *ctx, const char *module_name) {
     if (!strcmp(module_name, "std")) {
         return js_init_module_std(ctx, module_name);
     }
+#if defined(__linux__)
+    // os runs on ljs's event loop, built over libc's module
+    if (!strcmp(module_name, "os")) {
+        return ljs_loop_init_module_os(ctx, module_name);
+    }
+    if (!strcmp(module_name, "lanyt:os_libc")) {
+        return js_init_module_os(ctx, module_name);
+    }
+#else
     if (!strcmp(module_name, "os")) {
         return js_init_module_os(ctx, module_name);
     }
+#endif
 
     if (has_suffix(module_name, p_suffix)) {
         int _module_len = strlen(module_name) - strlen(p_suffix);
@@ -318,8 +721,57 @@ JSModuleDef *lanyt_js_init_module(JSContext *ctx, const char *module_name) {
     return NULL;
 }
 
+int lanyt_js_is_native_module(const char *module_name) {
+    init_cmodule_fn_t fn;
+    return !strcmp(module_name, "std") || !strcmp(module_name, "os") ||
+           !strcmp(module_name, "lanyt:os_libc") ||
+           has_suffix(module_name, p_suffix) ||
+           cmodule_list_find(module_name, &fn) == 0;
+}
+
+JSValue lanyt_js_caller_path(JSContext *ctx, JSValueConst spec) {
+    const char *s, *base;
+    JSValue ret = JS_UNDEFINED;
+    char *name;
+
+    s = JS_ToCString(ctx, spec);
+    if (!s)
+        return JS_EXCEPTION;
+    // level 0 is the native function asking
+    for (int level = 1; level < CALLER_LEVELS; level++) {
+        JSAtom atom = JS_GetScriptOrModuleName(ctx, level);
+        if (atom == JS_ATOM_NULL)
+            continue;
+        base = JS_AtomToCString(ctx, atom);
+        JS_FreeAtom(ctx, atom);
+        if (!base) {
+            ret = JS_EXCEPTION;
+            break;
+        }
+        if (!lanyt_js_is_native_module(base)) {
+            name = ljs_resolve_name(base, s);
+            ret = name ? JS_NewString(ctx, name) : JS_ThrowOutOfMemory(ctx);
+            mi_free(name);
+            JS_FreeCString(ctx, base);
+            break;
+        }
+        JS_FreeCString(ctx, base);
+    }
+    if (JS_IsUndefined(ret))
+        ret = JS_DupValue(ctx, spec);
+    JS_FreeCString(ctx, s);
+    return ret;
+}
+
 void lanyt_js_module_init() {
-    cmodule_list_add("lanyt:ffi", js_ffi_init_module);
+    cmodule_list_add("lanyt:ffi", lanyt_js_init_module_ffi);
+    cmodule_list_add("lanyt:fs", lanyt_js_init_module_fs);
+    cmodule_list_add("lanyt:worker", lanyt_js_init_module_worker);
+    cmodule_list_add("lanyt:worker_core", lanyt_js_init_module_worker_core);
+    cmodule_list_add("lanyt:worker_boot", lanyt_js_init_module_worker_boot);
+#if defined(__linux__)
+    cmodule_list_add("lanyt:loop", ljs_loop_init_module);
+#endif
 }
 void lanyt_js_module_free() {
     cmodule_list_free();
@@ -17,11 +17,24 @@ void lanyt_js_module_init();
 void lanyt_js_module_free();
 
 JSModuleDef *lanyt_js_init_module(JSContext *ctx, const char *module_name);
+// true if lanyt_js_init_module serves the name, without loading anything
+int lanyt_js_is_native_module(const char *module_name);
+// spec resolved against the innermost calling module that is not native,
+// as a script a builtin hands on is named by the code that called it
+JSValue lanyt_js_caller_path(JSContext *ctx, JSValueConst spec);
 // cmodule
 typedef JSModuleDef *(*init_cmodule_fn_t)(JSContext *ctx,
                                           const char *module_name);
 int cmodule_list_add(const char *name, init_cmodule_fn_t fn);
 int cmodule_list_find(const char *name, init_cmodule_fn_t *fn);
+// a module written in JS and built into ljs
+typedef struct {
+    const char *source;
+    uint8_t *bytecode; // compiled on first use, kept for the process
+    size_t len;
+} lanyt_js_builtin;
+JSModuleDef *lanyt_js_load_builtin(JSContext *ctx, const char *module_name,
+                                   lanyt_js_builtin *b);
 
 // cmd
 // typedef int (*init_cmd_fn_t)(JSRuntime *rt, int argc, char **argv);
@@ -31,6 +44,28 @@ int cmodule_list_find(const char *name, init_cmodule_fn_t *fn);
 // ffi
 init_cmodule_fn_t load_dynamic(const char *filename, const char *fn_name,
                                char **error_msg);
+// drops a reference taken by load_dynamic; returns the references left,
+// unloading the library at zero, or -1 if filename is not loaded
+int lanyt_js_dll_release(const char *filename);
+// opens each library of a path list (':' separated, ';' on Windows) and
+// resolves its js_init_module; returns the count loaded or -1
+int lanyt_js_preload(const char *list);
+// opens filename through the same cache and takes a reference; the handle
+// stays valid until lanyt_js_dll_release(filename) drops it
+void *lanyt_js_dll_open(const char *filename, char **error_msg);
+void *lanyt_js_dll_sym(void *handle, const char *name);
+// the lanyt:ffi module
+JSModuleDef *lanyt_js_init_module_ffi(JSContext *ctx, const char *module_name);
+// the lanyt:fs module
+JSModuleDef *lanyt_js_init_module_fs(JSContext *ctx, const char *module_name);
+// the lanyt:worker module, and the native part it is built on
+JSModuleDef *lanyt_js_init_module_worker(JSContext *ctx,
+                                         const char *module_name);
+JSModuleDef *lanyt_js_init_module_worker_core(JSContext *ctx,
+                                              const char *module_name);
+// what a Pool worker runs first, see worker.c
+JSModuleDef *lanyt_js_init_module_worker_boot(JSContext *ctx,
+                                              const char *module_name);
 
 // plugin
 // typedef struct plugin plugin_t;
@@ -0,0 +1,221 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <mimalloc.h>
+
+typedef struct {
+    pthread_mutex_t lock;
+    void **jobs; // ring buffer
+    int head;
+    int len;
+    int cap;
+} deque;
+
+typedef struct {
+    ljs_pool *pool;
+    int idx;
+} worker_arg;
+
+struct ljs_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;      // a job was queued, or stop was set
+    pthread_cond_t done_cond; // pending dropped to zero
+    atomic_int queued;        // jobs sitting in deques
+    int pending;              // jobs submitted and not finished
+    int stop;
+    int workers;
+    int started;
+    int slots; // deques set up, workers may have been cut back since
+    unsigned next; // round-robin submit target
+    deque *deques;
+    pthread_t *threads;
+    worker_arg *args;
+    ljs_pool_init_fn init;
+    ljs_pool_fini_fn fini;
+    ljs_pool_run_fn run;
+    void *opaque;
+};
+
+static int deque_push(deque *d, void *job) {
+    pthread_mutex_lock(&d->lock);
+    if (d->len >= d->cap) {
+        int newcap = d->cap + (d->cap >> 1) + 8;
+        void **a = mi_malloc(sizeof(a[0]) * newcap);
+        if (!a) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (int i = 0; i < d->len; i++)
+            a[i] = d->jobs[(d->head + i) % d->cap];
+        mi_free(d->jobs);
+        d->jobs = a;
+        d->head = 0;
+        d->cap = newcap;
+    }
+    d->jobs[(d->head + d->len) % d->cap] = job;
+    ++d->len;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// the owner takes from the front, thieves from the back
+static void *deque_pop(deque *d, int steal) {
+    void *job = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->len > 0) {
+        if (steal) {
+            job = d->jobs[(d->head + d->len - 1) % d->cap];
+        } else {
+            job = d->jobs[d->head];
+            d->head = (d->head + 1) % d->cap;
+        }
+        --d->len;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return job;
+}
+
+static void *take_job(ljs_pool *p, int idx) {
+    void *job = deque_pop(&p->deques[idx], 0);
+    for (int i = 1; !job && i < p->workers; i++)
+        job = deque_pop(&p->deques[(idx + i) % p->workers], 1);
+    if (job)
+        atomic_fetch_sub(&p->queued, 1);
+    return job;
+}
+
+static void *worker_main(void *opaque) {
+    worker_arg *arg = opaque;
+    ljs_pool *p = arg->pool;
+    void *state = p->init ? p->init(p->opaque, arg->idx) : NULL;
+
+    for (;;) {
+        void *job = take_job(p, arg->idx);
+        if (job) {
+            p->run(p->opaque, state, job);
+            pthread_mutex_lock(&p->lock);
+            if (--p->pending == 0)
+                pthread_cond_broadcast(&p->done_cond);
+            pthread_mutex_unlock(&p->lock);
+            continue;
+        }
+        pthread_mutex_lock(&p->lock);
+        while (!p->stop && atomic_load(&p->queued) == 0)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->stop && atomic_load(&p->queued) == 0) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    if (p->fini)
+        p->fini(p->opaque, state);
+    return NULL;
+}
+
+ljs_pool *ljs_pool_new(int workers, ljs_pool_init_fn init,
+                       ljs_pool_fini_fn fini, ljs_pool_run_fn run,
+                       void *opaque) {
+    ljs_pool *p;
+
+    if (workers < 1)
+        workers = 1;
+    p = mi_zalloc(sizeof(*p));
+    if (!p)
+        return NULL;
+    p->deques = mi_zalloc(sizeof(p->deques[0]) * workers);
+    p->threads = mi_zalloc(sizeof(p->threads[0]) * workers);
+    p->args = mi_zalloc(sizeof(p->args[0]) * workers);
+    if (!p->deques || !p->threads || !p->args) {
+        mi_free(p->deques);
+        mi_free(p->threads);
+        mi_free(p->args);
+        mi_free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    pthread_cond_init(&p->done_cond, NULL);
+    atomic_init(&p->queued, 0);
+    p->workers = workers;
+    p->slots = workers;
+    p->init = init;
+    p->fini = fini;
+    p->run = run;
+    p->opaque = opaque;
+    for (int i = 0; i < workers; i++)
+        pthread_mutex_init(&p->deques[i].lock, NULL);
+
+    for (; p->started < workers; p->started++) {
+        p->args[p->started].pool = p;
+        p->args[p->started].idx = p->started;
+        if (pthread_create(&p->threads[p->started], NULL, worker_main,
+                           &p->args[p->started]))
+            break;
+    }
+    if (p->started == 0) {
+        ljs_pool_free(p);
+        return NULL;
+    }
+    /* jobs are only handed to workers that exist */
+    p->workers = p->started;
+    return p;
+}
+
+int ljs_pool_submit(ljs_pool *p, void *job) {
+    int idx;
+
+    pthread_mutex_lock(&p->lock);
+    idx = p->next++ % p->workers;
+    ++p->pending;
+    pthread_mutex_unlock(&p->lock);
+
+    if (deque_push(&p->deques[idx], job)) {
+        pthread_mutex_lock(&p->lock);
+        if (--p->pending == 0)
+            pthread_cond_broadcast(&p->done_cond);
+        pthread_mutex_unlock(&p->lock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    atomic_fetch_add(&p->queued, 1);
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+void ljs_pool_wait(ljs_pool *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->pending > 0)
+        pthread_cond_wait(&p->done_cond, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void ljs_pool_free(ljs_pool *p) {
+    if (!p)
+        return;
+    ljs_pool_wait(p);
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->started; i++)
+        pthread_join(p->threads[i], NULL);
+
+    for (int i = 0; i < p->slots; i++) {
+        mi_free(p->deques[i].jobs);
+        pthread_mutex_destroy(&p->deques[i].lock);
+    }
+    pthread_cond_destroy(&p->done_cond);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    mi_free(p->deques);
+    mi_free(p->threads);
+    mi_free(p->args);
+    mi_free(p);
+}
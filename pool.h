@@ -0,0 +1,24 @@
+#ifndef POOL_H
+#define POOL_H
+
+/* Fixed-size thread pool with per-worker job deques. Each worker owns the
+ * state returned by init (a runtime, typically) for its whole life, runs
+ * its own jobs in submission order and steals from the back of the other
+ * deques once its own is empty. */
+
+typedef void *(*ljs_pool_init_fn)(void *opaque, int idx);
+typedef void (*ljs_pool_fini_fn)(void *opaque, void *state);
+typedef void (*ljs_pool_run_fn)(void *opaque, void *state, void *job);
+
+typedef struct ljs_pool ljs_pool;
+
+ljs_pool *ljs_pool_new(int workers, ljs_pool_init_fn init,
+                       ljs_pool_fini_fn fini, ljs_pool_run_fn run,
+                       void *opaque);
+int ljs_pool_submit(ljs_pool *p, void *job);
+// block until every submitted job has run
+void ljs_pool_wait(ljs_pool *p);
+// wait, then stop and join the workers
+void ljs_pool_free(ljs_pool *p);
+
+#endif // POOL_H
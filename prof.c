@@ -0,0 +1,208 @@
+#include "prof.h"
+#include "hash.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <mimalloc.h>
+
+#define PROF_MAX_DEPTH 128
+
+typedef struct {
+    char *stack; // folded, outermost frame first
+    uint64_t hash;
+    uint64_t count;
+} prof_entry;
+
+struct ljs_prof {
+    atomic_int tick;
+    int hz;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    prof_entry *tab; // open addressing, stack == NULL is empty
+    uint32_t mask;
+    uint32_t count;
+};
+
+static void *prof_thread(void *opaque) {
+    ljs_prof *p = opaque;
+    long step = 1000000000L / p->hz;
+    struct timespec ts;
+
+    pthread_mutex_lock(&p->lock);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    while (!p->stop) {
+        ts.tv_nsec += step;
+        while (ts.tv_nsec >= 1000000000L) {
+            ts.tv_nsec -= 1000000000L;
+            ts.tv_sec++;
+        }
+        // the condition only exists so that ljs_prof_free is not delayed
+        if (pthread_cond_timedwait(&p->cond, &p->lock, &ts) == ETIMEDOUT)
+            atomic_store_explicit(&p->tick, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+ljs_prof *ljs_prof_new(int hz) {
+    ljs_prof *p = mi_zalloc(sizeof(ljs_prof));
+    if (!p)
+        return NULL;
+    p->hz = hz < 1 ? 1 : hz > 10000 ? 10000 : hz;
+    p->mask = 255;
+    p->tab = mi_calloc(p->mask + 1, sizeof(prof_entry));
+    if (!p->tab) {
+        mi_free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    if (pthread_create(&p->thread, NULL, prof_thread, p)) {
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->lock);
+        mi_free(p->tab);
+        mi_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+static prof_entry *prof_slot(prof_entry *tab, uint32_t mask, const char *s,
+                             uint64_t hash) {
+    uint32_t i = hash & mask;
+    while (tab[i].stack &&
+           (tab[i].hash != hash || strcmp(tab[i].stack, s) != 0))
+        i = (i + 1) & mask;
+    return &tab[i];
+}
+
+static int prof_add(ljs_prof *p, const char *s) {
+    uint64_t hash = ljs_hash_str(s);
+    prof_entry *e = prof_slot(p->tab, p->mask, s, hash);
+
+    if (e->stack) {
+        e->count++;
+        return 0;
+    }
+    if ((p->count + 1) * 2 > p->mask + 1) {
+        uint32_t mask = p->mask * 2 + 1;
+        prof_entry *tab = mi_calloc(mask + 1, sizeof(prof_entry));
+        if (!tab)
+            return -1;
+        for (uint32_t i = 0; i <= p->mask; ++i)
+            if (p->tab[i].stack)
+                *prof_slot(tab, mask, p->tab[i].stack, p->tab[i].hash) =
+                    p->tab[i];
+        mi_free(p->tab);
+        p->tab = tab;
+        p->mask = mask;
+        e = prof_slot(p->tab, p->mask, s, hash);
+    }
+    e->stack = mi_strdup(s);
+    if (!e->stack)
+        return -1;
+    e->hash = hash;
+    e->count = 1;
+    p->count++;
+    return 0;
+}
+
+/* Turns an Error.stack ("    at f (file.js:3)\n" per frame, innermost
+ * first) into one folded line. ';' separates frames in that format, so it
+ * may not appear inside one. */
+static int prof_fold(ljs_prof *p, const char *stack) {
+    const char *frames[PROF_MAX_DEPTH];
+    size_t lens[PROF_MAX_DEPTH], total = 0;
+    int n = 0, ret;
+    char *out, *q;
+
+    for (const char *s = stack; *s && n < PROF_MAX_DEPTH;) {
+        const char *end = strchr(s, '\n');
+        size_t len = end ? (size_t)(end - s) : strlen(s);
+        while (len && *s == ' ') {
+            s++;
+            len--;
+        }
+        if (len > 3 && !strncmp(s, "at ", 3)) {
+            frames[n] = s + 3;
+            lens[n] = len - 3;
+            total += lens[n] + 1;
+            n++;
+        }
+        s += len;
+        if (*s == '\n')
+            s++;
+    }
+    if (n == 0)
+        return -1;
+
+    q = out = mi_malloc(total);
+    if (!out)
+        return -1;
+    for (int i = n - 1; i >= 0; --i) {
+        for (size_t k = 0; k < lens[i]; ++k)
+            *q++ = frames[i][k] == ';' ? ':' : frames[i][k];
+        *q++ = i ? ';' : '\0';
+    }
+    ret = prof_add(p, out);
+    mi_free(out);
+    return ret;
+}
+
+void ljs_prof_poll(ljs_prof *p, JSContext *ctx, JSValueConst error) {
+    JSValue err, stack;
+    const char *s = NULL;
+
+    if (!atomic_exchange_explicit(&p->tick, 0, memory_order_relaxed))
+        return;
+    if (!JS_IsFunction(ctx, error))
+        return;
+
+    err = JS_CallConstructor(ctx, error, 0, NULL);
+    stack = JS_GetPropertyStr(ctx, err, "stack");
+    if (JS_IsString(stack))
+        s = JS_ToCString(ctx, stack);
+    // a failed sample is dropped, it must not surface in the script
+    if (JS_IsException(err) || JS_IsException(stack) ||
+        (JS_IsString(stack) && !s))
+        JS_FreeValue(ctx, JS_GetException(ctx));
+    if (s)
+        prof_fold(p, s);
+
+    JS_FreeCString(ctx, s);
+    JS_FreeValue(ctx, stack);
+    JS_FreeValue(ctx, err);
+}
+
+int ljs_prof_write(ljs_prof *p, FILE *fp) {
+    for (uint32_t i = 0; i <= p->mask; ++i) {
+        if (p->tab[i].stack &&
+            fprintf(fp, "%s %llu\n", p->tab[i].stack,
+                    (unsigned long long)p->tab[i].count) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+void ljs_prof_free(ljs_prof *p) {
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    for (uint32_t i = 0; i <= p->mask; ++i)
+        mi_free(p->tab[i].stack);
+    mi_free(p->tab);
+    mi_free(p);
+}
@@ -0,0 +1,27 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+
+#include <quickjs.h>
+
+/* Sampling profiler. A timer thread raises a flag hz times a second and
+ * the runtime's interrupt handler takes the sample at the next safe point.
+ * A sample is the JS call stack, taken from the backtrace of an Error
+ * object, so every frame already carries its function name and file:line
+ * from the bytecode's debug info. Identical stacks are counted together
+ * and written in the folded format flamegraph tools read. */
+
+typedef struct ljs_prof ljs_prof;
+
+ljs_prof *ljs_prof_new(int hz);
+/* Cheap enough for every interrupt poll; samples only when the timer
+ * fired. error is ctx's Error constructor as it was before any script ran,
+ * so a script that replaces globalThis.Error is never called from here. */
+void ljs_prof_poll(ljs_prof *p, JSContext *ctx, JSValueConst error);
+// one "outer;...;inner count" line per distinct stack
+int ljs_prof_write(ljs_prof *p, FILE *fp);
+// stops the timer thread
+void ljs_prof_free(ljs_prof *p);
+
+#endif // PROF_H
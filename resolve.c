@@ -0,0 +1,243 @@
+#include "resolve.h"
+#include "hash.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <mimalloc.h>
+
+typedef struct {
+    char *name; // lexical name; NULL is an empty slot
+    uint64_t hash;
+    const char *target; // a file's canonical name, NULL if not a file
+} resolve_name;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    char *name; // canonical name; NULL is an empty slot
+} resolve_file;
+
+struct ljs_resolver {
+    pthread_mutex_t lock;
+    resolve_name *names; // open addressing, both tables
+    uint32_t names_mask;
+    uint32_t names_count;
+    resolve_file *files;
+    uint32_t files_mask;
+    uint32_t files_count;
+};
+
+ljs_resolver *ljs_resolver_new(void) {
+    ljs_resolver *r = mi_zalloc(sizeof(ljs_resolver));
+    if (!r)
+        return NULL;
+    pthread_mutex_init(&r->lock, NULL);
+    return r;
+}
+
+void ljs_resolver_free(ljs_resolver *r) {
+    if (!r)
+        return;
+    for (uint32_t i = 0; r->names && i <= r->names_mask; ++i)
+        mi_free(r->names[i].name);
+    for (uint32_t i = 0; r->files && i <= r->files_mask; ++i)
+        mi_free(r->files[i].name);
+    mi_free(r->names);
+    mi_free(r->files);
+    pthread_mutex_destroy(&r->lock);
+    mi_free(r);
+}
+
+char *ljs_resolve_name(const char *base, const char *spec) {
+    const char *p, *s = spec;
+    size_t len, cap;
+    char *out;
+
+    if (spec[0] != '.')
+        return mi_strdup(spec);
+    p = strrchr(base, '/');
+    len = p ? (size_t)(p - base) : 0;
+    cap = len + strlen(spec) + 2;
+    out = mi_malloc(cap);
+    if (!out)
+        return NULL;
+    memcpy(out, base, len);
+    out[len] = '\0';
+    for (;;) {
+        if (s[0] == '.' && s[1] == '/') {
+            s += 2;
+        } else if (s[0] == '.' && s[1] == '.' && s[2] == '/') {
+            char *q;
+            // drop the last directory, unless it is itself "." or ".."
+            if (out[0] == '\0')
+                break;
+            q = strrchr(out, '/');
+            q = q ? q + 1 : out;
+            if (!strcmp(q, ".") || !strcmp(q, ".."))
+                break;
+            if (q > out)
+                q--;
+            *q = '\0';
+            s += 3;
+        } else {
+            break;
+        }
+    }
+    len = strlen(out);
+    snprintf(out + len, cap - len, "%s%s", len ? "/" : "", s);
+    return out;
+}
+
+static resolve_name *name_slot(resolve_name *tab, uint32_t mask,
+                               const char *s, uint64_t hash) {
+    uint32_t i = hash & mask;
+    while (tab[i].name && (tab[i].hash != hash || strcmp(tab[i].name, s)))
+        i = (i + 1) & mask;
+    return &tab[i];
+}
+
+static uint64_t file_hash(uint64_t dev, uint64_t ino) {
+    return ljs_hash_mix(dev * 0x9e3779b97f4a7c15ULL ^ ino);
+}
+
+static resolve_file *file_slot(resolve_file *tab, uint32_t mask, uint64_t dev,
+                               uint64_t ino) {
+    uint32_t i = file_hash(dev, ino) & mask;
+    while (tab[i].name && (tab[i].dev != dev || tab[i].ino != ino))
+        i = (i + 1) & mask;
+    return &tab[i];
+}
+
+// room for one more entry in each table
+static int reserve(ljs_resolver *r) {
+    if ((r->names_count + 1) * 2 > r->names_mask) {
+        uint32_t mask = r->names_mask ? r->names_mask * 2 + 1 : 63;
+        resolve_name *tab = mi_calloc(mask + 1, sizeof(resolve_name));
+        if (!tab)
+            return -1;
+        for (uint32_t i = 0; r->names && i <= r->names_mask; ++i)
+            if (r->names[i].name)
+                *name_slot(tab, mask, r->names[i].name, r->names[i].hash) =
+                    r->names[i];
+        mi_free(r->names);
+        r->names = tab;
+        r->names_mask = mask;
+    }
+    if ((r->files_count + 1) * 2 > r->files_mask) {
+        uint32_t mask = r->files_mask ? r->files_mask * 2 + 1 : 63;
+        resolve_file *tab = mi_calloc(mask + 1, sizeof(resolve_file));
+        if (!tab)
+            return -1;
+        for (uint32_t i = 0; r->files && i <= r->files_mask; ++i)
+            if (r->files[i].name)
+                *file_slot(tab, mask, r->files[i].dev, r->files[i].ino) =
+                    r->files[i];
+        mi_free(r->files);
+        r->files = tab;
+        r->files_mask = mask;
+    }
+    return 0;
+}
+
+// name, or name with ".js", as a regular file; its name in *path
+static int stat_module(const char *name, char **path, struct stat *st) {
+    size_t len = strlen(name);
+
+    if (!stat(name, st) && S_ISREG(st->st_mode)) {
+        *path = mi_strdup(name);
+        return *path ? 0 : -1;
+    }
+    *path = mi_malloc(len + 4);
+    if (!*path)
+        return -1;
+    memcpy(*path, name, len);
+    memcpy(*path + len, ".js", 4);
+    if (!stat(*path, st) && S_ISREG(st->st_mode))
+        return 0;
+    mi_free(*path);
+    *path = NULL;
+    return 0;
+}
+
+static const char *resolve_locked(ljs_resolver *r, const char *name) {
+    uint64_t hash = ljs_hash_str(name);
+    resolve_name *e;
+    resolve_file *f = NULL;
+    struct stat st;
+    char *path;
+
+    if (r->names) {
+        e = name_slot(r->names, r->names_mask, name, hash);
+        if (e->name)
+            return e->target ? e->target : e->name;
+    }
+    if (reserve(r) || stat_module(name, &path, &st))
+        return NULL;
+    if (path) {
+        // without inode numbers (Windows) only identical names dedup
+        uint64_t ino = st.st_ino ? (uint64_t)st.st_ino : ljs_hash_str(path);
+        f = file_slot(r->files, r->files_mask, st.st_dev, ino);
+        if (f->name) {
+            mi_free(path);
+        } else {
+            f->dev = st.st_dev;
+            f->ino = ino;
+            f->name = path;
+            r->files_count++;
+        }
+    }
+    e = name_slot(r->names, r->names_mask, name, hash);
+    e->name = mi_strdup(name);
+    if (!e->name)
+        return NULL;
+    e->hash = hash;
+    e->target = f ? f->name : NULL;
+    r->names_count++;
+    return e->target ? e->target : e->name;
+}
+
+char *ljs_resolve(ljs_resolver *r, const char *name) {
+    const char *s;
+    char *ret = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    s = resolve_locked(r, name);
+    if (s)
+        ret = mi_strdup(s);
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+int ljs_resolver_aliases(ljs_resolver *r,
+                         int (*fn)(void *opaque, const char *name,
+                                   const char *target),
+                         void *opaque) {
+    int ret = 0;
+
+    pthread_mutex_lock(&r->lock);
+    for (uint32_t i = 0; r->names && i <= r->names_mask && !ret; ++i) {
+        resolve_name *e = &r->names[i];
+        if (e->name && e->target && strcmp(e->name, e->target))
+            ret = fn(opaque, e->name, e->target);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+int ljs_resolver_files(ljs_resolver *r,
+                       int (*fn)(void *opaque, const char *name),
+                       void *opaque) {
+    int ret = 0;
+
+    pthread_mutex_lock(&r->lock);
+    for (uint32_t i = 0; r->files && i <= r->files_mask && !ret; ++i) {
+        if (r->files[i].name)
+            ret = fn(opaque, r->files[i].name);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
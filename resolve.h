@@ -0,0 +1,37 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+/* Module resolution. The engine keeps one instance per module name, so a
+ * file reached through two spellings (./a and ./a.js, ../x/a.js from
+ * inside x, a symlink) used to be compiled and run twice. The resolver
+ * turns every spelling into one canonical name: the first name seen for
+ * the file's device and inode. Names stay relative like the engine's own,
+ * so they can go into a bundle and mean the same thing on another machine.
+ *
+ * Each lexical name is stat'ed once per resolver, and names that are not a
+ * file are remembered too, so a deep import graph costs one stat per
+ * distinct spelling. The resolver is locked and may be shared by threads. */
+
+typedef struct ljs_resolver ljs_resolver;
+
+ljs_resolver *ljs_resolver_new(void);
+void ljs_resolver_free(ljs_resolver *r);
+
+// spec as imported from the module base, normalized the way the engine's
+// default does: only a leading run of ./ and ../ is folded into the
+// directory of base. mi_malloc'd, NULL on OOM
+char *ljs_resolve_name(const char *base, const char *spec);
+// the canonical name for a lexical name, with ".js" appended when only
+// that exists; name itself if neither is a regular file. mi_malloc'd
+char *ljs_resolve(ljs_resolver *r, const char *name);
+// calls fn for every lexical name that resolved to a different one
+int ljs_resolver_aliases(ljs_resolver *r,
+                         int (*fn)(void *opaque, const char *name,
+                                   const char *target),
+                         void *opaque);
+// calls fn with the canonical name of every file resolved so far
+int ljs_resolver_files(ljs_resolver *r,
+                       int (*fn)(void *opaque, const char *name),
+                       void *opaque);
+
+#endif // RESOLVE_H
@@ -0,0 +1,197 @@
+#include "trace.h"
+#include "clock.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <mimalloc.h>
+
+#define TRACE_MAX_PHASES 32
+
+typedef struct {
+    const char *name;
+    char *arg;
+    uint64_t start; // ns since ljs_trace_enable
+    uint64_t dur;
+    int tid;
+    int parent; // enclosing span on the same thread, or -1
+} trace_span;
+
+static struct {
+    atomic_int enabled;
+    atomic_int next_tid;
+    pthread_mutex_t lock;
+    uint64_t base;
+    trace_span *spans;
+    int len;
+    int cap;
+} trace = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static _Thread_local int trace_tid;
+static _Thread_local int trace_open = -1;
+
+void ljs_trace_enable(void) {
+    pthread_mutex_lock(&trace.lock);
+    if (!atomic_load(&trace.enabled)) {
+        trace.base = ljs_clock_ns();
+        atomic_store(&trace.enabled, 1);
+    }
+    pthread_mutex_unlock(&trace.lock);
+}
+
+int ljs_trace_enabled(void) {
+    return atomic_load_explicit(&trace.enabled, memory_order_relaxed);
+}
+
+int ljs_trace_begin(const char *name, const char *arg) {
+    trace_span *s;
+    int idx = -1;
+
+    if (!ljs_trace_enabled())
+        return -1;
+    if (!trace_tid)
+        trace_tid = atomic_fetch_add(&trace.next_tid, 1) + 1;
+
+    pthread_mutex_lock(&trace.lock);
+    if (trace.len == trace.cap) {
+        int cap = trace.cap ? trace.cap * 2 : 64;
+        s = mi_realloc(trace.spans, cap * sizeof(trace_span));
+        if (!s)
+            goto done;
+        trace.spans = s;
+        trace.cap = cap;
+    }
+    idx = trace.len++;
+    s = &trace.spans[idx];
+    s->name = name;
+    s->arg = arg ? mi_strdup(arg) : NULL;
+    s->tid = trace_tid;
+    s->parent = trace_open;
+    trace_open = idx;
+    s->dur = 0;
+    // last, so that the lock and the copy are not part of the span
+    s->start = ljs_clock_ns() - trace.base;
+done:
+    pthread_mutex_unlock(&trace.lock);
+    return idx;
+}
+
+void ljs_trace_end(int span) {
+    uint64_t now;
+
+    if (span < 0)
+        return;
+    now = ljs_clock_ns() - trace.base;
+    pthread_mutex_lock(&trace.lock);
+    if (span < trace.len) {
+        trace.spans[span].dur = now - trace.spans[span].start;
+        trace_open = trace.spans[span].parent;
+    }
+    pthread_mutex_unlock(&trace.lock);
+}
+
+static void trace_put_str(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+int ljs_trace_write_json(FILE *fp) {
+    pthread_mutex_lock(&trace.lock);
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int i = 0; i < trace.len; ++i) {
+        trace_span *s = &trace.spans[i];
+        fprintf(fp, "%s\n{\"name\":", i ? "," : "");
+        trace_put_str(fp, s->name);
+        fprintf(fp,
+                ",\"cat\":\"startup\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+                s->start / 1e3, s->dur / 1e3, s->tid);
+        if (s->arg) {
+            fprintf(fp, ",\"args\":{\"name\":");
+            trace_put_str(fp, s->arg);
+            fputc('}', fp);
+        }
+        fputc('}', fp);
+    }
+    fprintf(fp, "\n]}\n");
+    pthread_mutex_unlock(&trace.lock);
+    return ferror(fp) ? -1 : 0;
+}
+
+int ljs_trace_write_table(FILE *fp) {
+    struct {
+        const char *name;
+        int count;
+        uint64_t total;
+        uint64_t self;
+        const trace_span *max;
+    } phases[TRACE_MAX_PHASES];
+    int n = 0;
+    uint64_t end = 0;
+
+    pthread_mutex_lock(&trace.lock);
+    for (int i = 0; i < trace.len; ++i) {
+        const trace_span *s = &trace.spans[i];
+        int k = 0;
+        while (k < n && strcmp(phases[k].name, s->name))
+            k++;
+        if (k == n) {
+            if (n == TRACE_MAX_PHASES)
+                continue;
+            phases[n].name = s->name;
+            phases[n].count = 0;
+            phases[n].total = 0;
+            phases[n].self = 0;
+            phases[n].max = s;
+            n++;
+        }
+        phases[k].count++;
+        phases[k].total += s->dur;
+        phases[k].self += s->dur;
+        if (s->dur > phases[k].max->dur)
+            phases[k].max = s;
+        if (s->start + s->dur > end)
+            end = s->start + s->dur;
+        if (s->parent >= 0) {
+            const char *pname = trace.spans[s->parent].name;
+            for (k = 0; k < n && strcmp(phases[k].name, pname); ++k)
+                ;
+            if (k < n)
+                phases[k].self -= s->dur;
+        }
+    }
+
+    // total includes nested phases, self leaves them out
+    fprintf(fp, "%-14s %6s %10s %10s %10s  %s\n", "phase", "count",
+            "total ms", "self ms", "max ms", "slowest");
+    for (int k = 0; k < n; ++k)
+        fprintf(fp, "%-14s %6d %10.3f %10.3f %10.3f  %s\n", phases[k].name,
+                phases[k].count, phases[k].total / 1e6,
+                (int64_t)phases[k].self / 1e6, phases[k].max->dur / 1e6,
+                phases[k].max->arg ? phases[k].max->arg : "");
+    fprintf(fp, "%-14s %6s %10.3f\n", "wall", "", end / 1e6);
+    pthread_mutex_unlock(&trace.lock);
+    return ferror(fp) ? -1 : 0;
+}
+
+void ljs_trace_free(void) {
+    pthread_mutex_lock(&trace.lock);
+    atomic_store(&trace.enabled, 0);
+    for (int i = 0; i < trace.len; ++i)
+        mi_free(trace.spans[i].arg);
+    mi_free(trace.spans);
+    trace.spans = NULL;
+    trace.len = trace.cap = 0;
+    pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,23 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+/* Startup tracing. Spans are timestamped with the monotonic clock and kept
+ * in one process-wide list, so phases on pool workers land in the same
+ * trace under their own thread id. Until ljs_trace_enable is called a span
+ * costs one relaxed load, which is why the hooks stay in release builds. */
+
+void ljs_trace_enable(void);
+int ljs_trace_enabled(void);
+// name must outlive the trace (a literal); arg, a file or module name, is
+// copied and may be NULL. Returns a handle for ljs_trace_end, -1 if off.
+int ljs_trace_begin(const char *name, const char *arg);
+void ljs_trace_end(int span);
+// Chrome trace-event JSON, for chrome://tracing or Perfetto
+int ljs_trace_write_json(FILE *fp);
+// one line per phase: count, total and slowest span
+int ljs_trace_write_table(FILE *fp);
+void ljs_trace_free(void);
+
+#endif // TRACE_H
@@ -0,0 +1,210 @@
+#include "watch.h"
+#include "jsc.h"
+#include "loop.h"
+
+#include <stdio.h>
+
+#if !defined(__linux__)
+
+int ljs_watch(JSRuntime *rt, const char *entry, const ljs_watch_opts *o) {
+    fprintf(stderr, "watch mode needs inotify, which is Linux only\n");
+    return -1;
+}
+
+#else
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <mimalloc.h>
+
+// an editor's save is often several events; wait for them to stop
+#define WATCH_SETTLE_MS 50
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+
+typedef struct {
+    int wd;     // of the directory
+    char *base; // name within the directory
+    char *name; // module name
+    int changed;
+} watch_file;
+
+typedef struct {
+    int fd; // inotify
+    watch_file *files;
+    int len;
+    int cap;
+} watch_set;
+
+static watch_file *watch_find(watch_set *w, const char *name) {
+    for (int i = 0; i < w->len; i++) {
+        if (!strcmp(w->files[i].name, name))
+            return &w->files[i];
+    }
+    return NULL;
+}
+
+static int watch_add(void *opaque, const char *name) {
+    watch_set *w = opaque;
+    const char *slash = strrchr(name, '/');
+    char dir[PATH_MAX];
+    watch_file *f;
+    int wd;
+
+    if (watch_find(w, name))
+        return 0;
+    if (!slash)
+        snprintf(dir, sizeof(dir), ".");
+    else if (slash == name)
+        snprintf(dir, sizeof(dir), "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - name), name);
+    // a directory watched already gives back the same descriptor
+    wd = inotify_add_watch(w->fd, dir, WATCH_EVENTS);
+    if (wd < 0)
+        return 0;
+    if (w->len >= w->cap) {
+        int cap = w->cap + (w->cap >> 1) + 16;
+        watch_file *files = mi_realloc(w->files, sizeof(watch_file) * cap);
+        if (!files)
+            return -1;
+        w->files = files;
+        w->cap = cap;
+    }
+    f = &w->files[w->len];
+    f->wd = wd;
+    f->base = mi_strdup(slash ? slash + 1 : name);
+    f->name = mi_strdup(name);
+    f->changed = 0;
+    if (!f->base || !f->name) {
+        mi_free(f->base);
+        mi_free(f->name);
+        return -1;
+    }
+    w->len++;
+    return 0;
+}
+
+static void watch_free(watch_set *w) {
+    for (int i = 0; i < w->len; i++) {
+        mi_free(w->files[i].base);
+        mi_free(w->files[i].name);
+    }
+    mi_free(w->files);
+    close(w->fd);
+}
+
+// mark the files pending events name; 1 if any was one of ours
+static int watch_read(watch_set *w) {
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    ssize_t n;
+    int hit = 0;
+
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            for (int i = 0; ev->len && i < w->len; i++) {
+                if (w->files[i].wd == ev->wd &&
+                    !strcmp(w->files[i].base, ev->name)) {
+                    w->files[i].changed = 1;
+                    hit = 1;
+                }
+            }
+        }
+    }
+    return hit;
+}
+
+static void watch_settle(watch_set *w) {
+    struct pollfd p = {.fd = w->fd, .events = POLLIN};
+    while (poll(&p, 1, WATCH_SETTLE_MS) > 0)
+        watch_read(w);
+}
+
+static void watch_wait(watch_set *w) {
+    struct pollfd p = {.fd = w->fd, .events = POLLIN};
+
+    fprintf(stderr, "watching %d files for changes\n", w->len);
+    while (!watch_read(w)) {
+        if (poll(&p, 1, -1) < 0 && errno != EINTR)
+            return;
+    }
+    watch_settle(w);
+}
+
+static int watch_changed(void *opaque, const char *name) {
+    watch_file *f = watch_find(opaque, name);
+    return !f || f->changed;
+}
+
+// run until a watched file changes; events about other files in the same
+// directories let the script go on
+static int watch_run(lanyt_js *ljs, watch_set *w, int silent) {
+    int r = lanyt_js_run2(ljs, silent, w->fd);
+    while (r == 1 && !watch_read(w))
+        r = ljs_loop_run(lanyt_js_get_ctx(ljs), w->fd);
+    return r;
+}
+
+int ljs_watch(JSRuntime *rt, const char *entry, const ljs_watch_opts *o) {
+    watch_set w = {0};
+    lanyt_js *ljs, *old = NULL;
+    int r = -1;
+
+    w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w.fd < 0) {
+        fprintf(stderr, "inotify: %s\n", strerror(errno));
+        return -1;
+    }
+    if (watch_add(&w, entry))
+        goto done;
+    for (;;) {
+        ljs = lanyt_new_js2(rt, o->intrinsics);
+        if (!ljs) {
+            fprintf(stderr, "create js context failed\n");
+            break;
+        }
+        if (o->cache_dir && lanyt_js_set_cache_dir(ljs, o->cache_dir)) {
+            lanyt_free_js(ljs);
+            break;
+        }
+        js_std_add_helpers(lanyt_js_get_ctx(ljs), o->argc, o->argv);
+        r = 0;
+        if (old) {
+            r = lanyt_js_adopt(ljs, old, entry, watch_changed, &w);
+            lanyt_free_js(old);
+            old = NULL;
+            // timers and worker ports of the last run still held by libc
+            js_std_free_handlers(rt);
+            js_std_init_handlers(rt);
+            for (int i = 0; i < w.len; i++)
+                w.files[i].changed = 0;
+        }
+        r = r ? 0 : lanyt_js_eval(ljs, entry);
+        if (r == 0)
+            r = watch_run(ljs, &w, o->silent);
+        // also a module that failed to compile, so that fixing it reruns
+        if (lanyt_js_files(ljs, watch_add, &w)) {
+            lanyt_free_js(ljs);
+            r = -1;
+            break;
+        }
+        if (r == 1)
+            watch_settle(&w);
+        else
+            watch_wait(&w);
+        old = ljs;
+    }
+done:
+    lanyt_free_js(old);
+    watch_free(&w);
+    return -1;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <quickjs.h>
+
+/* `run --watch`: run a script, and again each time one of its files is
+ * saved. Every run gets a fresh context on the same runtime; modules whose
+ * file did not change keep their bytecode from the run before (see
+ * lanyt_js_adopt), so a save costs one compile, not the whole graph. The
+ * entry and every file it imported are watched through their directories,
+ * which also catches editors that save by renaming a new file into place.
+ * A change interrupts a script still running its event loop. Linux only
+ * (inotify). */
+
+typedef struct {
+    int intrinsics;
+    const char *cache_dir;
+    int silent;
+    int argc; // for js_std_add_helpers
+    char **argv;
+} ljs_watch_opts;
+
+// returns only on error
+int ljs_watch(JSRuntime *rt, const char *entry, const ljs_watch_opts *o);
+
+#endif // WATCH_H
@@ -0,0 +1,276 @@
+#include "module.h"
+
+#include <pthread.h>
+
+#include <cutils.h>
+#include <quickjs.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* lanyt:worker fans work out over os.Worker threads:
+ *
+ *   // main.js
+ *   import { Pool } from "lanyt:worker";
+ *   const sab = new SharedArrayBuffer(n * 8), pool = new Pool("./sum.js");
+ *   const parts = await pool.map(ranges.map((r) => ({ sab, r })));
+ *
+ *   // sum.js
+ *   import { serve } from "lanyt:worker";
+ *   serve(({ sab, r }) => sum(new Float64Array(sab), r));
+ *
+ * Messages go through libc's serializer, which passes a SharedArrayBuffer
+ * by reference: every runtime sees the same memory, and worker threads may
+ * block in Atomics.wait. It has no transfer list, so a plain ArrayBuffer
+ * named in one is copied once and detached on the sending side. A Pool
+ * keeps its workers listening only while they start or tasks are out, so
+ * an idle pool does not keep the program alive. Its workers run
+ * lanyt:worker_boot, which imports the script and reports back: a script
+ * that throws while loading or never calls serve rejects the pool's tasks
+ * rather than leaving them waiting. */
+
+static JSValue js_worker_cpus(JSContext *ctx, JSValueConst this_val, int argc,
+                              JSValueConst *argv) {
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return JS_NewInt32(ctx, si.dwNumberOfProcessors);
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return JS_NewInt32(ctx, n > 0 ? n : 1);
+#endif
+}
+
+static JSValue js_worker_path(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv) {
+    return lanyt_js_caller_path(ctx, argv[0]);
+}
+
+static JSValue js_worker_detach(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv) {
+    JS_DetachArrayBuffer(ctx, argv[0]);
+    return JS_UNDEFINED;
+}
+
+static const JSCFunctionListEntry js_worker_core_funcs[] = {
+    JS_CFUNC_DEF("cpus", 0, js_worker_cpus),
+    JS_CFUNC_DEF("detach", 1, js_worker_detach),
+    JS_CFUNC_DEF("path", 1, js_worker_path),
+};
+
+static int js_worker_core_init(JSContext *ctx, JSModuleDef *m) {
+    return JS_SetModuleExportList(ctx, m, js_worker_core_funcs,
+                                  countof(js_worker_core_funcs));
+}
+
+JSModuleDef *lanyt_js_init_module_worker_core(JSContext *ctx,
+                                              const char *module_name) {
+    JSModuleDef *m;
+    m = JS_NewCModule(ctx, module_name, js_worker_core_init);
+    if (!m)
+        return NULL;
+    JS_AddModuleExportList(ctx, m, js_worker_core_funcs,
+                           countof(js_worker_core_funcs));
+    return m;
+}
+
+static const char worker_source[] =
+    "import { Worker as OsWorker } from 'os';\n"
+    "import { cpus, detach, path } from 'lanyt:worker_core';\n"
+    "export { cpus };\n"
+    "\n"
+    "function release(transfer) {\n"
+    "    for (const b of transfer || []) {\n"
+    "        const buf = ArrayBuffer.isView(b) ? b.buffer : b;\n"
+    "        if (buf instanceof ArrayBuffer)\n"
+    "            detach(buf);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "export class Worker extends OsWorker {\n"
+    "    postMessage(msg, transfer) {\n"
+    "        super.postMessage(msg);\n"
+    "        release(transfer);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "export function post(msg, transfer) {\n"
+    "    OsWorker.parent.postMessage(msg);\n"
+    "    release(transfer);\n"
+    "}\n"
+    "\n"
+    "let served = false, closed = false;\n"
+    "\n"
+    "// a closed pool has its workers stop listening, which ends their loop\n"
+    "function closing(parent, msg) {\n"
+    "    if (!msg.close)\n"
+    "        return false;\n"
+    "    closed = true;\n"
+    "    parent.onmessage = null;\n"
+    "    return true;\n"
+    "}\n"
+    "\n"
+    "export function serve(fn) {\n"
+    "    const parent = OsWorker.parent;\n"
+    "    served = true;\n"
+    "    if (closed)\n"
+    "        return;\n"
+    "    parent.onmessage = async (e) => {\n"
+    "        if (closing(parent, e.data))\n"
+    "            return;\n"
+    "        const { id, data } = e.data;\n"
+    "        let reply;\n"
+    "        try {\n"
+    "            reply = { id, result: await fn(data) };\n"
+    "        } catch (err) {\n"
+    "            reply = { id, error: String((err && err.stack) || err) };\n"
+    "        }\n"
+    "        parent.postMessage(reply);\n"
+    "    };\n"
+    "}\n"
+    "\n"
+    "export function boot() {\n"
+    "    const parent = OsWorker.parent;\n"
+    "    parent.onmessage = async (e) => {\n"
+    "        if (closing(parent, e.data))\n"
+    "            return;\n"
+    "        let msg = { ready: true };\n"
+    "        try {\n"
+    "            await import(e.data.load);\n"
+    "            if (!served)\n"
+    "                throw new Error(`${e.data.load} did not call serve()`);\n"
+    "        } catch (err) {\n"
+    "            msg = { failed: String((err && err.stack) || err) };\n"
+    "            parent.onmessage = null;\n"
+    "        }\n"
+    "        if (!closed)\n"
+    "            parent.postMessage(msg);\n"
+    "    };\n"
+    "}\n"
+    "\n"
+    "export class Pool {\n"
+    "    #slots = [];\n"
+    "    #idle = [];\n"
+    "    #queue = [];\n"
+    "    #head = 0;\n"
+    "    #busy = 0; // slots starting or running a task\n"
+    "    #next = 1;\n"
+    "    #error = null; // what run rejects with once closed or broken\n"
+    "\n"
+    "    constructor(filename, size = cpus()) {\n"
+    "        const load = path(filename);\n"
+    "        for (let i = 0; i < size; i++) {\n"
+    "            const worker = new Worker('lanyt:worker_boot');\n"
+    "            const slot = { worker, task: null };\n"
+    "            this.#slots.push(slot);\n"
+    "            slot.worker.postMessage({ load });\n"
+    "        }\n"
+    "        this.#busy = size;\n"
+    "        if (size)\n"
+    "            this.#listen(true);\n"
+    "    }\n"
+    "\n"
+    "    get size() {\n"
+    "        return this.#slots.length;\n"
+    "    }\n"
+    "\n"
+    "    run(data, transfer) {\n"
+    "        return new Promise((resolve, reject) => {\n"
+    "            if (this.#error)\n"
+    "                return reject(this.#error);\n"
+    "            this.#queue.push({ data, transfer, resolve, reject });\n"
+    "            this.#pump();\n"
+    "        });\n"
+    "    }\n"
+    "\n"
+    "    map(items) {\n"
+    "        return Promise.all(Array.from(items, (x) => this.run(x)));\n"
+    "    }\n"
+    "\n"
+    "    close() {\n"
+    "        this.#fail(new Error('pool closed'));\n"
+    "    }\n"
+    "\n"
+    "    // settle every task still out or queued and stop the workers\n"
+    "    #fail(error) {\n"
+    "        if (this.#error)\n"
+    "            return;\n"
+    "        this.#error = error;\n"
+    "        this.#listen(false);\n"
+    "        for (const slot of this.#slots) {\n"
+    "            slot.worker.postMessage({ close: true });\n"
+    "            if (slot.task)\n"
+    "                slot.task.reject(error);\n"
+    "        }\n"
+    "        for (let i = this.#head; i < this.#queue.length; i++)\n"
+    "            this.#queue[i].reject(error);\n"
+    "        this.#slots = [];\n"
+    "        this.#idle = [];\n"
+    "        this.#queue = [];\n"
+    "        this.#head = 0;\n"
+    "        this.#busy = 0;\n"
+    "    }\n"
+    "\n"
+    "    #pump() {\n"
+    "        while (this.#idle.length && this.#head < this.#queue.length) {\n"
+    "            const slot = this.#idle.pop();\n"
+    "            const task = this.#queue[this.#head];\n"
+    "            this.#queue[this.#head++] = undefined;\n"
+    "            if (this.#busy++ === 0)\n"
+    "                this.#listen(true);\n"
+    "            slot.task = task;\n"
+    "            const msg = { id: this.#next++, data: task.data };\n"
+    "            slot.worker.postMessage(msg, task.transfer);\n"
+    "        }\n"
+    "        if (this.#head === this.#queue.length) {\n"
+    "            this.#queue = [];\n"
+    "            this.#head = 0;\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    // a task's reply, or a starting worker saying whether it is ready\n"
+    "    #done(slot, msg) {\n"
+    "        const task = slot.task;\n"
+    "        if ('failed' in msg)\n"
+    "            return this.#fail(new Error(msg.failed));\n"
+    "        slot.task = null;\n"
+    "        this.#idle.push(slot);\n"
+    "        if (--this.#busy === 0)\n"
+    "            this.#listen(false);\n"
+    "        if (task && 'error' in msg)\n"
+    "            task.reject(new Error(msg.error));\n"
+    "        else if (task)\n"
+    "            task.resolve(msg.result);\n"
+    "        this.#pump();\n"
+    "    }\n"
+    "\n"
+    "    // a worker with a handler keeps libc's loop, and the program, alive\n"
+    "    #listen(on) {\n"
+    "        for (const slot of this.#slots)\n"
+    "            slot.worker.onmessage =\n"
+    "                on ? (e) => this.#done(slot, e.data) : null;\n"
+    "    }\n"
+    "}\n";
+
+static lanyt_js_builtin worker_module = {worker_source};
+
+JSModuleDef *lanyt_js_init_module_worker(JSContext *ctx,
+                                         const char *module_name) {
+    return lanyt_js_load_builtin(ctx, module_name, &worker_module);
+}
+
+/* A Pool worker starts here rather than in its script, so that whatever
+ * the script does while loading gets back to the pool. */
+static const char worker_boot_source[] =
+    "import { boot } from 'lanyt:worker';\n"
+    "boot();\n";
+
+static lanyt_js_builtin worker_boot = {worker_boot_source};
+
+JSModuleDef *lanyt_js_init_module_worker_boot(JSContext *ctx,
+                                              const char *module_name) {
+    return lanyt_js_load_builtin(ctx, module_name, &worker_boot);
+}